@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/uio.h>
+#include "auditlog.h"
+
+#define RING_SLOTS   1024 // records per thread, a power of two
+#define BATCH        64   // records per writev
+#define IDLE_WAIT_MS 10   // flusher sleep when a wakeup might have been missed
+#define LINE_MAX_LEN 116
+
+// One formatted record, a cache line pair so slots never share lines
+typedef struct logRecord {
+    uint64_t seq;
+    int len;
+    char line[LINE_MAX_LEN];
+} logRecord;
+
+// Single-producer ring owned by one worker thread and drained by the
+// flusher. head is only written by the owner and tail by the flusher.
+typedef struct logRing {
+    logRecord slots[RING_SLOTS];
+    _Alignas(64) _Atomic uint64_t head;
+    _Alignas(64) _Atomic uint64_t tail;
+    uint64_t taken; // records of the batch being written, flusher only
+    struct logRing *next;
+    struct logRing *nextSpare;
+} logRing;
+
+typedef struct auditLog {
+    int fd;
+    bool dropWhenFull;
+    // Every record takes the next sequence number, and the flusher writes
+    // them strictly in that order
+    _Alignas(64) _Atomic uint64_t nextSeq;
+    _Alignas(64) _Atomic(logRing *) rings;
+    logRing *spares; // rings of threads that exited, under mutex
+    _Atomic uint64_t flushedSeq;
+    _Atomic bool flusherIdle;
+    _Atomic int waiters;
+    _Atomic long written;
+    _Atomic long dropped;
+    _Atomic long blocked;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;    // records are waiting for the flusher
+    pthread_cond_t drained; // the flusher freed ring space or wrote a batch
+    bool stop;
+    pthread_t flusher;
+} auditLog_t;
+
+// The calling thread's ring, created on its first record
+static _Thread_local logRing *myRing;
+
+// Helper Functions -----------------------------------------------------------
+
+static struct timespec deadlineIn(int ms) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += (long) ms * 1000000;
+    ts.tv_sec += ts.tv_nsec / 1000000000;
+    ts.tv_nsec %= 1000000000;
+    return ts;
+}
+
+static logRing *newRing(auditLog_t *l) {
+    // A ring left by a thread that exited is taken over as it is, records
+    // and all, since the flusher goes by sequence number and not by ring
+    pthread_mutex_lock(&l->mutex);
+    logRing *r = l->spares;
+    if (r != NULL) {
+        l->spares = r->nextSpare;
+        pthread_mutex_unlock(&l->mutex);
+        return r;
+    }
+    pthread_mutex_unlock(&l->mutex);
+
+    r = aligned_alloc(64, sizeof(logRing));
+    assert(r != NULL);
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    r->taken = 0;
+
+    // Rings are only ever added, at the front, so the flusher can walk
+    // the list without a lock
+    pthread_mutex_lock(&l->mutex);
+    r->next = atomic_load(&l->rings);
+    atomic_store(&l->rings, r);
+    pthread_mutex_unlock(&l->mutex);
+    return r;
+}
+
+// Wait until the flusher frees a slot in r
+static void waitForSpace(auditLog_t *l, logRing *r) {
+    atomic_fetch_add(&l->blocked, 1);
+    pthread_mutex_lock(&l->mutex);
+    atomic_fetch_add(&l->waiters, 1);
+    while (atomic_load(&r->head) - atomic_load(&r->tail) == RING_SLOTS) {
+        pthread_cond_signal(&l->wake);
+        struct timespec deadline = deadlineIn(IDLE_WAIT_MS);
+        pthread_cond_timedwait(&l->drained, &l->mutex, &deadline);
+    }
+    atomic_fetch_sub(&l->waiters, 1);
+    pthread_mutex_unlock(&l->mutex);
+}
+
+// Write every iovec, picking up after short writes
+static void writeAll(int fd, struct iovec *iov, int n) {
+    while (n > 0) {
+        ssize_t w = writev(fd, iov, n);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (n > 0 && (size_t) w >= iov->iov_len) {
+            w -= iov->iov_len;
+            iov++;
+            n--;
+        }
+        if (n > 0) {
+            iov->iov_base = (char *) iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+}
+
+// Gather up to BATCH records in sequence order starting at *seq. Stops
+// early at a sequence number that was taken but isn't published yet.
+static int gather(auditLog_t *l, uint64_t *seq, struct iovec *iov) {
+    int n = 0;
+    while (n < BATCH) {
+        logRecord *found = NULL;
+        for (logRing *r = atomic_load(&l->rings); r != NULL; r = r->next) {
+            uint64_t pos = atomic_load(&r->tail) + r->taken;
+            if (pos == atomic_load(&r->head)) {
+                continue;
+            }
+            logRecord *rec = &r->slots[pos & (RING_SLOTS - 1)];
+            if (rec->seq == *seq) {
+                found = rec;
+                r->taken += 1;
+                break;
+            }
+        }
+        if (found == NULL) {
+            break;
+        }
+        iov[n].iov_base = found->line;
+        iov[n].iov_len = found->len;
+        n += 1;
+        *seq += 1;
+    }
+    return n;
+}
+
+// Hand the slots of the written batch back to their rings
+static void release(auditLog_t *l) {
+    for (logRing *r = atomic_load(&l->rings); r != NULL; r = r->next) {
+        if (r->taken > 0) {
+            atomic_fetch_add(&r->tail, r->taken);
+            r->taken = 0;
+        }
+    }
+}
+
+static void *flusher_thread(void *args) {
+    auditLog_t *l = (auditLog_t *) args;
+    struct iovec iov[BATCH];
+    uint64_t seq = 0;
+
+    while (1) {
+        int n = gather(l, &seq, iov);
+        if (n > 0) {
+            writeAll(l->fd, iov, n);
+            release(l);
+            atomic_store(&l->flushedSeq, seq);
+            atomic_fetch_add(&l->written, n);
+            if (atomic_load(&l->waiters) > 0) {
+                pthread_mutex_lock(&l->mutex);
+                pthread_cond_broadcast(&l->drained);
+                pthread_mutex_unlock(&l->mutex);
+            }
+            continue;
+        }
+
+        if (atomic_load(&l->nextSeq) != seq) {
+            // The next record is being filled in right now
+            sched_yield();
+            continue;
+        }
+
+        pthread_mutex_lock(&l->mutex);
+        if (l->stop) {
+            pthread_mutex_unlock(&l->mutex);
+            return args;
+        }
+        atomic_store(&l->flusherIdle, true);
+        if (atomic_load(&l->nextSeq) == seq) {
+            struct timespec deadline = deadlineIn(IDLE_WAIT_MS);
+            pthread_cond_timedwait(&l->wake, &l->mutex, &deadline);
+        }
+        atomic_store(&l->flusherIdle, false);
+        pthread_mutex_unlock(&l->mutex);
+    }
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+auditLog_t *auditlog_new(int fd, bool dropWhenFull) {
+    auditLog_t *l = aligned_alloc(64, sizeof(auditLog_t));
+    assert(l != NULL);
+    l->fd = fd;
+    l->dropWhenFull = dropWhenFull;
+    atomic_init(&l->nextSeq, 0);
+    atomic_init(&l->rings, NULL);
+    l->spares = NULL;
+    atomic_init(&l->flushedSeq, 0);
+    atomic_init(&l->flusherIdle, false);
+    atomic_init(&l->waiters, 0);
+    atomic_init(&l->written, 0);
+    atomic_init(&l->dropped, 0);
+    atomic_init(&l->blocked, 0);
+    l->stop = false;
+
+    int rc;
+    rc = pthread_mutex_init(&l->mutex, NULL);
+    assert(!rc);
+    rc = pthread_cond_init(&l->wake, NULL);
+    assert(!rc);
+    rc = pthread_cond_init(&l->drained, NULL);
+    assert(!rc);
+    rc = pthread_create(&l->flusher, NULL, flusher_thread, l);
+    assert(!rc);
+    return l;
+}
+
+void auditlog_delete(auditLog_t **l) {
+    if (*l == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&(*l)->mutex);
+    (*l)->stop = true;
+    pthread_cond_signal(&(*l)->wake);
+    pthread_mutex_unlock(&(*l)->mutex);
+    pthread_join((*l)->flusher, NULL);
+
+    logRing *r = atomic_load(&(*l)->rings);
+    while (r != NULL) {
+        logRing *next = r->next;
+        free(r);
+        r = next;
+    }
+    pthread_mutex_destroy(&(*l)->mutex);
+    pthread_cond_destroy(&(*l)->wake);
+    pthread_cond_destroy(&(*l)->drained);
+    free(*l);
+    *l = NULL;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+void auditlog_write(auditLog_t *l, const char *method, const char *uri, int code, int requestId) {
+    if (myRing == NULL) {
+        myRing = newRing(l);
+    }
+    logRing *r = myRing;
+
+    // Only this thread adds to r, so a free slot found here stays free
+    uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load(&r->tail) == RING_SLOTS) {
+        if (l->dropWhenFull) {
+            atomic_fetch_add(&l->dropped, 1);
+            return;
+        }
+        waitForSpace(l, r);
+    }
+
+    logRecord *rec = &r->slots[head & (RING_SLOTS - 1)];
+    int len = snprintf(rec->line, LINE_MAX_LEN, "%s,/%s,%d,%d\n", method, uri, code, requestId);
+    rec->len = len < LINE_MAX_LEN ? len : LINE_MAX_LEN - 1;
+
+    // The sequence number is taken last so the flusher never waits long on
+    // one that is taken but not yet published
+    rec->seq = atomic_fetch_add(&l->nextSeq, 1);
+    atomic_store_explicit(&r->head, head + 1, memory_order_release);
+
+    if (atomic_load(&l->flusherIdle)) {
+        pthread_mutex_lock(&l->mutex);
+        pthread_cond_signal(&l->wake);
+        pthread_mutex_unlock(&l->mutex);
+    }
+}
+
+void auditlog_thread_done(auditLog_t *l) {
+    if (myRing == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&l->mutex);
+    myRing->nextSpare = l->spares;
+    l->spares = myRing;
+    pthread_mutex_unlock(&l->mutex);
+    myRing = NULL;
+}
+
+void auditlog_flush(auditLog_t *l) {
+    uint64_t target = atomic_load(&l->nextSeq);
+    pthread_mutex_lock(&l->mutex);
+    atomic_fetch_add(&l->waiters, 1);
+    while (atomic_load(&l->flushedSeq) < target) {
+        pthread_cond_signal(&l->wake);
+        struct timespec deadline = deadlineIn(IDLE_WAIT_MS);
+        pthread_cond_timedwait(&l->drained, &l->mutex, &deadline);
+    }
+    atomic_fetch_sub(&l->waiters, 1);
+    pthread_mutex_unlock(&l->mutex);
+}
+
+void auditlog_stats(auditLog_t *l, auditStats *stats) {
+    stats->written = atomic_load(&l->written);
+    stats->dropped = atomic_load(&l->dropped);
+    stats->blocked = atomic_load(&l->blocked);
+}
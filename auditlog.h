@@ -0,0 +1,65 @@
+/**
+ * @File auditlog.h
+ *
+ * Asynchronous audit log. Workers append records to a ring of their own
+ * without taking any shared lock, and a background flusher writes them
+ * out in batches with writev, in the order they were logged.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/** @struct auditLog_t
+ *
+ *  @brief The audit log with its per-thread rings and flusher thread.
+ */
+typedef struct auditLog auditLog_t;
+
+/** @struct auditStats
+ *
+ *  @brief Counters of the records that went through the log.
+ */
+typedef struct auditStats {
+    long written;
+    long dropped;
+    long blocked;
+} auditStats;
+
+/** @brief Dynamically allocates a new log and starts its flusher thread.
+ *  Only one log may be in use at a time.
+ *
+ *  @param fd where records are written, e.g. 2 for stderr
+ *
+ *  @param dropWhenFull if true a record is dropped when the logging
+ *  thread's ring is full, otherwise the thread waits for the flusher
+ *
+ *  @return a pointer to a new auditLog_t
+ */
+auditLog_t *auditlog_new(int fd, bool dropWhenFull);
+
+/** @brief Stop the flusher after it writes what is left, free all of the
+ *  log's memory and set *l = NULL. No thread may log after this.
+ */
+void auditlog_delete(auditLog_t **l);
+
+/** @brief Append the record "method,/uri,code,requestId" to the calling
+ *  thread's ring. Records are written in the order of these calls, so a
+ *  caller that logs while holding the URI's lock keeps the order in
+ *  which requests to that URI took effect.
+ */
+void auditlog_write(auditLog_t *l, const char *method, const char *uri, int code, int requestId);
+
+/** @brief Hand the calling thread's ring to the next thread that starts
+ *  logging, for a thread that is about to exit. Records still in the
+ *  ring are written out as usual.
+ */
+void auditlog_thread_done(auditLog_t *l);
+
+/** @brief Write out every record logged before this call.
+ */
+void auditlog_flush(auditLog_t *l);
+
+/** @brief Fill *stats with the log's counters.
+ */
+void auditlog_stats(auditLog_t *l, auditStats *stats);
@@ -0,0 +1,632 @@
+/**
+ * @File loadgen.c
+ *
+ * Multi-threaded HTTP load generator for the server. Each connection is
+ * driven by its own thread over a keep-alive socket and takes its next
+ * request from a shared workload, either replayed from a JSONL file or
+ * built from one of the canned scenarios. In closed-loop mode every
+ * connection sends its next request as soon as the last one is answered;
+ * in open-loop mode requests are due at a fixed total rate and latency
+ * is measured from when a request was due, so a stalled server can't
+ * hide its queueing delay. Latencies go into HDR-style histograms.
+ *
+ * Usage: ./bench/loadgen [-p port] [-a address] [-c connections]
+ *                        [-d seconds] [-r requests/sec]
+ *                        (-w workload.jsonl | -s scenario)
+ *
+ * Workload lines look like
+ *     {"method": "PUT", "uri": "/a.txt", "size": 4096, "id": 7}
+ * where size is the PUT body length and id the Request-Id (optional).
+ * Scenarios: small-get, large-get, put-heavy, contention, or all.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define MAX_CONNS   1024
+#define MAX_URI     64
+#define HEAD_SIZE   4096
+#define IO_SIZE     65536
+#define MAX_BODY    (64 << 20)
+
+// Histogram of microsecond latencies with 3 significant digits: values
+// below SUB_BUCKETS are exact, every power of two above is split into
+// HALF_BUCKETS equal steps, up to about an hour
+#define SUB_BITS     11
+#define SUB_BUCKETS  (1 << SUB_BITS)
+#define HALF_BUCKETS (SUB_BUCKETS / 2)
+#define MAX_SHIFT    22
+#define N_BUCKETS    (SUB_BUCKETS + MAX_SHIFT * HALF_BUCKETS)
+
+typedef struct histogram {
+    int counts[N_BUCKETS];
+    long total;
+    long max;
+} histogram;
+
+// One request of the workload
+typedef struct request {
+    bool isPut;
+    char uri[MAX_URI];
+    long size;
+    long id;
+} request;
+
+typedef struct workload {
+    request *reqs;
+    int n;
+    request *setup; // PUTs that create the files before the run
+    int nSetup;
+} workload;
+
+// Settings shared by every connection thread
+typedef struct runConfig {
+    struct sockaddr_in addr;
+    int connections;
+    double seconds;
+    double rate; // requests/sec in open loop, 0 for closed loop
+} runConfig;
+
+// Per-thread results, merged when the run ends
+typedef struct connStats {
+    histogram latency;
+    long requests;
+    long errors;
+    long reconnects;
+    long bytesIn;
+    long status[6]; // by class, 1xx to 5xx
+} connStats;
+
+typedef struct connArgs {
+    const runConfig *run;
+    const workload *w;
+    int index;
+    double start;
+    connStats stats;
+} connArgs;
+
+static const char *scenarios[] = { "small-get", "large-get", "put-heavy", "contention" };
+
+// Shared position in the workload
+static _Atomic long nextRequest;
+
+// Zeros sent as PUT bodies
+static char bodyBytes[IO_SIZE];
+
+// Helper Functions -----------------------------------------------------------
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void sleepUntil(double t) {
+    double left = t - seconds();
+    if (left > 0) {
+        struct timespec ts = { .tv_sec = (time_t) left,
+            .tv_nsec = (long) ((left - (time_t) left) * 1e9) };
+        nanosleep(&ts, NULL);
+    }
+}
+
+// Histograms -----------------------------------------------------------------
+
+static int bucketOf(long v) {
+    if (v < SUB_BUCKETS) {
+        return (int) v;
+    }
+    int shift = 63 - __builtin_clzl((unsigned long) v) - (SUB_BITS - 1);
+    if (shift > MAX_SHIFT) {
+        return N_BUCKETS - 1;
+    }
+    return SUB_BUCKETS + (shift - 1) * HALF_BUCKETS + (int) ((v >> shift) - HALF_BUCKETS);
+}
+
+// Lowest value that falls in bucket i
+static long bucketValue(int i) {
+    if (i < SUB_BUCKETS) {
+        return i;
+    }
+    int shift = (i - SUB_BUCKETS) / HALF_BUCKETS + 1;
+    long sub = (i - SUB_BUCKETS) % HALF_BUCKETS + HALF_BUCKETS;
+    return sub << shift;
+}
+
+static void record(histogram *h, long v) {
+    h->counts[bucketOf(v)] += 1;
+    h->total += 1;
+    if (v > h->max) {
+        h->max = v;
+    }
+}
+
+static void merge(histogram *into, const histogram *h) {
+    for (int i = 0; i < N_BUCKETS; i++) {
+        into->counts[i] += h->counts[i];
+    }
+    into->total += h->total;
+    if (h->max > into->max) {
+        into->max = h->max;
+    }
+}
+
+// Smallest recorded value that at least fraction q of all values are at
+static long percentile(const histogram *h, double q) {
+    long want = (long) (q * h->total + 0.5);
+    if (want < 1) {
+        want = 1;
+    }
+    long seen = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        seen += h->counts[i];
+        if (seen >= want) {
+            return bucketValue(i);
+        }
+    }
+    return h->max;
+}
+
+// Workloads ------------------------------------------------------------------
+
+// Find "key" in a JSON object line and return what follows its colon
+static const char *jsonField(const char *line, const char *key) {
+    char quoted[MAX_URI + 2];
+    snprintf(quoted, sizeof(quoted), "\"%s\"", key);
+    const char *p = strstr(line, quoted);
+    if (p == NULL) {
+        return NULL;
+    }
+    p += strlen(quoted);
+    while (*p == ' ' || *p == '\t' || *p == ':') {
+        p++;
+    }
+    return p;
+}
+
+static bool jsonString(const char *line, const char *key, char *out, size_t size) {
+    const char *p = jsonField(line, key);
+    if (p == NULL || *p != '"') {
+        return false;
+    }
+    const char *end = strchr(++p, '"');
+    if (end == NULL || (size_t) (end - p) >= size) {
+        return false;
+    }
+    memcpy(out, p, end - p);
+    out[end - p] = '\0';
+    return true;
+}
+
+static long jsonNumber(const char *line, const char *key, long otherwise) {
+    const char *p = jsonField(line, key);
+    return p == NULL ? otherwise : strtol(p, NULL, 10);
+}
+
+static void addRequest(request **reqs, int *n, bool isPut, const char *uri, long size) {
+    *reqs = realloc(*reqs, (*n + 1) * sizeof(request));
+    if (*reqs == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    request *r = &(*reqs)[*n];
+    r->isPut = isPut;
+    snprintf(r->uri, MAX_URI, "%s", uri);
+    r->size = size;
+    r->id = *n + 1;
+    *n += 1;
+}
+
+static bool loadWorkload(const char *path, workload *w) {
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        return false;
+    }
+    char line[512];
+    int lineNo = 0;
+    while (fgets(line, sizeof(line), f) != NULL) {
+        lineNo += 1;
+        char method[8];
+        char uri[MAX_URI];
+        if (strspn(line, " \t\r\n") == strlen(line)) {
+            continue;
+        }
+        if (!jsonString(line, "method", method, sizeof(method))
+            || !jsonString(line, "uri", uri, sizeof(uri)) || uri[0] != '/'
+            || (strcmp(method, "GET") != 0 && strcmp(method, "PUT") != 0)) {
+            fprintf(stderr, "%s:%d: bad workload line\n", path, lineNo);
+            fclose(f);
+            return false;
+        }
+        long size = jsonNumber(line, "size", 0);
+        if (size < 0 || size > MAX_BODY) {
+            fprintf(stderr, "%s:%d: bad body size\n", path, lineNo);
+            fclose(f);
+            return false;
+        }
+        addRequest(&w->reqs, &w->n, method[0] == 'P', uri, size);
+        w->reqs[w->n - 1].id = jsonNumber(line, "id", w->n);
+    }
+    fclose(f);
+    return w->n > 0;
+}
+
+// Build a canned scenario. The files it reads are created by setup PUTs
+// so GETs find them, and its requests are mixed in a fixed order.
+static bool buildScenario(const char *name, workload *w) {
+    char uri[MAX_URI];
+    if (strcmp(name, "small-get") == 0) {
+        // Many small files, every request a GET
+        for (int i = 0; i < 100; i++) {
+            snprintf(uri, sizeof(uri), "/small%d.txt", i);
+            addRequest(&w->setup, &w->nSetup, true, uri, 1024);
+            addRequest(&w->reqs, &w->n, false, uri, 0);
+        }
+    } else if (strcmp(name, "large-get") == 0) {
+        // A few 8 MB files, throughput bound
+        for (int i = 0; i < 4; i++) {
+            snprintf(uri, sizeof(uri), "/large%d.bin", i);
+            addRequest(&w->setup, &w->nSetup, true, uri, 8 << 20);
+            addRequest(&w->reqs, &w->n, false, uri, 0);
+        }
+    } else if (strcmp(name, "put-heavy") == 0) {
+        // Four PUTs of 16 KB to every GET, spread over 50 files
+        for (int i = 0; i < 50; i++) {
+            snprintf(uri, sizeof(uri), "/put%d.bin", i);
+            addRequest(&w->setup, &w->nSetup, true, uri, 16384);
+            for (int j = 0; j < 4; j++) {
+                addRequest(&w->reqs, &w->n, true, uri, 16384);
+            }
+            addRequest(&w->reqs, &w->n, false, uri, 0);
+        }
+    } else if (strcmp(name, "contention") == 0) {
+        // Every connection on one hot URI, 7 reads to 3 writes
+        addRequest(&w->setup, &w->nSetup, true, "/hot.txt", 4096);
+        for (int i = 0; i < 10; i++) {
+            addRequest(&w->reqs, &w->n, i % 10 >= 7, "/hot.txt", 4096);
+        }
+    } else {
+        return false;
+    }
+
+    // Interleave reads and writes instead of running them in blocks
+    srand(1);
+    for (int i = w->n - 1; i > 0; i--) {
+        int j = rand() % (i + 1);
+        request tmp = w->reqs[i];
+        w->reqs[i] = w->reqs[j];
+        w->reqs[j] = tmp;
+    }
+    return true;
+}
+
+// Connections ----------------------------------------------------------------
+
+static int connectTo(const struct sockaddr_in *addr) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    int on = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+    struct timeval tv = { .tv_sec = 10, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    if (connect(fd, (const struct sockaddr *) addr, sizeof(*addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static bool sendAll(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, buf, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        len -= n;
+    }
+    return true;
+}
+
+// Send r and read its response. Returns the status code, or -1 if the
+// connection failed. *keepAlive is cleared if the server closes after it.
+static int exchange(int fd, const request *r, long *bytesIn, bool *keepAlive) {
+    char head[HEAD_SIZE];
+    int len;
+    if (r->isPut) {
+        len = snprintf(head, sizeof(head),
+            "PUT %s HTTP/1.1\r\nRequest-Id: %ld\r\nContent-Length: %ld\r\n\r\n", r->uri, r->id,
+            r->size);
+    } else {
+        len = snprintf(head, sizeof(head), "GET %s HTTP/1.1\r\nRequest-Id: %ld\r\n\r\n", r->uri,
+            r->id);
+    }
+    if (!sendAll(fd, head, len)) {
+        return -1;
+    }
+    for (long left = r->isPut ? r->size : 0; left > 0;) {
+        size_t chunk = left < IO_SIZE ? (size_t) left : IO_SIZE;
+        if (!sendAll(fd, bodyBytes, chunk)) {
+            return -1;
+        }
+        left -= chunk;
+    }
+
+    // Response head, then skip Content-Length bytes of body
+    static _Thread_local char buf[IO_SIZE];
+    int have = 0;
+    char *end = NULL;
+    while (end == NULL) {
+        if (have == (int) sizeof(head) - 1) {
+            return -1;
+        }
+        ssize_t n = recv(fd, head + have, sizeof(head) - 1 - have, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        have += n;
+        head[have] = '\0';
+        end = strstr(head, "\r\n\r\n");
+    }
+    *bytesIn += have;
+
+    int status = 0;
+    if (sscanf(head, "HTTP/1.1 %d", &status) != 1) {
+        return -1;
+    }
+    const char *cl = strcasestr(head, "\r\nContent-Length:");
+    long body = cl != NULL ? strtol(cl + 17, NULL, 10) : 0;
+    if (strcasestr(head, "\r\nConnection: close") != NULL) {
+        *keepAlive = false;
+    }
+
+    body -= have - (end + 4 - head);
+    while (body > 0) {
+        ssize_t n = recv(fd, buf, body < IO_SIZE ? (size_t) body : IO_SIZE, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return -1;
+        }
+        body -= n;
+        *bytesIn += n;
+    }
+    return status;
+}
+
+// Drive one connection until the run's time is up
+static void *connection_thread(void *args) {
+    connArgs *a = (connArgs *) args;
+    const runConfig *run = a->run;
+    double end = a->start + run->seconds;
+
+    // In open loop the connections take turns at the total rate, so this
+    // one's requests are due every connections/rate seconds
+    double interval = run->rate > 0 ? run->connections / run->rate : 0;
+    double due = a->start + (run->rate > 0 ? a->index / run->rate : 0);
+
+    int fd = -1;
+    while (1) {
+        if (run->rate > 0) {
+            if (due >= end) {
+                break;
+            }
+            sleepUntil(due);
+        } else {
+            due = seconds();
+            if (due >= end) {
+                break;
+            }
+        }
+
+        if (fd < 0) {
+            fd = connectTo(&run->addr);
+            if (fd < 0) {
+                a->stats.errors += 1;
+                due += interval;
+                continue;
+            }
+            a->stats.reconnects += 1;
+        }
+
+        const request *r = &a->w->reqs[atomic_fetch_add(&nextRequest, 1) % a->w->n];
+        bool keepAlive = true;
+        int status = exchange(fd, r, &a->stats.bytesIn, &keepAlive);
+        double done = seconds();
+        if (status < 0) {
+            a->stats.errors += 1;
+            keepAlive = false;
+        } else {
+            a->stats.requests += 1;
+            a->stats.status[status / 100 < 6 ? status / 100 : 0] += 1;
+            record(&a->stats.latency, (long) ((done - due) * 1e6));
+        }
+        if (!keepAlive) {
+            close(fd);
+            fd = -1;
+        }
+        due += interval;
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return NULL;
+}
+
+// Create the files a scenario reads, one PUT at a time
+static bool runSetup(const runConfig *run, const workload *w) {
+    int fd = -1;
+    for (int i = 0; i < w->nSetup; i++) {
+        if (fd < 0 && (fd = connectTo(&run->addr)) < 0) {
+            return false;
+        }
+        long bytes = 0;
+        bool keepAlive = true;
+        int status = exchange(fd, &w->setup[i], &bytes, &keepAlive);
+        if (status != 200 && status != 201) {
+            close(fd);
+            return false;
+        }
+        if (!keepAlive) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    if (fd >= 0) {
+        close(fd);
+    }
+    return true;
+}
+
+static void report(const char *name, const runConfig *run, connArgs *conns, double elapsed) {
+    static histogram all;
+    memset(&all, 0, sizeof(all));
+    connStats total = { .requests = 0 };
+    for (int i = 0; i < run->connections; i++) {
+        merge(&all, &conns[i].stats.latency);
+        total.requests += conns[i].stats.requests;
+        total.errors += conns[i].stats.errors;
+        total.reconnects += conns[i].stats.reconnects;
+        total.bytesIn += conns[i].stats.bytesIn;
+        for (int s = 0; s < 6; s++) {
+            total.status[s] += conns[i].stats.status[s];
+        }
+    }
+
+    printf("%s: %d connections, ", name, run->connections);
+    if (run->rate > 0) {
+        printf("open loop at %.0f req/s, ", run->rate);
+    } else {
+        printf("closed loop, ");
+    }
+    printf("%.1f s\n", elapsed);
+    printf("  requests %ld (%.0f req/s, %.1f MB/s in)  errors %ld  connects %ld\n",
+        total.requests, total.requests / elapsed, total.bytesIn / elapsed / 1e6, total.errors,
+        total.reconnects);
+    printf("  status 2xx %ld  3xx %ld  4xx %ld  5xx %ld\n", total.status[2], total.status[3],
+        total.status[4], total.status[5]);
+    if (all.total > 0) {
+        printf("  latency us  p50 %ld  p90 %ld  p99 %ld  p999 %ld  max %ld\n",
+            percentile(&all, 0.50), percentile(&all, 0.90), percentile(&all, 0.99),
+            percentile(&all, 0.999), all.max);
+    }
+}
+
+static bool runWorkload(const char *name, const runConfig *run, const workload *w) {
+    if (!runSetup(run, w)) {
+        fprintf(stderr, "%s: setup PUTs failed, is the server up?\n", name);
+        return false;
+    }
+
+    connArgs *conns = calloc(run->connections, sizeof(connArgs));
+    pthread_t *threads = calloc(run->connections, sizeof(pthread_t));
+    if (conns == NULL || threads == NULL) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
+    }
+    atomic_store(&nextRequest, 0);
+    double start = seconds();
+    for (int i = 0; i < run->connections; i++) {
+        conns[i] = (connArgs) { .run = run, .w = w, .index = i, .start = start };
+        pthread_create(&threads[i], NULL, connection_thread, &conns[i]);
+    }
+    for (int i = 0; i < run->connections; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    report(name, run, conns, seconds() - start);
+    free(conns);
+    free(threads);
+    return true;
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+        "Usage: %s [-p port] [-a address] [-c connections] [-d seconds] [-r requests/sec]\n"
+        "          (-w workload.jsonl | -s small-get|large-get|put-heavy|contention|all)\n",
+        prog);
+    exit(1);
+}
+
+int main(int argc, char *argv[]) {
+    runConfig run = { .connections = 16, .seconds = 10, .rate = 0 };
+    const char *address = "127.0.0.1";
+    const char *workloadPath = NULL;
+    const char *scenario = NULL;
+    int port = 8080;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "p:a:c:d:r:w:s:")) != -1) {
+        switch (opt) {
+        case 'p': port = atoi(optarg); break;
+        case 'a': address = optarg; break;
+        case 'c': run.connections = atoi(optarg); break;
+        case 'd': run.seconds = atof(optarg); break;
+        case 'r': run.rate = atof(optarg); break;
+        case 'w': workloadPath = optarg; break;
+        case 's': scenario = optarg; break;
+        default: usage(argv[0]);
+        }
+    }
+    if ((workloadPath == NULL) == (scenario == NULL) || run.connections < 1
+        || run.connections > MAX_CONNS || run.seconds <= 0 || run.rate < 0 || port < 1
+        || port > 65535) {
+        usage(argv[0]);
+    }
+
+    memset(&run.addr, 0, sizeof(run.addr));
+    run.addr.sin_family = AF_INET;
+    run.addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address, &run.addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", address);
+        return 1;
+    }
+
+    if (workloadPath != NULL) {
+        workload w = { .reqs = NULL, .n = 0, .setup = NULL, .nSetup = 0 };
+        if (!loadWorkload(workloadPath, &w)) {
+            fprintf(stderr, "cannot load workload %s\n", workloadPath);
+            return 1;
+        }
+        return runWorkload(workloadPath, &run, &w) ? 0 : 1;
+    }
+
+    bool all = strcmp(scenario, "all") == 0;
+    bool ok = true;
+    bool found = false;
+    for (size_t i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++) {
+        if (all || strcmp(scenario, scenarios[i]) == 0) {
+            workload w = { .reqs = NULL, .n = 0, .setup = NULL, .nSetup = 0 };
+            buildScenario(scenarios[i], &w);
+            ok &= runWorkload(scenarios[i], &run, &w);
+            free(w.reqs);
+            free(w.setup);
+            found = true;
+        }
+    }
+    if (!found) {
+        usage(argv[0]);
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,79 @@
+/**
+ * @File queue_bench.c
+ *
+ * Contention benchmark for queue_t: N producers and N consumers move a
+ * fixed number of elements through a small queue, once with the mutex
+ * queue and once with the lock-free ring, for N = 1 to 64.
+ *
+ * Usage: ./bench/queue_bench [elements per thread] [queue size]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include "queue.h"
+
+typedef struct benchArgs {
+    queue_t *q;
+    long count;
+} benchArgs;
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *producer(void *args) {
+    benchArgs *b = (benchArgs *) args;
+    for (long i = 1; i <= b->count; i++) {
+        queue_push(b->q, (void *) (intptr_t) i);
+    }
+    return NULL;
+}
+
+static void *consumer(void *args) {
+    benchArgs *b = (benchArgs *) args;
+    void *elem;
+    for (long i = 0; i < b->count; i++) {
+        queue_pop(b->q, &elem);
+    }
+    return NULL;
+}
+
+// Returns queue operations (pushes + pops) per second
+static double run(queue_t *q, int nThreads, long perThread) {
+    pthread_t threads[2 * nThreads];
+    benchArgs b = { .q = q, .count = perThread };
+
+    double start = seconds();
+    for (int i = 0; i < nThreads; i++) {
+        pthread_create(&threads[i], NULL, producer, &b);
+        pthread_create(&threads[nThreads + i], NULL, consumer, &b);
+    }
+    for (int i = 0; i < 2 * nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    return 2.0 * nThreads * perThread / (seconds() - start);
+}
+
+int main(int argc, char *argv[]) {
+    long perThread = argc > 1 ? atol(argv[1]) : 200000;
+    int size = argc > 2 ? atoi(argv[2]) : 64;
+
+    printf("%8s %16s %16s %8s\n", "threads", "mutex ops/s", "lock-free ops/s", "ratio");
+    for (int n = 1; n <= 64; n *= 2) {
+        queue_t *q = queue_new(size);
+        double mutexRate = run(q, n, perThread / n);
+        queue_delete(&q);
+
+        q = queue_new_lockfree(size);
+        double ringRate = run(q, n, perThread / n);
+        queue_delete(&q);
+
+        printf("%8d %16.0f %16.0f %7.2fx\n", n, mutexRate, ringRate, ringRate / mutexRate);
+    }
+    return 0;
+}
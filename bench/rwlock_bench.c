@@ -0,0 +1,102 @@
+/**
+ * @File rwlock_bench.c
+ *
+ * Throughput benchmark for rwlock_t: N threads take one lock for reading
+ * or writing around a tiny critical section, once with the mutex lock
+ * and once with the futex lock, for N = 1 to 64. Writers bump two
+ * counters that readers check are equal, so a lock that lets a reader in
+ * beside a writer is caught rather than just measured.
+ *
+ * Usage: ./bench/rwlock_bench [operations per thread] [read percent]
+ *                             [readers|writers|nway]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include "rwlock.h"
+
+typedef struct benchArgs {
+    rwlock_t *rw;
+    long count;
+    int readPercent;
+    volatile long first;
+    volatile long second;
+    long torn;
+} benchArgs;
+
+static double seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *worker(void *args) {
+    benchArgs *b = (benchArgs *) args;
+    unsigned seed = (unsigned) (uintptr_t) &seed;
+    long torn = 0;
+    for (long i = 0; i < b->count; i++) {
+        if ((int) (rand_r(&seed) % 100) < b->readPercent) {
+            reader_lock(b->rw);
+            if (b->first != b->second) {
+                torn++;
+            }
+            reader_unlock(b->rw);
+        } else {
+            writer_lock(b->rw);
+            b->first += 1;
+            b->second += 1;
+            writer_unlock(b->rw);
+        }
+    }
+    __atomic_fetch_add(&b->torn, torn, __ATOMIC_RELAXED);
+    return NULL;
+}
+
+// Returns lock operations (acquire + release pairs) per second
+static double run(rwlock_t *rw, int nThreads, long perThread, int readPercent) {
+    pthread_t threads[nThreads];
+    benchArgs b = { .rw = rw, .count = perThread, .readPercent = readPercent };
+
+    double start = seconds();
+    for (int i = 0; i < nThreads; i++) {
+        pthread_create(&threads[i], NULL, worker, &b);
+    }
+    for (int i = 0; i < nThreads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    double rate = (double) nThreads * perThread / (seconds() - start);
+    if (b.torn > 0 || b.first != b.second) {
+        fprintf(stderr, "readers saw a writer at work %ld times\n", b.torn);
+        exit(1);
+    }
+    return rate;
+}
+
+int main(int argc, char *argv[]) {
+    long perThread = argc > 1 ? atol(argv[1]) : 200000;
+    int readPercent = argc > 2 ? atoi(argv[2]) : 90;
+    PRIORITY p = N_WAY;
+    if (argc > 3 && strcmp(argv[3], "readers") == 0) {
+        p = READERS;
+    } else if (argc > 3 && strcmp(argv[3], "writers") == 0) {
+        p = WRITERS;
+    }
+
+    printf("%8s %16s %16s %8s\n", "threads", "mutex ops/s", "futex ops/s", "ratio");
+    for (int n = 1; n <= 64; n *= 2) {
+        rwlock_t *rw = rwlock_new(p, 1);
+        double mutexRate = run(rw, n, perThread / n, readPercent);
+        rwlock_delete(&rw);
+
+        rw = rwlock_new_futex(p, 1);
+        double futexRate = run(rw, n, perThread / n, readPercent);
+        rwlock_delete(&rw);
+
+        printf("%8d %16.0f %16.0f %7.2fx\n", n, mutexRate, futexRate, futexRate / mutexRate);
+    }
+    return 0;
+}
@@ -0,0 +1,212 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <assert.h>
+#include <pthread.h>
+#include "bufpool.h"
+
+// Size classes are MIN_BUF << i, larger buffers are allocated and freed
+// every time
+#define MIN_BUF   4096
+#define N_CLASSES 10
+
+// Only the owning thread writes a shard's counters, readers may see a
+// count a moment old but never a torn one
+typedef _Atomic long counter;
+
+// A free buffer, linked through its own first bytes
+typedef struct freeBuf {
+    struct freeBuf *next;
+} freeBuf;
+
+typedef struct bufShard {
+    freeBuf *free[N_CLASSES];
+    size_t cached;
+    counter gets;
+    counter reused;
+    counter inUse;
+    counter cachedBytes;
+    struct bufShard *next;
+    struct bufShard *nextSpare;
+} bufShard;
+
+typedef struct bufPool {
+    pthread_mutex_t mutex;
+    _Atomic(bufShard *) shards;
+    bufShard *spares; // shards of threads that exited, under mutex
+    size_t maxCached;
+    _Atomic long allocated;
+    _Atomic long highWater;
+} bufPool_t;
+
+// The calling thread's shard, created on its first buffer
+static _Thread_local bufShard *myShard;
+
+// Helper Functions -----------------------------------------------------------
+
+static void bump(counter *c, long n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static long value(counter *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static bufShard *shard(bufPool_t *p) {
+    if (myShard == NULL) {
+        pthread_mutex_lock(&p->mutex);
+        myShard = p->spares;
+        if (myShard != NULL) {
+            p->spares = myShard->nextSpare;
+        }
+        pthread_mutex_unlock(&p->mutex);
+    }
+    if (myShard == NULL) {
+        bufShard *s = aligned_alloc(64, (sizeof(bufShard) + 63) & ~(size_t) 63);
+        assert(s != NULL);
+        memset(s, 0, sizeof(*s));
+
+        // Shards are only added, at the front, so stats walk the list
+        // without the lock
+        pthread_mutex_lock(&p->mutex);
+        s->next = atomic_load(&p->shards);
+        atomic_store(&p->shards, s);
+        pthread_mutex_unlock(&p->mutex);
+        myShard = s;
+    }
+    return myShard;
+}
+
+// Smallest class holding size bytes, N_CLASSES if none does
+static int sizeClass(size_t size) {
+    int i = 0;
+    while (i < N_CLASSES && ((size_t) MIN_BUF << i) < size) {
+        i++;
+    }
+    return i;
+}
+
+// Allocate a buffer and count it, raising the high-water mark with it
+static char *allocate(bufPool_t *p, size_t size) {
+    char *buf = aligned_alloc(64, size);
+    assert(buf != NULL);
+    long total = atomic_fetch_add(&p->allocated, (long) size) + (long) size;
+    long high = atomic_load(&p->highWater);
+    while (total > high && !atomic_compare_exchange_weak(&p->highWater, &high, total)) {
+    }
+    return buf;
+}
+
+static void release(bufPool_t *p, char *buf, size_t size) {
+    free(buf);
+    atomic_fetch_sub(&p->allocated, (long) size);
+}
+
+// Free every buffer on s's free lists
+static void drain(bufPool_t *p, bufShard *s) {
+    for (int i = 0; i < N_CLASSES; i++) {
+        while (s->free[i] != NULL) {
+            freeBuf *f = s->free[i];
+            s->free[i] = f->next;
+            release(p, (char *) f, (size_t) MIN_BUF << i);
+        }
+    }
+    bump(&s->cachedBytes, -(long) s->cached);
+    s->cached = 0;
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+bufPool_t *bufpool_new(size_t maxCached) {
+    bufPool_t *p = malloc(sizeof(bufPool_t));
+    assert(p != NULL);
+    int rc = pthread_mutex_init(&p->mutex, NULL);
+    assert(!rc);
+    atomic_init(&p->shards, NULL);
+    p->spares = NULL;
+    p->maxCached = maxCached;
+    atomic_init(&p->allocated, 0);
+    atomic_init(&p->highWater, 0);
+    return p;
+}
+
+void bufpool_delete(bufPool_t **p) {
+    if (*p == NULL) {
+        return;
+    }
+    bufShard *s = atomic_load(&(*p)->shards);
+    while (s != NULL) {
+        bufShard *next = s->next;
+        drain(*p, s);
+        free(s);
+        s = next;
+    }
+    myShard = NULL;
+    pthread_mutex_destroy(&(*p)->mutex);
+    free(*p);
+    *p = NULL;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+char *bufpool_get(bufPool_t *p, size_t size, size_t *got) {
+    bufShard *s = shard(p);
+    int i = sizeClass(size);
+    char *buf;
+    if (i == N_CLASSES) {
+        *got = (size + MIN_BUF - 1) & ~(size_t) (MIN_BUF - 1);
+        buf = allocate(p, *got);
+    } else if (s->free[i] != NULL) {
+        *got = (size_t) MIN_BUF << i;
+        buf = (char *) s->free[i];
+        s->free[i] = s->free[i]->next;
+        s->cached -= *got;
+        bump(&s->cachedBytes, -(long) *got);
+        bump(&s->reused, 1);
+    } else {
+        *got = (size_t) MIN_BUF << i;
+        buf = allocate(p, *got);
+    }
+    bump(&s->gets, 1);
+    bump(&s->inUse, (long) *got);
+    return buf;
+}
+
+void bufpool_put(bufPool_t *p, char *buf, size_t size) {
+    bufShard *s = shard(p);
+    bump(&s->inUse, -(long) size);
+    int i = sizeClass(size);
+    if (i == N_CLASSES || s->cached + size > p->maxCached) {
+        release(p, buf, size);
+        return;
+    }
+    freeBuf *f = (freeBuf *) buf;
+    f->next = s->free[i];
+    s->free[i] = f;
+    s->cached += size;
+    bump(&s->cachedBytes, (long) size);
+}
+
+void bufpool_thread_done(bufPool_t *p) {
+    if (myShard == NULL) {
+        return;
+    }
+    drain(p, myShard);
+    pthread_mutex_lock(&p->mutex);
+    myShard->nextSpare = p->spares;
+    p->spares = myShard;
+    pthread_mutex_unlock(&p->mutex);
+    myShard = NULL;
+}
+
+void bufpool_stats(bufPool_t *p, bufPoolStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (bufShard *s = atomic_load(&p->shards); s != NULL; s = s->next) {
+        stats->gets += value(&s->gets);
+        stats->reused += value(&s->reused);
+        stats->bytesInUse += value(&s->inUse);
+        stats->bytesCached += value(&s->cachedBytes);
+    }
+    stats->highWaterBytes = atomic_load(&p->highWater);
+}
@@ -0,0 +1,70 @@
+/**
+ * @File bufpool.h
+ *
+ * Pool of the buffers connections read request heads and copy bodies
+ * through. Buffers come in power-of-two size classes, are cache-line
+ * aligned, and are kept on free lists of the thread that gave them back,
+ * so taking one is a pointer pop with no lock and no memset.
+ */
+
+#pragma once
+
+#include <stddef.h>
+
+/** @struct bufPool_t
+ *
+ *  @brief Per-thread free lists of buffers with shared usage counters.
+ */
+typedef struct bufPool bufPool_t;
+
+/** @struct bufPoolStats
+ *
+ *  @brief Usage of the pool. Byte counts are of whole buffers, so a
+ *  request for 5000 bytes counts the 8192 it was given.
+ */
+typedef struct bufPoolStats {
+    long gets;           // buffers handed out
+    long reused;         // of those, the ones taken from a free list
+    long bytesInUse;     // bytes of buffers handed out and not given back
+    long bytesCached;    // bytes of buffers waiting on free lists
+    long highWaterBytes; // the most bytes allocated at once, in use or cached
+} bufPoolStats;
+
+/** @brief Dynamically allocates a new, empty pool. Only one pool may be
+ *  in use at a time.
+ *
+ *  @param maxCached the most bytes of free buffers each thread keeps,
+ *  buffers given back past that are freed
+ *
+ *  @return a pointer to a new bufPool_t
+ */
+bufPool_t *bufpool_new(size_t maxCached);
+
+/** @brief Free the pool and every cached buffer and set *p = NULL.
+ *  Buffers still in use must be given back first.
+ */
+void bufpool_delete(bufPool_t **p);
+
+/** @brief Take a buffer of at least size bytes. Its contents are
+ *  whatever its last user left there.
+ *
+ *  @param got set to the buffer's real size, which bufpool_put() is
+ *  given back with
+ *
+ *  @return a 64-byte aligned buffer
+ */
+char *bufpool_get(bufPool_t *p, size_t size, size_t *got);
+
+/** @brief Give back a buffer from bufpool_get() of the size it returned
+ *  in *got. Any thread may give it back.
+ */
+void bufpool_put(bufPool_t *p, char *buf, size_t size);
+
+/** @brief Free the calling thread's cached buffers, for a thread that is
+ *  about to exit. Its counters stay in the totals.
+ */
+void bufpool_thread_done(bufPool_t *p);
+
+/** @brief Fill *stats with the pool's counters summed over threads.
+ */
+void bufpool_stats(bufPool_t *p, bufPoolStats *stats);
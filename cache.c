@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "cache.h"
+#include "uritable.h"
+
+#define CACHE_SHARDS  16
+#define SHARD_BUCKETS 256
+
+typedef struct cacheObj {
+    char uri[65];
+    uint32_t hash;
+    off_t size;
+    struct stat st;
+    int refs;
+    bool cached;
+    char *data;
+    struct cacheObj *next;
+    struct cacheObj *newer;
+    struct cacheObj *older;
+} cacheObj_t;
+
+// Each shard has its own lock, LRU list and share of the budget
+typedef struct cacheShard {
+    _Alignas(64) pthread_mutex_t mutex;
+    cacheObj_t *buckets[SHARD_BUCKETS];
+    cacheObj_t *newest;
+    cacheObj_t *oldest;
+    size_t bytes;
+    long objects;
+    long hits;
+    long misses;
+    long insertions;
+    long evictions;
+    long invalidations;
+} cacheShard;
+
+typedef struct cache {
+    size_t shardBudget;
+    size_t maxObject;
+    cacheShard *shards;
+} cache_t;
+
+static cacheShard *shardFor(cache_t *c, uint32_t hash) {
+    return &c->shards[hash % CACHE_SHARDS];
+}
+
+static cacheObj_t **bucketFor(cacheShard *s, uint32_t hash) {
+    return &s->buckets[(hash / CACHE_SHARDS) % SHARD_BUCKETS];
+}
+
+static void freeObj(cacheObj_t *o) {
+    free(o->data);
+    free(o);
+}
+
+// Find uri in its shard, shard is locked
+static cacheObj_t *find(cacheShard *s, uint32_t hash, const char *uri) {
+    cacheObj_t *o = *bucketFor(s, hash);
+    while (o != NULL && (o->hash != hash || strcmp(o->uri, uri) != 0)) {
+        o = o->next;
+    }
+    return o;
+}
+
+// Unlink o from the LRU list, shard is locked
+static void lruRemove(cacheShard *s, cacheObj_t *o) {
+    if (o->newer != NULL) {
+        o->newer->older = o->older;
+    } else {
+        s->newest = o->older;
+    }
+    if (o->older != NULL) {
+        o->older->newer = o->newer;
+    } else {
+        s->oldest = o->newer;
+    }
+    o->newer = NULL;
+    o->older = NULL;
+}
+
+// Make o the most recently used object, shard is locked
+static void lruPush(cacheShard *s, cacheObj_t *o) {
+    o->older = s->newest;
+    o->newer = NULL;
+    if (s->newest != NULL) {
+        s->newest->newer = o;
+    } else {
+        s->oldest = o;
+    }
+    s->newest = o;
+}
+
+// Take o out of the cache, freeing it unless a response still holds it,
+// shard is locked
+static void removeObj(cacheShard *s, cacheObj_t *o) {
+    cacheObj_t **link = bucketFor(s, o->hash);
+    while (*link != o) {
+        link = &(*link)->next;
+    }
+    *link = o->next;
+    lruRemove(s, o);
+    s->bytes -= o->size;
+    s->objects -= 1;
+    o->cached = false;
+    if (o->refs == 0) {
+        freeObj(o);
+    }
+}
+
+//  Dynamically allocates and initializes a new cache.
+cache_t *cache_new(size_t budget, size_t maxObject) {
+    cache_t *c = (cache_t *) calloc(1, sizeof(cache_t));
+    assert(c != NULL);
+    c->shardBudget = budget / CACHE_SHARDS;
+    c->maxObject = maxObject < c->shardBudget ? maxObject : c->shardBudget;
+    c->shards = (cacheShard *) aligned_alloc(64, CACHE_SHARDS * sizeof(cacheShard));
+    assert(c->shards != NULL);
+    memset(c->shards, 0, CACHE_SHARDS * sizeof(cacheShard));
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        int rc = pthread_mutex_init(&(c->shards[i].mutex), NULL);
+        assert(!rc);
+    }
+    return c;
+}
+
+//  Delete the cache and free all of its memory.
+void cache_delete(cache_t **c) {
+    if (*c != NULL) {
+        for (int i = 0; i < CACHE_SHARDS; i++) {
+            cacheShard *s = &(*c)->shards[i];
+            while (s->oldest != NULL) {
+                removeObj(s, s->oldest);
+            }
+            pthread_mutex_destroy(&(s->mutex));
+        }
+        free((*c)->shards);
+        free(*c);
+    }
+    *c = NULL;
+}
+
+//  Look up uri and take a reference on its object.
+cacheObj_t *cache_get(cache_t *c, const char *uri) {
+    uint32_t hash = uritable_hash(uri);
+    cacheShard *s = shardFor(c, hash);
+
+    pthread_mutex_lock(&(s->mutex));
+    cacheObj_t *o = find(s, hash, uri);
+    if (o != NULL) {
+        o->refs += 1;
+        lruRemove(s, o);
+        lruPush(s, o);
+        s->hits += 1;
+    } else {
+        s->misses += 1;
+    }
+    pthread_mutex_unlock(&(s->mutex));
+    return o;
+}
+
+//  Read the file fd, whose fstat() is st, into a new object for uri and
+//  take a reference on it.
+cacheObj_t *cache_load(cache_t *c, const char *uri, int fd, const struct stat *st) {
+    off_t size = st->st_size;
+    if (size < 0 || (size_t) size > c->maxObject) {
+        return NULL;
+    }
+
+    // Read outside the shard lock, the caller's URI lock keeps fd stable
+    cacheObj_t *o = (cacheObj_t *) malloc(sizeof(cacheObj_t));
+    assert(o != NULL);
+    o->data = (char *) malloc(size > 0 ? size : 1);
+    assert(o->data != NULL);
+    off_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(fd, o->data + done, size - done, done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            freeObj(o);
+            return NULL;
+        }
+        done += n;
+    }
+    strncpy(o->uri, uri, sizeof(o->uri) - 1);
+    o->uri[sizeof(o->uri) - 1] = '\0';
+    o->hash = uritable_hash(uri);
+    o->size = size;
+    o->st = *st;
+    o->refs = 1;
+    o->cached = true;
+
+    cacheShard *s = shardFor(c, o->hash);
+    pthread_mutex_lock(&(s->mutex));
+    cacheObj_t *old = find(s, o->hash, uri);
+    if (old != NULL) {
+        removeObj(s, old);
+    }
+    while (s->oldest != NULL && s->bytes + size > c->shardBudget) {
+        removeObj(s, s->oldest);
+        s->evictions += 1;
+    }
+    cacheObj_t **bucket = bucketFor(s, o->hash);
+    o->next = *bucket;
+    *bucket = o;
+    lruPush(s, o);
+    s->bytes += size;
+    s->objects += 1;
+    s->insertions += 1;
+    pthread_mutex_unlock(&(s->mutex));
+    return o;
+}
+
+//  Drop a reference taken by cache_get or cache_load.
+void cache_release(cache_t *c, cacheObj_t *o) {
+    cacheShard *s = shardFor(c, o->hash);
+    pthread_mutex_lock(&(s->mutex));
+    o->refs -= 1;
+    bool orphan = o->refs == 0 && !o->cached;
+    pthread_mutex_unlock(&(s->mutex));
+    if (orphan) {
+        freeObj(o);
+    }
+}
+
+//  Remove uri's object, if any, so later GETs go to the file.
+void cache_invalidate(cache_t *c, const char *uri) {
+    uint32_t hash = uritable_hash(uri);
+    cacheShard *s = shardFor(c, hash);
+    pthread_mutex_lock(&(s->mutex));
+    cacheObj_t *o = find(s, hash, uri);
+    if (o != NULL) {
+        removeObj(s, o);
+        s->invalidations += 1;
+    }
+    pthread_mutex_unlock(&(s->mutex));
+}
+
+//  The cached file contents.
+const char *cache_data(cacheObj_t *o) {
+    return o->data;
+}
+
+//  The size of the cached file contents.
+off_t cache_size(cacheObj_t *o) {
+    return o->size;
+}
+
+//  The file's metadata when it was loaded.
+const struct stat *cache_stat(cacheObj_t *o) {
+    return &o->st;
+}
+
+//  Fill *stats with the cache's counters.
+void cache_stats(cache_t *c, cacheStats *stats) {
+    memset(stats, 0, sizeof(cacheStats));
+    for (int i = 0; i < CACHE_SHARDS; i++) {
+        cacheShard *s = &c->shards[i];
+        pthread_mutex_lock(&(s->mutex));
+        stats->hits += s->hits;
+        stats->misses += s->misses;
+        stats->insertions += s->insertions;
+        stats->evictions += s->evictions;
+        stats->invalidations += s->invalidations;
+        stats->objects += s->objects;
+        stats->bytes += (long) s->bytes;
+        pthread_mutex_unlock(&(s->mutex));
+    }
+}
@@ -0,0 +1,96 @@
+/**
+ * @File cache.h
+ *
+ * Bounded in-memory cache of whole files for GET. Objects are reference
+ * counted so one evicted or invalidated while a response is still being
+ * sent stays alive until that response lets go of it.
+ */
+
+#pragma once
+
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** @struct cache_t
+ *
+ *  @brief A sharded object cache with a total byte budget, evicting the
+ *  least recently used objects of a shard when it is over its share.
+ */
+typedef struct cache cache_t;
+
+/** @struct cacheObj_t
+ *
+ *  @brief The contents of one file at the time it was loaded.
+ */
+typedef struct cacheObj cacheObj_t;
+
+/** @struct cacheStats
+ *
+ *  @brief Counters summed over every shard.
+ */
+typedef struct cacheStats {
+    long hits;
+    long misses;
+    long insertions;
+    long evictions;
+    long invalidations;
+    long objects;
+    long bytes;
+} cacheStats;
+
+/** @brief Dynamically allocates and initializes a new cache.
+ *
+ *  @param budget the most bytes of file contents held at once
+ *
+ *  @param maxObject files larger than this are never cached
+ *
+ *  @return a pointer to a new cache_t
+ */
+cache_t *cache_new(size_t budget, size_t maxObject);
+
+/** @brief Delete the cache and free all of its memory, sets *c = NULL.
+ *  Objects still referenced must be released before this is called.
+ */
+void cache_delete(cache_t **c);
+
+/** @brief Look up uri and take a reference on its object.
+ *
+ *  @return the object, or NULL on a miss
+ */
+cacheObj_t *cache_get(cache_t *c, const char *uri);
+
+/** @brief Read the file fd into a new object for uri, replacing any
+ *  object already cached for it, and take a reference on it. The caller
+ *  must hold the URI's lock so the file can't change underneath.
+ *
+ *  @param st the fstat() of fd, kept with the object
+ *
+ *  @return the object, or NULL if the file is too big or can't be read
+ */
+cacheObj_t *cache_load(cache_t *c, const char *uri, int fd, const struct stat *st);
+
+/** @brief Drop a reference taken by cache_get or cache_load.
+ */
+void cache_release(cache_t *c, cacheObj_t *o);
+
+/** @brief Remove uri's object, if any, so later GETs go to the file.
+ *  Called by writers while they hold the URI's writer lock.
+ */
+void cache_invalidate(cache_t *c, const char *uri);
+
+/** @brief The cached file contents.
+ */
+const char *cache_data(cacheObj_t *o);
+
+/** @brief The size of the cached file contents.
+ */
+off_t cache_size(cacheObj_t *o);
+
+/** @brief The file's metadata at the time it was loaded.
+ */
+const struct stat *cache_stat(cacheObj_t *o);
+
+/** @brief Fill *stats with the cache's counters.
+ */
+void cache_stats(cache_t *c, cacheStats *stats);
@@ -0,0 +1,45 @@
+/**
+ * @File config.h
+ *
+ * Server settings chosen on the command line, filled in by main before
+ * any thread starts and only read afterwards.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+// How far PUTs go to make their changes survive a crash before answering
+typedef enum {
+    DURABLE_NONE,  // leave it to the kernel's writeback
+    DURABLE_SYNC,  // fdatasync() every PUT's file, and the directory for new names
+    DURABLE_GROUP, // one syncfs() shared by every PUT that finished meanwhile
+} durabilityLevel;
+
+typedef struct serverConfig {
+    int nThreads;   // workers, or the fewest the dispatcher's pool keeps
+    int maxThreads; // the most the dispatcher's pool grows to
+    int queueSize;  // connections the dispatcher may queue for workers
+    int maxQueued;     // queued connections past which new ones get 503, 0 for no limit
+    int queueTargetMs; // queue wait past which new ones get 503, 0 for no target
+    bool eventMode;
+    bool uringMode;     // event loops drive their sockets through io_uring
+    bool lockFreeQueue; // hand connections to workers through the lock-free ring
+    bool reusePort;     // every worker accepts on its own SO_REUSEPORT listener
+    int idleTimeout; // seconds a keep-alive connection may wait for its next request
+    int sendTimeout; // seconds a request in progress may go without its client moving
+    int maxRequests; // requests served on one connection before it is closed
+    int cacheMB;     // object cache budget in megabytes, 0 turns it off
+    int maxHeadKB;   // largest request head accepted, in kilobytes
+    int cachedFds;   // open files and missing URIs the fd cache keeps, 0 turns it off
+    bool atomicPut;  // PUTs upload to a new file and rename it over the old one
+    int logObjectKB; // PUT bodies up to this size go to the log store, 0 turns it off
+    durabilityLevel durability;
+    int commitWindowUs; // how long a group commit waits for more PUTs to join
+    const char *auditPath; // audit log file, NULL for stderr
+    bool dropAuditRecords; // drop records when a thread's log ring is full instead of waiting
+    bool futexLocks;       // per-URI locks are futex rwlocks rather than mutex ones
+    bool lockStats;        // keep contention statistics for every URI's lock
+} serverConfig;
+
+extern serverConfig config;
@@ -0,0 +1,1794 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/sendfile.h>
+#include <sys/random.h>
+#include <stdatomic.h>
+#include "asgn2_helper_funcs.h"
+#include "config.h"
+#include "connection.h"
+#include "parser.h"
+#include "cache.h"
+#include "bufpool.h"
+#include "fdcache.h"
+#include "groupcommit.h"
+#include "logstore.h"
+
+// First size of a connection's receive buffer, it doubles while a request
+// head doesn't fit, up to config.maxHeadKB
+#define HEAD_BUF_SIZE 4096
+
+// Size of the buffer bodies are copied through when they can't be spliced
+// or sent with sendfile()
+#define IO_BUF_SIZE (64 << 10)
+
+// Ranges served in one multipart/byteranges response, more are ignored
+#define MAX_RANGES 8
+
+// Room in front of a chunk's data in ioBuf for its hex size and "\r\n"
+#define CHUNK_HEAD 8
+
+// URI of the metrics endpoint, it shadows any file of that name
+#define METRICS_URI "metrics"
+
+// Uploads in atomic PUT mode are staged under names no URI can have
+#define STAGE_PREFIX "upload_"
+
+// Numbers the staged upload files of every thread
+static _Atomic unsigned long stageCounter;
+
+// Blocking connections whose thread sleeps on a URI lock
+static _Atomic int lockSleepers;
+
+// Numbers multipart responses, for boundaries when getrandom() fails
+static _Atomic unsigned long boundaryCounter;
+
+// Pipe used by this thread to splice PUT bodies from socket to file. It is
+// always left empty between calls so any connection on the thread can use it.
+static _Thread_local int bodyPipe[2] = { -1, -1 };
+static _Thread_local int bodyPipeSize = 0;
+
+// Structs --------------------------------------------------------------------
+
+typedef enum { READ_REQUEST, PARSE, LOCK, IO, RESPOND, FINISH } connPhase;
+
+// private connObj type
+typedef struct connObj {
+    int fd;
+    bool nonBlocking;
+    int recvTimeout; // seconds, of a blocking socket
+    int wakeFd; // the loop's eventfd a parked connection is woken through
+    connPhase phase;
+
+    // Receive buffer from bufPool, unconsumed bytes are
+    // buffer[bufStart, bufLen). It is given back while the connection
+    // idles between requests with nothing buffered.
+    char *buffer;
+    size_t bufSize;
+    int bufStart;
+    int bufLen;
+    int headLen;
+
+    // Request, parsed in place over buffer
+    httpParser parser;
+    httpRequest req;
+    const char *method;
+    char uri[65];
+    int requestId;
+    off_t contentLen;
+    bool chunked;
+    chunkDecoder chunks;
+    int statusCode;
+    bool isGet;
+    bool keepAlive;
+    int nRequests;
+
+    // Per-URI synchronization
+    uriEntry_t *entry;
+    bool locked;
+    bool lockWaiting; // counted among the lock's waiters while retrying its trylock
+
+    // File transfer, file bytes waiting to be sent are ioBuf[ioStart, ioLen)
+    bool opened;
+    cacheObj_t *cached;
+    fdEntry_t *openFile; // fd cache entry fileFd belongs to, NULL if it's ours
+    logObject logged;    // stored version fileFd belongs to, or a logged PUT made
+    int fileFd;
+    bool isCreated;
+    off_t fileBase; // where the body starts in fileFd, a logged body sits in its segment
+    off_t fileOff;
+    off_t bodyRemaining;
+    bool copyBody;
+    bool chunkedBody;
+    bool lastChunk;
+    bool staged;
+    char stagePath[32];
+    bool logPut;    // the body goes to the log store
+    bool auditLater; // let go of its lock before the response ended
+    bool wasLogged; // the version a file PUT replaces was in the log store
+    int putStatus;     // status of a PUT whose changes are made, 0 before
+    long commitTicket; // group commit the PUT waits on, 0 for none
+    char *ioBuf; // from bufPool on first use, given back with the request
+    size_t ioSize;
+    int ioStart;
+    int ioLen;
+
+    // Requested byte ranges, parts of a multipart body are sent in order
+    byteRange ranges[MAX_RANGES];
+    int nRanges;
+    int nextRange;
+    off_t fileSize;
+    char boundary[20];
+
+    // Validators of the file being sent
+    char etag[56];
+    char lastModified[32];
+
+    // Response bytes waiting to be sent are resp[respSent, respLen)
+    const char *resp;
+    size_t respLen;
+    size_t respSent;
+    char respHead[384];
+    char *respAlloc; // a response too big for respHead, freed with the request
+
+    // Timing and traffic of the request for metrics, 0 times are unset
+    long requestStart;
+    long phaseStart;
+    long lockStart;
+    bool lockRetried; // a trylock failed, so the wait happened outside the lock
+    long phaseNs[N_PHASES];
+    unsigned phasesSeen;
+    long bytesIn;
+    long bytesOut;
+} connObj;
+
+// Helper Functions -----------------------------------------------------------
+
+// Numeric value of a header, which must be nothing but decimal digits up
+// to its "\r\n" and at most max. Returns -1 for anything else, so a sign,
+// junk or an overflowing number can't be read as some other length.
+static off_t headerInt(Conn c, int header, off_t max) {
+    strSlice value = c->req.headerValues[header];
+    off_t n = 0;
+    for (int i = 0; i < value.len; i++) {
+        char d = c->buffer[value.off + i];
+        if (d < '0' || d > '9' || n > (max - (d - '0')) / 10) {
+            return -1;
+        }
+        n = n * 10 + (d - '0');
+    }
+    return n;
+}
+
+// Strong validator and Last-Modified date of a file. The ETag changes
+// when a PUT replaces the file (new inode) or rewrites it (new size or
+// modification time).
+static void formatValidators(const struct stat *st, char *etag, char *lastModified) {
+    unsigned long mtime = (unsigned long) st->st_mtim.tv_sec * 1000000000UL + st->st_mtim.tv_nsec;
+    snprintf(etag, 56, "\"%lx-%lx-%lx\"", (unsigned long) st->st_ino,
+        (unsigned long) st->st_size, mtime);
+    struct tm tm;
+    gmtime_r(&st->st_mtim.tv_sec, &tm);
+    strftime(lastModified, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+}
+
+// True if the entity-tag list of an If-Match or If-None-Match header is
+// "*" or names etag. Weak tags (W/"...") only count when weak is true.
+static bool etagListHas(Conn c, int header, const char *etag, bool weak) {
+    strSlice s = c->req.headerValues[header];
+    const char *p = c->buffer + s.off;
+    const char *end = p + s.len;
+    size_t etagLen = strlen(etag);
+    while (p < end) {
+        if (*p == ' ' || *p == '\t' || *p == ',') {
+            p++;
+            continue;
+        }
+        if (*p == '*') {
+            return true;
+        }
+        bool isWeak = end - p > 2 && p[0] == 'W' && p[1] == '/';
+        if (isWeak) {
+            p += 2;
+        }
+        if (*p != '"') {
+            return false;
+        }
+        const char *close = memchr(p + 1, '"', end - p - 1);
+        if (close == NULL) {
+            return false;
+        }
+        if ((size_t) (close + 1 - p) == etagLen && memcmp(p, etag, etagLen) == 0
+            && (weak || !isWeak)) {
+            return true;
+        }
+        p = close + 1;
+    }
+    return false;
+}
+
+// Seconds since the epoch of an HTTP-date header, or -1 if it isn't one
+static time_t headerDate(Conn c, int header) {
+    strSlice s = c->req.headerValues[header];
+    char date[64];
+    if (s.len >= (int) sizeof(date)) {
+        return -1;
+    }
+    memcpy(date, c->buffer + s.off, s.len);
+    date[s.len] = '\0';
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    const char *end = strptime(date, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+    if (end == NULL || *end != '\0') {
+        return -1;
+    }
+    return timegm(&tm);
+}
+
+// Reason phrase for a status code, also used as the body of responses
+// that carry no file contents
+static const char *statusMessage(int statusCode) {
+    switch (statusCode) {
+    case 200: return "OK";
+    case 201: return "Created";
+    case 206: return "Partial Content";
+    case 304: return "Not Modified";
+    case 400: return "Bad Request";
+    case 403: return "Forbidden";
+    case 404: return "Not Found";
+    case 408: return "Request Timeout";
+    case 412: return "Precondition Failed";
+    case 416: return "Range Not Satisfiable";
+    case 431: return "Request Header Fields Too Large";
+    case 501: return "Not Implemented";
+    case 505: return "Version Not Supported";
+    default: return "Internal Server Error";
+    }
+}
+
+// Queue a response with the extra header lines in headers (each ending in
+// "\r\n") to be written in the RESPOND phase. After a bad or failed
+// request the rest of the stream can't be trusted, so it is closed.
+static void respondWith(Conn c, int statusCode, const char *headers) {
+    const char *msg = statusMessage(statusCode);
+    if (statusCode == 400 || statusCode == 408 || statusCode >= 500) {
+        c->keepAlive = false;
+    }
+
+    c->statusCode = statusCode;
+    c->respLen = snprintf(c->respHead, sizeof(c->respHead),
+        "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n%s%s\r\n%s\n", statusCode, msg, strlen(msg) + 1,
+        headers, c->keepAlive ? "" : "Connection: close\r\n", msg);
+    c->resp = c->respHead;
+    c->respSent = 0;
+    c->phase = RESPOND;
+}
+
+static void respond(Conn c, int statusCode) {
+    respondWith(c, statusCode, "");
+}
+
+// End a request that can't be answered anymore and close its connection
+static void abortRequest(Conn c, int statusCode) {
+    c->statusCode = statusCode;
+    c->keepAlive = false;
+    c->phase = FINISH;
+}
+
+// Forget the finished request, keeping any pipelined bytes after it
+static void resetRequest(Conn c) {
+    int leftover = c->bufLen - c->bufStart;
+    if (leftover > 0 && c->bufStart > 0) {
+        memmove(c->buffer, c->buffer + c->bufStart, leftover);
+    }
+    c->bufStart = 0;
+    c->bufLen = leftover;
+    c->headLen = 0;
+
+    c->phase = READ_REQUEST;
+    parserReset(&c->parser);
+    c->method = "";
+    c->uri[0] = '\0';
+    c->requestId = 0;
+    c->contentLen = 0;
+    c->chunked = false;
+    chunkReset(&c->chunks);
+    c->statusCode = 200;
+    c->isGet = false;
+    c->keepAlive = true;
+    c->isCreated = false;
+    c->opened = false;
+    c->fileBase = 0;
+    c->fileOff = 0;
+    c->bodyRemaining = 0;
+    c->copyBody = false;
+    c->chunkedBody = false;
+    c->lastChunk = false;
+    c->staged = false;
+    c->logPut = false;
+    c->auditLater = false;
+    c->wasLogged = false;
+    c->putStatus = 0;
+    c->commitTicket = 0;
+    c->ioStart = 0;
+    c->ioLen = 0;
+    c->nRanges = 0;
+    c->nextRange = 0;
+    c->resp = NULL;
+    c->respLen = 0;
+    c->respSent = 0;
+    c->requestStart = 0;
+    c->lockStart = 0;
+    c->lockRetried = false;
+    c->phasesSeen = 0;
+    memset(c->phaseNs, 0, sizeof(c->phaseNs));
+    c->bytesIn = 0;
+    c->bytesOut = 0;
+}
+
+// A failed read or write on a blocking socket (including its receive
+// timeout) ends the connection, on a non-blocking one EAGAIN means wait
+static bool wouldBlock(Conn c) {
+    return c->nonBlocking && (errno == EAGAIN || errno == EWOULDBLOCK);
+}
+
+// Whether a failed read or write on a blocking socket ran into its timeout
+static bool timedOut(void) {
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+}
+
+// Wait up to seconds for each read of a blocking socket. Only the head of
+// a request is read under the short idle timeout; once a PUT's body is
+// on its way the client gets as long as for taking a response.
+static void setRecvTimeout(Conn c, int seconds) {
+    if (c->nonBlocking || c->recvTimeout == seconds) {
+        return;
+    }
+    struct timeval tv = { .tv_sec = seconds, .tv_usec = 0 };
+    setsockopt(c->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    c->recvTimeout = seconds;
+}
+
+// How many more bytes of a request head may be read into the receive
+// buffer, taking the buffer if the connection has none and doubling it
+// when it is full. 0 once the head is as large as config.maxHeadKB allows.
+static int headSpace(Conn c) {
+    int limit = config.maxHeadKB << 10;
+    if (c->buffer == NULL) {
+        c->buffer = bufpool_get(bufPool, HEAD_BUF_SIZE, &c->bufSize);
+    } else if (c->bufLen == (int) c->bufSize && c->bufLen < limit) {
+        size_t size;
+        char *bigger = bufpool_get(bufPool, c->bufSize * 2, &size);
+        memcpy(bigger, c->buffer, c->bufLen);
+        bufpool_put(bufPool, c->buffer, c->bufSize);
+        c->buffer = bigger;
+        c->bufSize = size;
+    }
+    int end = (int) c->bufSize < limit ? (int) c->bufSize : limit;
+    return end > c->bufLen ? end - c->bufLen : 0;
+}
+
+// Give the receive buffer back, for a connection with nothing buffered
+static void dropBuffer(Conn c) {
+    if (c->buffer != NULL) {
+        bufpool_put(bufPool, c->buffer, c->bufSize);
+        c->buffer = NULL;
+        c->bufSize = 0;
+    }
+}
+
+// The buffer bodies are copied through, taken the first time the request
+// needs it
+static char *ioBuffer(Conn c) {
+    if (c->ioBuf == NULL) {
+        c->ioBuf = bufpool_get(bufPool, IO_BUF_SIZE, &c->ioSize);
+    }
+    return c->ioBuf;
+}
+
+// Write pending response bytes, returns -1 on error, 0 when all are sent
+// and 1 if the socket is full. flags are added to the send() flags.
+static int flushResponse(Conn c, int flags) {
+    while (c->respSent < c->respLen) {
+        ssize_t n = send(
+            c->fd, c->resp + c->respSent, c->respLen - c->respSent, MSG_NOSIGNAL | flags);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return wouldBlock(c) ? 1 : -1;
+        }
+        c->respSent += n;
+        c->bytesOut += n;
+    }
+    return 0;
+}
+
+// Phases ---------------------------------------------------------------------
+
+// Read from the socket until the whole request head is buffered, parsing
+// each new chunk where the last one left off
+static connStatus readRequest(Conn c) {
+    setRecvTimeout(c, config.idleTimeout);
+    while (1) {
+        // The request's clock starts at its first byte, not while the
+        // connection sits idle between requests
+        if (c->requestStart == 0 && c->bufLen > 0) {
+            c->requestStart = metrics_now();
+            c->phaseStart = c->requestStart;
+        }
+
+        int space = headSpace(c);
+        parseResult result = parseRequestHead(&c->parser, c->buffer, c->bufLen, &c->req);
+        if (result == PARSE_DONE) {
+            break;
+        }
+        if (result == PARSE_ERROR) {
+            respond(c, 400);
+            return CONN_WANT_WRITE;
+        }
+        if (result == PARSE_TOO_MANY_HEADERS) {
+            // The rest of the head is never parsed, so the stream can't go on
+            c->keepAlive = false;
+            respond(c, 431);
+            return CONN_WANT_WRITE;
+        }
+        if (space == 0) {
+            // The rest of the head is never read, so the stream can't go on
+            c->keepAlive = false;
+            respond(c, 431);
+            return CONN_WANT_WRITE;
+        }
+
+        ssize_t n = read(c->fd, c->buffer + c->bufLen, space);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && wouldBlock(c)) {
+            // An idle connection holds no buffer while it waits
+            if (c->bufLen == 0) {
+                dropBuffer(c);
+            }
+            return CONN_WANT_READ;
+        }
+        if (n <= 0) {
+            if (c->bufLen == 0) {
+                // Client left or idled out between requests
+                c->keepAlive = false;
+                c->phase = FINISH;
+            } else {
+                respond(c, n < 0 && timedOut() ? 408 : 400);
+            }
+            return CONN_WANT_WRITE;
+        }
+        c->bufLen += n;
+        c->bytesIn += n;
+    }
+
+    c->headLen = c->req.headLen;
+    c->bufStart = c->headLen;
+    c->phase = PARSE;
+    return CONN_WANT_READ;
+}
+
+// Write the buffer pool's usage in the Prometheus text format to out,
+// returns its length
+static int renderBufPool(char *out, size_t size) {
+    bufPoolStats stats;
+    bufpool_stats(bufPool, &stats);
+    int len = snprintf(out, size,
+        "# HELP http_buffer_pool_bytes Bytes of connection buffers, in use or cached for reuse.\n"
+        "# TYPE http_buffer_pool_bytes gauge\n"
+        "http_buffer_pool_bytes{state=\"in_use\"} %ld\n"
+        "http_buffer_pool_bytes{state=\"cached\"} %ld\n"
+        "# HELP http_buffer_pool_high_water_bytes Most bytes of connection buffers allocated "
+        "at once.\n"
+        "# TYPE http_buffer_pool_high_water_bytes gauge\n"
+        "http_buffer_pool_high_water_bytes %ld\n"
+        "# HELP http_buffer_pool_gets_total Connection buffers handed out, by whether one was "
+        "reused.\n"
+        "# TYPE http_buffer_pool_gets_total counter\n"
+        "http_buffer_pool_gets_total{reused=\"true\"} %ld\n"
+        "http_buffer_pool_gets_total{reused=\"false\"} %ld\n",
+        stats.bytesInUse, stats.bytesCached, stats.highWaterBytes, stats.reused,
+        stats.gets - stats.reused);
+    return len < (int) size ? len : (int) size - 1;
+}
+
+// Queue the metrics of the whole server in the Prometheus text format
+static void respondMetrics(Conn c) {
+    size_t len;
+    char *body = metrics_render(serverMetrics, &len);
+    char pool[640];
+    int poolLen = renderBufPool(pool, sizeof(pool));
+    char head[160];
+    int headLen = snprintf(head, sizeof(head),
+        "HTTP/1.1 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+        "%s\r\n",
+        len + poolLen, c->keepAlive ? "" : "Connection: close\r\n");
+
+    c->respAlloc = malloc(headLen + len + poolLen);
+    assert(c->respAlloc != NULL);
+    memcpy(c->respAlloc, head, headLen);
+    memcpy(c->respAlloc + headLen, body, len);
+    memcpy(c->respAlloc + headLen + len, pool, poolLen);
+    free(body);
+
+    c->statusCode = 200;
+    c->resp = c->respAlloc;
+    c->respLen = headLen + len + poolLen;
+    c->respSent = 0;
+    c->phase = RESPOND;
+}
+
+// Check the parsed request and collect the fields the server acts on
+static void parseRequest(Conn c) {
+    httpRequest *req = &c->req;
+
+    // Method
+    if (sliceIs(c->buffer, req->method, "GET")) {
+        c->method = "GET";
+        c->isGet = true;
+    } else if (sliceIs(c->buffer, req->method, "PUT")) {
+        c->method = "PUT";
+    } else {
+        respond(c, 501);
+        return;
+    }
+
+    // URI, without its leading '/'
+    memcpy(c->uri, c->buffer + req->uri.off + 1, req->uri.len - 1);
+    c->uri[req->uri.len - 1] = '\0';
+
+    // Version
+    if (!sliceIs(c->buffer, req->version, "HTTP/1.1")) {
+        respond(c, 505);
+        return;
+    }
+
+    // Header Fields
+    if (ambiguousFraming(c->buffer, req)) {
+        respond(c, 400);
+        return;
+    }
+    int header;
+    if ((header = findHeader(c->buffer, req, "Request-Id")) >= 0) {
+        off_t id = headerInt(c, header, INT_MAX);
+        if (id < 0) {
+            respond(c, 400);
+            return;
+        }
+        c->requestId = (int) id;
+    }
+    if ((header = findHeader(c->buffer, req, "Content-Length")) >= 0) {
+        c->contentLen = headerInt(c, header, INT64_MAX);
+        if (c->contentLen < 0) {
+            c->contentLen = 0;
+            respond(c, 400);
+            return;
+        }
+    }
+    if ((header = findHeader(c->buffer, req, "Transfer-Encoding")) >= 0) {
+        // Only a plain chunked body can be decoded
+        if (!sliceIsCase(c->buffer, req->headerValues[header], "chunked")) {
+            respond(c, 501);
+            return;
+        }
+        c->chunked = true;
+    }
+    if ((header = findHeader(c->buffer, req, "Connection")) >= 0) {
+        if (sliceIsCase(c->buffer, req->headerValues[header], "close")) {
+            c->keepAlive = false;
+        } else if (sliceIsCase(c->buffer, req->headerValues[header], "keep-alive")) {
+            c->keepAlive = true;
+        }
+    }
+    if (c->nRequests + 1 >= config.maxRequests) {
+        c->keepAlive = false;
+    }
+
+    if (c->isGet && strcmp(c->uri, METRICS_URI) == 0) {
+        respondMetrics(c);
+        return;
+    }
+
+    // Atomic and logged PUTs upload first and only lock to publish the
+    // new version
+    c->logPut = logStore != NULL && !c->isGet && !c->chunked
+                && c->contentLen <= (off_t) config.logObjectKB << 10;
+    c->phase = ((config.atomicPut || c->logPut) && !c->isGet) ? IO : LOCK;
+}
+
+// Take the per-URI lock, only trying it on non-blocking connections
+static connStatus lockURI(Conn c) {
+    if (c->entry == NULL) {
+        // One lookup, the handle is used until the request finishes
+        c->entry = uritable_acquire(uriLocks, c->uri);
+    }
+
+    if (c->lockStart == 0) {
+        c->lockStart = metrics_now();
+    }
+
+    rwlock_t *rw = uritable_rwlock(c->entry);
+    if (c->nonBlocking) {
+        bool acquired = c->isGet ? reader_trylock(rw) : writer_trylock(rw);
+        if (!acquired) {
+            // Registered once, so the lock's priority holds others back
+            // for us between retries like it would for a sleeping thread
+            if (!c->lockWaiting) {
+                rwlock_wait_begin(rw, !c->isGet);
+                c->lockWaiting = true;
+            }
+            // Parked until the next release, unless that was just now
+            uritable_park(uriLocks, c->entry, c->wakeFd);
+            acquired = c->isGet ? reader_trylock(rw) : writer_trylock(rw);
+        }
+        if (!acquired) {
+            c->lockRetried = true;
+            return CONN_WANT_LOCK;
+        }
+        if (c->lockWaiting) {
+            rwlock_wait_end(rw, !c->isGet);
+            c->lockWaiting = false;
+        }
+    } else {
+        atomic_fetch_add(&lockSleepers, 1);
+        if (c->isGet) {
+            reader_lock(rw);
+        } else {
+            writer_lock(rw);
+        }
+        atomic_fetch_sub(&lockSleepers, 1);
+    }
+    long waited = metrics_now() - c->lockStart;
+    metrics_lock_wait(serverMetrics, !c->isGet, waited);
+    if (c->lockRetried) {
+        rwlock_waited(rw, !c->isGet, waited);
+    }
+
+    c->locked = true;
+    c->phase = IO;
+    return CONN_WANT_READ;
+}
+
+// Release the per-URI lock without audit logging
+static void releaseURI(Conn c) {
+    if (c->isGet) {
+        reader_unlock(uritable_rwlock(c->entry));
+    } else {
+        writer_unlock(uritable_rwlock(c->entry));
+    }
+    c->locked = false;
+    uritable_wake(uriLocks, c->entry);
+}
+
+// Release the per-URI lock, audit logging while it is still held so the
+// log keeps the order in which requests to the URI took effect
+static void unlockURI(Conn c) {
+    if (!c->locked) {
+        return;
+    }
+    auditlog_write(auditLog, c->method, c->uri, c->statusCode, c->requestId);
+    releaseURI(c);
+}
+
+// Send bodyRemaining bytes of the file from fileOff. Cached files are sent
+// from memory. Otherwise the kernel copies file pages straight to the
+// socket with sendfile(); files it can't do that for go through ioBuf
+// instead. Either way a full socket only pauses the send. Leaves the
+// connection in the IO phase unless the send failed.
+static connStatus sendBody(Conn c) {
+    while (c->bodyRemaining > 0) {
+        if (c->cached != NULL) {
+            ssize_t n = send(c->fd, cache_data(c->cached) + c->fileOff, c->bodyRemaining,
+                MSG_NOSIGNAL);
+            if (n < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                if (wouldBlock(c)) {
+                    return CONN_WANT_WRITE;
+                }
+                abortRequest(c, timedOut() ? 408 : 500);
+                return CONN_CLOSE;
+            }
+            c->fileOff += n;
+            c->bodyRemaining -= n;
+            c->bytesOut += n;
+            continue;
+        }
+
+        if (!c->copyBody) {
+            ssize_t n = sendfile(c->fd, c->fileFd, &c->fileOff, c->bodyRemaining);
+            if (n > 0) {
+                c->bodyRemaining -= n;
+                c->bytesOut += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n < 0 && wouldBlock(c)) {
+                return CONN_WANT_WRITE;
+            }
+            if (n < 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                c->copyBody = true;
+                continue;
+            }
+            // Send failed or the file shrank under us
+            abortRequest(c, n < 0 && timedOut() ? 408 : 500);
+            return CONN_CLOSE;
+        }
+
+        if (c->ioStart == c->ioLen) {
+            char *buf = ioBuffer(c);
+            size_t toRead = c->ioSize;
+            if ((off_t) toRead > c->bodyRemaining) {
+                toRead = (size_t) c->bodyRemaining;
+            }
+            ssize_t bytesRead = pread(c->fileFd, buf, toRead, c->fileOff);
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead <= 0) {
+                abortRequest(c, 500);
+                return CONN_CLOSE;
+            }
+            c->fileOff += bytesRead;
+            c->ioStart = 0;
+            c->ioLen = (int) bytesRead;
+        }
+
+        ssize_t n = send(c->fd, c->ioBuf + c->ioStart, c->ioLen - c->ioStart, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (wouldBlock(c)) {
+                return CONN_WANT_WRITE;
+            }
+            abortRequest(c, timedOut() ? 408 : 500);
+            return CONN_CLOSE;
+        }
+        c->ioStart += (int) n;
+        c->bodyRemaining -= n;
+        c->bytesOut += n;
+    }
+    return CONN_CLOSE;
+}
+
+// Send a file whose length isn't known up front, such as a pipe, as chunks
+// of up to one ioBuf each until it ends. bodyRemaining stays positive
+// until the terminating empty chunk has been sent.
+static connStatus sendChunks(Conn c) {
+    while (c->bodyRemaining > 0) {
+        if (c->ioStart == c->ioLen) {
+            if (c->lastChunk) {
+                c->bodyRemaining = 0;
+                break;
+            }
+            char *buf = ioBuffer(c);
+            ssize_t bytesRead = read(c->fileFd, buf + CHUNK_HEAD, c->ioSize - CHUNK_HEAD - 2);
+            if (bytesRead < 0 && errno == EINTR) {
+                continue;
+            }
+            if (bytesRead < 0) {
+                abortRequest(c, 500);
+                return CONN_CLOSE;
+            }
+
+            // Frame the data in place, the last chunk is empty and followed
+            // by the empty line that ends the (missing) trailers
+            char size[CHUNK_HEAD + 1];
+            int len = snprintf(size, sizeof(size), "%zx\r\n", (size_t) bytesRead);
+            c->ioStart = CHUNK_HEAD - len;
+            memcpy(c->ioBuf + c->ioStart, size, len);
+            c->ioLen = CHUNK_HEAD + (int) bytesRead;
+            memcpy(c->ioBuf + c->ioLen, "\r\n", 2);
+            c->ioLen += 2;
+            c->lastChunk = bytesRead == 0;
+        }
+
+        ssize_t n = send(c->fd, c->ioBuf + c->ioStart, c->ioLen - c->ioStart, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (wouldBlock(c)) {
+                return CONN_WANT_WRITE;
+            }
+            abortRequest(c, timedOut() ? 408 : 500);
+            return CONN_CLOSE;
+        }
+        c->ioStart += (int) n;
+        c->bytesOut += n;
+    }
+    return CONN_CLOSE;
+}
+
+// Length of the head of multipart part i, or of the closing boundary when
+// i is nRanges. With buf it is also written there.
+static int partHead(Conn c, int i, char *buf, size_t size) {
+    if (i == c->nRanges) {
+        return snprintf(buf, size, "\r\n--%s--\r\n", c->boundary);
+    }
+    return snprintf(buf, size, "\r\n--%s\r\nContent-Range: bytes %ld-%ld/%ld\r\n\r\n",
+        c->boundary, (long) c->ranges[i].first, (long) c->ranges[i].last, (long) c->fileSize);
+}
+
+// Queue the head of the next multipart part, or the closing boundary
+// after the last part. Returns false once there is nothing left to queue.
+static bool nextPart(Conn c) {
+    if (c->nRanges < 2 || c->nextRange > c->nRanges) {
+        return false;
+    }
+    int i = c->nextRange;
+    c->respLen = partHead(c, i, c->respHead, sizeof(c->respHead));
+    c->resp = c->respHead;
+    c->respSent = 0;
+    if (i < c->nRanges) {
+        c->fileOff = c->fileBase + c->ranges[i].first;
+        c->bodyRemaining = c->ranges[i].last - c->ranges[i].first + 1;
+    }
+    c->nextRange += 1;
+    return true;
+}
+
+// Queue the response head for the opened file: 200 with the whole file,
+// 206 with one range or a multipart/byteranges body for several, or 416
+// if no requested range overlaps the file. Returns false for a 416.
+static bool queueBodyHead(Conn c) {
+    off_t size = c->fileSize;
+    int header = findHeader(c->buffer, &c->req, "Range");
+    c->nRanges = RANGES_IGNORED;
+
+    // If-Range asks for the ranges only if the file is still the version
+    // the client has part of, and for all of it otherwise
+    int ifRange = findHeader(c->buffer, &c->req, "If-Range");
+    if (ifRange >= 0 && !sliceIs(c->buffer, c->req.headerValues[ifRange], c->etag)
+        && !sliceIs(c->buffer, c->req.headerValues[ifRange], c->lastModified)) {
+        header = -1;
+    }
+    if (header >= 0) {
+        c->nRanges = parseByteRanges(
+            c->buffer, c->req.headerValues[header], size, c->ranges, MAX_RANGES);
+    }
+    if (c->nRanges == 0) {
+        char headers[64];
+        snprintf(headers, sizeof(headers), "Content-Range: bytes */%ld\r\n", (long) size);
+        respondWith(c, 416, headers);
+        return false;
+    }
+
+    char headers[160];
+    snprintf(headers, sizeof(headers), "ETag: %s\r\nLast-Modified: %s\r\n%s", c->etag,
+        c->lastModified, c->keepAlive ? "" : "Connection: close\r\n");
+    c->fileOff = c->fileBase;
+    c->bodyRemaining = size;
+    if (c->nRanges == RANGES_IGNORED) {
+        c->nRanges = 0;
+        c->statusCode = 200;
+        c->respLen = snprintf(c->respHead, sizeof(c->respHead),
+            "HTTP/1.1 200 OK\r\nContent-Length: %ld\r\n%s\r\n", (long) size, headers);
+    } else if (c->nRanges == 1) {
+        c->statusCode = 206;
+        c->fileOff = c->fileBase + c->ranges[0].first;
+        c->bodyRemaining = c->ranges[0].last - c->ranges[0].first + 1;
+        c->respLen = snprintf(c->respHead, sizeof(c->respHead),
+            "HTTP/1.1 206 Partial Content\r\nContent-Length: %ld\r\n"
+            "Content-Range: bytes %ld-%ld/%ld\r\n%s\r\n",
+            (long) c->bodyRemaining, (long) c->ranges[0].first, (long) c->ranges[0].last,
+            (long) size, headers);
+    } else {
+        // Parts are sent by nextPart(), the head only needs their total size
+        // Random, so neither a file nor a client can make it occur in a part
+        uint64_t r;
+        if (getrandom(&r, sizeof(r), GRND_NONBLOCK) != (ssize_t) sizeof(r)) {
+            r = (uint64_t) metrics_now() ^ (atomic_fetch_add(&boundaryCounter, 1) << 32);
+        }
+        snprintf(c->boundary, sizeof(c->boundary), "%016llx", (unsigned long long) r);
+        off_t total = partHead(c, c->nRanges, NULL, 0);
+        for (int i = 0; i < c->nRanges; i++) {
+            total += partHead(c, i, NULL, 0) + c->ranges[i].last - c->ranges[i].first + 1;
+        }
+        c->statusCode = 206;
+        c->bodyRemaining = 0;
+        c->respLen = snprintf(c->respHead, sizeof(c->respHead),
+            "HTTP/1.1 206 Partial Content\r\nContent-Length: %ld\r\n"
+            "Content-Type: multipart/byteranges; boundary=%s\r\n%s\r\n",
+            (long) total, c->boundary, headers);
+    }
+    c->resp = c->respHead;
+    c->respSent = 0;
+    return true;
+}
+
+// Queue a chunked 200 head for a file that has no size to go by. Ranges
+// and validators need a fixed length, so it gets neither.
+static void queueChunkedHead(Conn c) {
+    c->chunkedBody = true;
+    c->bodyRemaining = 1;
+    c->statusCode = 200;
+    c->respLen = snprintf(c->respHead, sizeof(c->respHead),
+        "HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n%s\r\n",
+        c->keepAlive ? "" : "Connection: close\r\n");
+    c->resp = c->respHead;
+    c->respSent = 0;
+}
+
+// Whether the client's copy is current. If-None-Match decides when it is
+// present, otherwise If-Modified-Since does.
+static bool notModified(Conn c, const struct stat *st) {
+    int header = findHeader(c->buffer, &c->req, "If-None-Match");
+    if (header >= 0) {
+        return etagListHas(c, header, c->etag, true);
+    }
+    header = findHeader(c->buffer, &c->req, "If-Modified-Since");
+    if (header >= 0) {
+        time_t since = headerDate(c, header);
+        return since >= 0 && st->st_mtim.tv_sec <= since;
+    }
+    return false;
+}
+
+// Open the file a GET sends and fstat it into *st, through the fd cache
+// when there is one. Returns 0, or the status code to answer with.
+static int openFile(Conn c, struct stat *st) {
+    if (fdCache != NULL) {
+        int err;
+        c->openFile = fdcache_open(fdCache, c->uri, &err);
+        if (c->openFile == NULL) {
+            return err == EISDIR ? 403 : err == ENOENT || err == ENOTDIR ? 404 : 500;
+        }
+        c->fileFd = fdcache_fd(c->openFile);
+        *st = *fdcache_stat(c->openFile);
+        return 0;
+    }
+
+    // O_NONBLOCK keeps a FIFO without a writer from blocking the open
+    c->fileFd = open(c->uri, O_RDONLY | O_NONBLOCK);
+    if (c->fileFd < 0) {
+        return errno == EISDIR ? 403 : 404;
+    }
+    if (fstat(c->fileFd, st) < 0) {
+        return 500;
+    }
+    return 0;
+}
+
+// Open the file or cached copy a GET sends and queue the response head.
+// Returns false if an error response was queued instead.
+static bool openBody(Conn c) {
+    struct stat st;
+
+    // Hot files are served from memory, the rest are loaded on a miss.
+    // Logged bodies are sent from their segment, a stored version shadows
+    // any file of the same name.
+    if (objectCache != NULL && (c->cached = cache_get(objectCache, c->uri)) != NULL) {
+        st = *cache_stat(c->cached);
+    } else if (logStore != NULL && logstore_get(logStore, c->uri, &c->logged)) {
+        st = c->logged.st;
+        c->fileFd = c->logged.fd;
+        c->fileBase = c->logged.offset;
+    } else {
+        int statusCode = openFile(c, &st);
+        if (statusCode != 0) {
+            respond(c, statusCode);
+            return false;
+        }
+        // A pipe or device may not have data for a long while, and a
+        // loop's worker can't block waiting for it
+        if (S_ISDIR(st.st_mode) || (!S_ISREG(st.st_mode) && c->nonBlocking)) {
+            respond(c, 403);
+            return false;
+        }
+        if (!S_ISREG(st.st_mode)) {
+            // Pipes and devices are read until they end, blocking for data
+            fcntl(c->fileFd, F_SETFL, fcntl(c->fileFd, F_GETFL) & ~O_NONBLOCK);
+            queueChunkedHead(c);
+            return true;
+        }
+        if (objectCache != NULL) {
+            c->cached = cache_load(objectCache, c->uri, c->fileFd, &st);
+        }
+    }
+
+    c->fileSize = st.st_size;
+    formatValidators(&st, c->etag, c->lastModified);
+    if (notModified(c, &st)) {
+        c->statusCode = 304;
+        c->respLen = snprintf(c->respHead, sizeof(c->respHead),
+            "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nLast-Modified: %s\r\n%s\r\n", c->etag,
+            c->lastModified, c->keepAlive ? "" : "Connection: close\r\n");
+        c->resp = c->respHead;
+        c->respSent = 0;
+        c->phase = RESPOND;
+        return false;
+    }
+    return queueBodyHead(c);
+}
+
+// GET method sends the contents of an existing URI
+static connStatus getMethod(Conn c) {
+    if (!c->opened) {
+        c->opened = true;
+        bool ok = openBody(c);
+
+        // Atomic PUTs replace files by rename and logged versions are never
+        // rewritten, so what was just opened stays this version and the
+        // lock was only needed to pick it. The body may still fail to go
+        // out, so the request is logged once it ends.
+        if (config.atomicPut || c->logged.segment != NULL) {
+            releaseURI(c);
+            c->auditLater = true;
+        }
+        if (!ok) {
+            return CONN_WANT_WRITE;
+        }
+    }
+
+    // Head, then body, then the next part's head and body if multipart
+    while (1) {
+        // MSG_MORE lets a head share a packet with the body after it
+        bool more = c->bodyRemaining > 0 || (c->nRanges > 1 && c->nextRange <= c->nRanges);
+        int rc = flushResponse(c, more ? MSG_MORE : 0);
+        if (rc > 0) {
+            return CONN_WANT_WRITE;
+        }
+        if (rc < 0) {
+            abortRequest(c, timedOut() ? 408 : 500);
+            return CONN_CLOSE;
+        }
+
+        connStatus status = c->chunkedBody ? sendChunks(c) : sendBody(c);
+        if (c->bodyRemaining > 0 || c->phase != IO) {
+            return status;
+        }
+        if (!nextPart(c)) {
+            c->phase = FINISH;
+            return CONN_CLOSE;
+        }
+    }
+}
+
+// Drop this thread's pipe, losing anything still in it
+static void closeBodyPipe(void) {
+    close(bodyPipe[0]);
+    close(bodyPipe[1]);
+    bodyPipe[0] = -1;
+    bodyPipe[1] = -1;
+}
+
+// Move the next part of a PUT body from the socket into the file through
+// this thread's pipe, without copying it into user space. Returns the
+// bytes moved, 0 at end of stream, -1 with errno set if the socket side
+// failed and -2 if the file side failed.
+static ssize_t spliceBody(Conn c) {
+    if (bodyPipe[0] < 0) {
+        if (pipe2(bodyPipe, O_CLOEXEC) < 0) {
+            errno = ENOSYS;
+            return -1;
+        }
+        // A bigger pipe moves more per pair of calls, the default is fine too
+        bodyPipeSize = fcntl(bodyPipe[1], F_SETPIPE_SZ, 1 << 20);
+        if (bodyPipeSize < 0) {
+            bodyPipeSize = fcntl(bodyPipe[1], F_GETPIPE_SZ);
+        }
+    }
+
+    size_t want = (size_t) bodyPipeSize;
+    if ((off_t) want > c->bodyRemaining) {
+        want = (size_t) c->bodyRemaining;
+    }
+    ssize_t n = splice(c->fd, NULL, bodyPipe[1], NULL, want, SPLICE_F_MOVE);
+    if (n <= 0) {
+        return n;
+    }
+
+    ssize_t left = n;
+    while (left > 0) {
+        ssize_t moved = splice(bodyPipe[0], NULL, c->fileFd, NULL, left, SPLICE_F_MOVE);
+        if (moved < 0 && errno == EINTR) {
+            continue;
+        }
+        if (moved <= 0) {
+            // The file can't take a splice, copy out what the pipe holds
+            if (moved < 0 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                char *chunk = ioBuffer(c);
+                size_t toRead = (size_t) left < c->ioSize ? (size_t) left : c->ioSize;
+                ssize_t bytesRead = read(bodyPipe[0], chunk, toRead);
+                if (bytesRead > 0 && write_n_bytes(c->fileFd, chunk, bytesRead) == bytesRead) {
+                    c->copyBody = true;
+                    left -= bytesRead;
+                    continue;
+                }
+            }
+            closeBodyPipe();
+            return -2;
+        }
+        left -= moved;
+    }
+    return n;
+}
+
+// Metadata of the URI's current version, logged or a file. Returns false
+// if it has none.
+static bool currentStat(Conn c, struct stat *st) {
+    if (logStore != NULL && logstore_stat(logStore, c->uri, st)) {
+        return true;
+    }
+    return stat(c->uri, st) == 0;
+}
+
+// Check If-Match and If-None-Match against the file as it is now. Called
+// with the writer lock held, so the file can't change between the check
+// and the write. Returns false if the PUT must not happen.
+static bool putAllowed(Conn c) {
+    int ifMatch = findHeader(c->buffer, &c->req, "If-Match");
+    int ifNoneMatch = findHeader(c->buffer, &c->req, "If-None-Match");
+    if (ifMatch < 0 && ifNoneMatch < 0) {
+        return true;
+    }
+
+    struct stat st;
+    char etag[56] = "";
+    char lastModified[32];
+    bool exists = currentStat(c, &st);
+    if (exists) {
+        formatValidators(&st, etag, lastModified);
+    }
+    if (ifMatch >= 0 && (!exists || !etagListHas(c, ifMatch, etag, false))) {
+        return false;
+    }
+    if (ifNoneMatch >= 0 && exists && etagListHas(c, ifNoneMatch, etag, true)) {
+        return false;
+    }
+    return true;
+}
+
+// Queue the PUT's response with the new ETag, so the client can make its
+// next PUT conditional on it
+static void respondPut(Conn c, int statusCode) {
+    struct stat st;
+    char headers[72] = "";
+    if (c->logged.segment != NULL) {
+        st = c->logged.st;
+    }
+    if (statusCode < 300 && (c->logged.segment != NULL || fstat(c->fileFd, &st) == 0)) {
+        char etag[56];
+        char lastModified[32];
+        formatValidators(&st, etag, lastModified);
+        snprintf(headers, sizeof(headers), "ETag: %s\r\n", etag);
+    }
+    respondWith(c, statusCode, headers);
+}
+
+// Create the file an atomic PUT uploads into, in the same directory as
+// the URI so it can be renamed over it
+static bool openStage(Conn c) {
+    while (1) {
+        snprintf(c->stagePath, sizeof(c->stagePath), STAGE_PREFIX "%lu",
+            atomic_fetch_add(&stageCounter, 1));
+        c->fileFd = open(c->stagePath, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0666);
+        if (c->fileFd >= 0) {
+            c->staged = true;
+            return true;
+        }
+        if (errno != EEXIST) {
+            return false;
+        }
+    }
+}
+
+// Drop the cached copy and open file of the URI, called with the writer
+// lock held so no reader can see them once the file starts changing
+static void invalidateURI(Conn c) {
+    if (objectCache != NULL) {
+        cache_invalidate(objectCache, c->uri);
+    }
+    if (fdCache != NULL) {
+        fdcache_invalidate(fdCache, c->uri);
+    }
+}
+
+// Drop the URI's logged version, for a PUT that stores it as a file.
+// Returns 1 if it had one, 0 if not, or -1 if it couldn't be dropped and
+// would shadow the file.
+static int unlogURI(Conn c) {
+    return logStore != NULL ? logstore_remove(logStore, c->uri) : 0;
+}
+
+// Replace the URI with the uploaded file. Called with the writer lock
+// held, which is all the time a GET of the URI can be kept waiting.
+// Returns the status code of the PUT.
+static int publishStage(Conn c) {
+    if (!putAllowed(c)) {
+        unlink(c->stagePath);
+        c->staged = false;
+        return 412;
+    }
+
+    struct stat st;
+    bool existed = currentStat(c, &st);
+    invalidateURI(c);
+    int rc = unlogURI(c) < 0 ? -1 : rename(c->stagePath, c->uri);
+    if (rc < 0) {
+        unlink(c->stagePath);
+    }
+    c->staged = false;
+    if (rc < 0) {
+        return 500;
+    }
+    return existed ? 200 : 201;
+}
+
+// Move the next bodyRemaining bytes of the PUT body, from the buffer and
+// then the socket, into the file. Returns true once they are all written,
+// otherwise false with *status set to what the connection waits on.
+static bool receiveBody(Conn c, connStatus *status) {
+    while (c->bodyRemaining > 0) {
+        int available = c->bufLen - c->bufStart;
+        if (available > 0) {
+            int bytesToWrite = available < c->bodyRemaining ? available : (int) c->bodyRemaining;
+            if (write_n_bytes(c->fileFd, c->buffer + c->bufStart, bytesToWrite) < 0) {
+                respond(c, 500);
+                *status = CONN_WANT_WRITE;
+                return false;
+            }
+            c->bufStart += bytesToWrite;
+            c->bodyRemaining -= bytesToWrite;
+            continue;
+        }
+
+        c->bufStart = 0;
+        c->bufLen = 0;
+
+        // Buffer drained, splice exactly the rest of the body (or chunk) unless this
+        // socket or file already showed it can't be spliced
+        if (!c->copyBody) {
+            ssize_t n = spliceBody(c);
+            if (n > 0) {
+                c->bodyRemaining -= n;
+                c->bytesIn += n;
+                continue;
+            }
+            if (n == -1 && errno == EINTR) {
+                continue;
+            }
+            if (n == -1 && wouldBlock(c)) {
+                *status = CONN_WANT_READ;
+                return false;
+            }
+            if (n == -1 && (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                c->copyBody = true;
+                continue;
+            }
+            if (n == -2) {
+                respond(c, 500);
+            } else {
+                // Body ended before all of it arrived, or stopped arriving
+                respond(c, n < 0 && timedOut() ? 408 : 400);
+            }
+            *status = CONN_WANT_WRITE;
+            return false;
+        }
+
+        // Copy through ioBuf, reading no further than the body's end so a
+        // pipelined request stays in the socket
+        char *buf = ioBuffer(c);
+        size_t toRead = c->ioSize;
+        if ((off_t) toRead > c->bodyRemaining) {
+            toRead = (size_t) c->bodyRemaining;
+        }
+        ssize_t n = read(c->fd, buf, toRead);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && wouldBlock(c)) {
+            *status = CONN_WANT_READ;
+            return false;
+        }
+        if (n <= 0) {
+            // Body ended before all of it arrived, or stopped arriving
+            respond(c, n < 0 && timedOut() ? 408 : 400);
+            *status = CONN_WANT_WRITE;
+            return false;
+        }
+        if (write_n_bytes(c->fileFd, buf, n) < 0) {
+            respond(c, 500);
+            *status = CONN_WANT_WRITE;
+            return false;
+        }
+        c->bodyRemaining -= n;
+        c->bytesIn += n;
+    }
+
+    return true;
+}
+
+// Decode a chunked PUT body into the file. The data of each chunk is moved
+// by receiveBody() like a body of that length, so it is spliced whenever
+// the buffer is drained; only the framing between chunks is read here.
+static bool receiveChunks(Conn c, connStatus *status) {
+    while (1) {
+        if (c->bodyRemaining > 0) {
+            bool received = receiveBody(c, status);
+            c->chunks.remaining = c->bodyRemaining;
+            if (!received) {
+                return false;
+            }
+        }
+        if (chunkDone(&c->chunks)) {
+            return true;
+        }
+
+        int available = c->bufLen - c->bufStart;
+        if (available > 0) {
+            int n = chunkFraming(&c->chunks, c->buffer + c->bufStart, available);
+            if (n < 0) {
+                respond(c, 400);
+                *status = CONN_WANT_WRITE;
+                return false;
+            }
+            c->bufStart += n;
+            c->bodyRemaining = c->chunks.remaining;
+            continue;
+        }
+
+        c->bufStart = 0;
+        c->bufLen = 0;
+        ssize_t n = read(c->fd, c->buffer, c->bufSize);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && wouldBlock(c)) {
+            *status = CONN_WANT_READ;
+            return false;
+        }
+        if (n <= 0) {
+            // Body ended before its last chunk
+            respond(c, 400);
+            *status = CONN_WANT_WRITE;
+            return false;
+        }
+        c->bufLen = (int) n;
+        c->bytesIn += n;
+    }
+}
+
+// fsync() the served directory, for a name created or renamed in it
+static int syncDir(void) {
+    int fd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+    int rc = fsync(fd);
+    close(fd);
+    return rc;
+}
+
+// Make what the PUT wrote to fd durable, as far as config.durability asks.
+// dirChanged is set when a name in the directory changed, which syncing
+// the file's data doesn't cover. Returns 1 once durable, -1 if it failed
+// and 0 while a non-blocking connection waits on its group commit.
+static int makeDurable(Conn c, int fd, bool dirChanged) {
+    if (config.durability == DURABLE_SYNC) {
+        if (fdatasync(fd) < 0 || (dirChanged && syncDir() < 0)) {
+            return -1;
+        }
+        return 1;
+    }
+    if (config.durability == DURABLE_GROUP) {
+        // One syncfs() covers the data and the directory alike
+        if (c->commitTicket == 0) {
+            c->commitTicket = groupcommit_request(putCommits);
+        }
+        int state = c->nonBlocking ? groupcommit_poll(putCommits, c->commitTicket, c->wakeFd)
+                                   : groupcommit_wait(putCommits, c->commitTicket);
+        if (state != 0) {
+            c->commitTicket = 0;
+        }
+        return state;
+    }
+    return 1;
+}
+
+// A PUT small enough for the log store. The body is collected in ioBuf
+// before the writer lock is taken, then appended as one record and
+// published by pointing the index at it, so readers see the old version
+// or the new one and never a partial body.
+static connStatus putLogged(Conn c) {
+    char *body = ioBuffer(c);
+    while (c->ioLen < c->contentLen) {
+        int wanted = (int) c->contentLen - c->ioLen;
+        int available = c->bufLen - c->bufStart;
+        if (available > 0) {
+            int n = available < wanted ? available : wanted;
+            memcpy(body + c->ioLen, c->buffer + c->bufStart, n);
+            c->bufStart += n;
+            c->ioLen += n;
+            continue;
+        }
+        ssize_t n = read(c->fd, body + c->ioLen, wanted);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && wouldBlock(c)) {
+            return CONN_WANT_READ;
+        }
+        if (n <= 0) {
+            // Body ended before all of it arrived, or stopped arriving
+            respond(c, n < 0 && timedOut() ? 408 : 400);
+            return CONN_WANT_WRITE;
+        }
+        c->ioLen += (int) n;
+        c->bytesIn += n;
+    }
+
+    if (!c->locked) {
+        c->phase = LOCK;
+        return CONN_WANT_READ;
+    }
+
+    bool dirChanged = false;
+    if (c->putStatus == 0) {
+        if (!putAllowed(c)) {
+            respond(c, 412);
+            return CONN_WANT_WRITE;
+        }
+        struct stat st;
+        bool logged = logstore_stat(logStore, c->uri, &st);
+        bool existed = logged || stat(c->uri, &st) == 0;
+        if (existed && S_ISDIR(st.st_mode)) {
+            respond(c, 500);
+            return CONN_WANT_WRITE;
+        }
+        invalidateURI(c);
+        if (logstore_put(logStore, c->uri, body, c->ioLen, &c->logged) < 0) {
+            respond(c, 500);
+            return CONN_WANT_WRITE;
+        }
+
+        // The record shadows the file the URI had, which only takes space
+        if (existed && !logged) {
+            unlink(c->uri);
+            dirChanged = true;
+        }
+        c->putStatus = existed ? 200 : 201;
+    }
+    int durable = makeDurable(c, c->logged.fd, dirChanged);
+    if (durable == 0) {
+        return CONN_WANT_LOCK;
+    }
+    if (durable < 0) {
+        c->putStatus = 500;
+    }
+    respondPut(c, c->putStatus);
+    unlockURI(c);
+    return CONN_WANT_WRITE;
+}
+
+// PUT method puts content into URI if it exists or not
+static connStatus putMethod(Conn c) {
+    setRecvTimeout(c, config.sendTimeout);
+    if (c->logPut) {
+        return putLogged(c);
+    }
+    if (c->fileFd < 0 && config.atomicPut) {
+        if (!openStage(c)) {
+            respond(c, 500);
+            return CONN_WANT_WRITE;
+        }
+        c->bodyRemaining = c->chunked ? 0 : c->contentLen;
+    } else if (c->fileFd < 0) {
+        // The body is still unread, so a refused PUT closes the connection
+        if (!putAllowed(c)) {
+            c->keepAlive = false;
+            respond(c, 412);
+            return CONN_WANT_WRITE;
+        }
+
+        invalidateURI(c);
+        int logged = unlogURI(c);
+        if (logged < 0) {
+            respond(c, 500);
+            return CONN_WANT_WRITE;
+        }
+        c->wasLogged = logged > 0;
+
+        c->fileFd = open(c->uri, O_WRONLY | O_TRUNC, 0666);
+        if (c->fileFd < 0 && errno == ENOENT) {
+            c->fileFd = open(c->uri, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+            c->isCreated = true;
+        }
+        if (c->fileFd < 0) {
+            respond(c, 500);
+            return CONN_WANT_WRITE;
+        }
+        c->bodyRemaining = c->chunked ? 0 : c->contentLen;
+    }
+
+    connStatus status;
+    if (!(c->chunked ? receiveChunks(c, &status) : receiveBody(c, &status))) {
+        return status;
+    }
+
+    if (c->staged && !c->locked) {
+        // The upload must be durable before a rename can publish it
+        int durable = makeDurable(c, c->fileFd, false);
+        if (durable == 0) {
+            return CONN_WANT_LOCK;
+        }
+        if (durable < 0) {
+            respond(c, 500);
+            return CONN_WANT_WRITE;
+        }
+
+        // Whole body uploaded, take the writer lock just to publish it
+        c->phase = LOCK;
+        return CONN_WANT_READ;
+    }
+
+    if (c->putStatus == 0) {
+        c->putStatus = c->staged ? publishStage(c) : c->isCreated && !c->wasLogged ? 201 : 200;
+    }
+    if (c->putStatus < 300) {
+        // A new name, created or renamed, lives in the directory
+        int durable = makeDurable(c, c->fileFd, c->isCreated || config.atomicPut);
+        if (durable == 0) {
+            return CONN_WANT_LOCK;
+        }
+        if (durable < 0) {
+            c->putStatus = 500;
+        }
+    }
+    respondPut(c, c->putStatus);
+    if (config.atomicPut) {
+        unlockURI(c);
+    }
+    return CONN_WANT_WRITE;
+}
+
+// Release everything the request holds
+static void finish(Conn c) {
+    // An atomic or logged PUT that failed before taking the lock changed
+    // nothing, and a GET that let its lock go early is logged with the
+    // status its response ended with, so both are logged without the lock
+    if (((c->staged || (c->logPut && c->putStatus == 0)) && !c->locked) || c->auditLater) {
+        auditlog_write(auditLog, c->method, c->uri, c->statusCode, c->requestId);
+    }
+    c->logPut = false;
+    c->auditLater = false;
+    if (c->staged) {
+        // An upload that was never published is thrown away
+        unlink(c->stagePath);
+        c->staged = false;
+    }
+    unlockURI(c);
+    if (c->lockWaiting) {
+        // Closed while still waiting for the lock, which may let in
+        // others it held back
+        rwlock_wait_end(uritable_rwlock(c->entry), !c->isGet);
+        c->lockWaiting = false;
+        uritable_wake(uriLocks, c->entry);
+    }
+    if (c->entry != NULL) {
+        uritable_release(uriLocks, c->entry);
+        c->entry = NULL;
+    }
+    if (c->cached != NULL) {
+        cache_release(objectCache, c->cached);
+        c->cached = NULL;
+    }
+    if (c->openFile != NULL) {
+        fdcache_release(fdCache, c->openFile);
+        c->openFile = NULL;
+    } else if (c->logged.segment != NULL) {
+        logstore_release(logStore, &c->logged);
+    } else if (c->fileFd >= 0) {
+        close(c->fileFd);
+    }
+    c->fileFd = -1;
+    if (c->ioBuf != NULL) {
+        bufpool_put(bufPool, c->ioBuf, c->ioSize);
+        c->ioBuf = NULL;
+    }
+    free(c->respAlloc);
+    c->respAlloc = NULL;
+}
+
+// Add the time since the last phase change to the phase just left. The
+// read phase runs from the first byte of the request until it is parsed.
+static void notePhase(Conn c, connPhase left) {
+    static const int timed[] = { [READ_REQUEST] = PHASE_READ, [PARSE] = PHASE_READ,
+        [LOCK] = PHASE_LOCK, [IO] = PHASE_IO, [RESPOND] = PHASE_RESPOND, [FINISH] = -1 };
+    if (c->requestStart == 0 || timed[left] < 0 || (left == READ_REQUEST && c->phase == PARSE)) {
+        return;
+    }
+    long now = metrics_now();
+    c->phaseNs[timed[left]] += now - c->phaseStart;
+    c->phasesSeen |= 1u << timed[left];
+    c->phaseStart = now;
+}
+
+// Count the finished request, unless the connection closed before one
+// began
+static void recordRequest(Conn c) {
+    if (c->requestStart == 0) {
+        return;
+    }
+    for (int i = 0; i < N_PHASES; i++) {
+        if (c->phasesSeen & (1u << i)) {
+            metrics_phase(serverMetrics, i, c->phaseNs[i]);
+        }
+    }
+    metrics_request(serverMetrics, c->method, c->statusCode, c->bytesIn, c->bytesOut,
+        metrics_now() - c->requestStart);
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+// newConn()
+// Creates a connection for the accepted socket fd.
+Conn newConn(int fd, bool nonBlocking, int wakeFd) {
+    Conn c = malloc(sizeof(connObj));
+    assert(c != NULL);
+    c->fd = fd;
+    c->nonBlocking = nonBlocking;
+    c->wakeFd = wakeFd;
+    if (!nonBlocking) {
+        // A client that stops taking a response gets the send timeout,
+        // reads start out under the idle timeout
+        struct timeval send = { .tv_sec = config.sendTimeout, .tv_usec = 0 };
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &send, sizeof(send));
+    }
+    c->recvTimeout = 0;
+    c->nRequests = 0;
+    c->entry = NULL;
+    c->locked = false;
+    c->lockWaiting = false;
+    c->cached = NULL;
+    c->openFile = NULL;
+    c->logged.segment = NULL;
+    c->fileFd = -1;
+    c->respAlloc = NULL;
+    c->buffer = NULL;
+    c->bufSize = 0;
+    c->ioBuf = NULL;
+    c->bufStart = 0;
+    c->bufLen = 0;
+    resetRequest(c);
+    return c;
+}
+
+// freeConn()
+// Releases anything the connection still holds, closes its socket, frees
+// *pC and sets *pC to NULL.
+void freeConn(Conn *pC) {
+    if (pC != NULL && *pC != NULL) {
+        close(releaseConn(pC));
+    }
+}
+
+// releaseConn()
+// Like freeConn(), but returns the socket instead of closing it.
+int releaseConn(Conn *pC) {
+    int fd = (*pC)->fd;
+    finish(*pC);
+    dropBuffer(*pC);
+    free(*pC);
+    *pC = NULL;
+    return fd;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+// connThreadDone()
+// Releases the calling thread's splice pipe, audit ring, metrics shard and
+// cached buffers.
+void connThreadDone(void) {
+    if (bodyPipe[0] >= 0) {
+        closeBodyPipe();
+    }
+    auditlog_thread_done(auditLog);
+    metrics_thread_done(serverMetrics);
+    bufpool_thread_done(bufPool);
+}
+
+// connLockSleepers()
+// Returns how many blocking connections wait on a URI lock.
+int connLockSleepers(void) {
+    return atomic_load(&lockSleepers);
+}
+
+// connAdvance()
+// Runs the connection until it would block or is finished. Every phase
+// either moves the connection to a new phase or reports what it waits on,
+// and a kept-alive connection loops back to read its next request.
+connStatus connAdvance(Conn c) {
+    while (1) {
+        connPhase before = c->phase;
+        connStatus status = CONN_CLOSE;
+        switch (c->phase) {
+        case READ_REQUEST: status = readRequest(c); break;
+        case PARSE: parseRequest(c); break;
+        case LOCK: status = lockURI(c); break;
+        case IO: status = c->isGet ? getMethod(c) : putMethod(c); break;
+        case RESPOND: {
+            int rc = flushResponse(c, 0);
+            if (rc > 0) {
+                status = CONN_WANT_WRITE;
+            } else if (rc < 0) {
+                // The client never got the response it is logged with
+                abortRequest(c, timedOut() ? 408 : 500);
+            } else {
+                c->phase = FINISH;
+            }
+            break;
+        }
+        case FINISH:
+            recordRequest(c);
+            finish(c);
+            c->nRequests += 1;
+            if (!c->keepAlive) {
+                return CONN_CLOSE;
+            }
+            resetRequest(c);
+            break;
+        }
+
+        if (c->phase == before) {
+            return status;
+        }
+        notePhase(c, before);
+    }
+}
+
+// connAwaitingRequest()
+// Whether the connection waits for the head of its next request.
+bool connAwaitingRequest(Conn c) {
+    return c->phase == READ_REQUEST;
+}
+
+// connTimedOut()
+// Aborts the request in progress of a connection closing for a timeout.
+void connTimedOut(Conn c) {
+    if (c->phase != READ_REQUEST) {
+        abortRequest(c, 408);
+        recordRequest(c);
+        c->requestStart = 0;
+    }
+}
+
+// connRecvSpace()
+// Where the next bytes of a request head go, NULL if not waiting on one.
+char *connRecvSpace(Conn c, size_t *len) {
+    int space = c->phase == READ_REQUEST ? headSpace(c) : 0;
+    if (space == 0) {
+        return NULL;
+    }
+    *len = (size_t) space;
+    return c->buffer + c->bufLen;
+}
+
+// connReceived()
+// Adds n bytes received into the space from connRecvSpace() to the request.
+void connReceived(Conn c, size_t n) {
+    c->bufLen += (int) n;
+    c->bytesIn += (long) n;
+}
@@ -0,0 +1,118 @@
+/**
+ * @File connection.h
+ *
+ * Per-connection request state machine. A connection moves through
+ * the read, parse, lock, I/O and respond phases; the blocking workers
+ * drive it to completion in one call while the event loop resumes it
+ * whenever its socket or lock becomes ready.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "uritable.h"
+#include "cache.h"
+#include "fdcache.h"
+#include "auditlog.h"
+#include "metrics.h"
+#include "bufpool.h"
+#include "groupcommit.h"
+#include "logstore.h"
+
+// Exported types -------------------------------------------------------------
+typedef struct connObj *Conn;
+
+// What a connection is waiting on after connAdvance() returns. CONN_WANT_LOCK
+// is a wait on another thread, one holding the per-URI lock or flushing a
+// group commit, with no file descriptor of its own to watch; the caller
+// retries once the connection's wakeFd is written to.
+typedef enum { CONN_WANT_READ, CONN_WANT_WRITE, CONN_WANT_LOCK, CONN_CLOSE } connStatus;
+
+// Per-URI locks shared by every connection for file synchronization
+extern uriTable_t *uriLocks;
+
+// Hot-object cache for GET, NULL when caching is turned off
+extern cache_t *objectCache;
+
+// Open files of GET, NULL when fd caching is turned off
+extern fdCache_t *fdCache;
+
+// Where each finished request is recorded
+extern auditLog_t *auditLog;
+
+// Request counts and timings, served at GET /metrics
+extern metrics_t *serverMetrics;
+
+// Receive and copy buffers of every connection
+extern bufPool_t *bufPool;
+
+// Flushes PUTs to disk in batches, NULL unless durability is DURABLE_GROUP
+extern groupCommit_t *putCommits;
+
+// Segment files small PUT bodies are appended to, NULL when turned off
+extern logStore_t *logStore;
+
+// Constructors-Destructors ---------------------------------------------------
+
+// newConn()
+// Creates a connection for the accepted socket fd. If nonBlocking is true
+// the socket is expected to be O_NONBLOCK and per-URI locks are only tried.
+// wakeFd is the eventfd of the loop serving a non-blocking connection,
+// which is written to when the lock or group commit the connection was
+// parked on may be ready, -1 for blocking connections.
+Conn newConn(int fd, bool nonBlocking, int wakeFd);
+
+// freeConn()
+// Releases anything the connection still holds, closes its socket, frees
+// *pC and sets *pC to NULL.
+void freeConn(Conn *pC);
+
+// releaseConn()
+// Like freeConn(), but hands the socket back instead of closing it, for
+// callers that close it asynchronously.
+int releaseConn(Conn *pC);
+
+// Manipulation procedures ----------------------------------------------------
+
+// connThreadDone()
+// Releases what the calling thread set up to serve connections: its splice
+// pipe, audit log ring, metrics shard and cached buffers. Called by a
+// worker about to exit.
+void connThreadDone(void);
+
+// connLockSleepers()
+// Returns how many blocking connections have their thread asleep on a
+// URI lock, unable to serve anything else until it is released.
+int connLockSleepers(void);
+
+// connAdvance()
+// Runs the connection until it would block or is finished. Kept-alive
+// connections go on to serve pipelined and later requests. A blocking
+// connection only ever returns CONN_CLOSE, after its idle timeout at most
+// between requests and its send timeout within one.
+connStatus connAdvance(Conn c);
+
+// connAwaitingRequest()
+// Whether the connection waits for the head of its next request, as
+// opposed to being in the middle of one. Only the former is held to the
+// idle timeout, the latter gets the longer send timeout.
+bool connAwaitingRequest(Conn c);
+
+// connTimedOut()
+// Aborts the request in progress, if any, of a connection the caller is
+// about to close for a timeout, so it is logged and counted as 408 rather
+// than with the status its unfinished response carries.
+void connTimedOut(Conn c);
+
+// connRecvSpace()
+// For a connection that returned CONN_WANT_READ while waiting on a request
+// head, returns where the next bytes from its socket go and sets *len to
+// the room there, so the caller can receive them itself. Returns NULL if
+// the connection reads its socket by itself, e.g. to splice a PUT body.
+char *connRecvSpace(Conn c, size_t *len);
+
+// connReceived()
+// Adds n bytes received into the space from connRecvSpace() to the
+// request. connAdvance() picks up from there.
+void connReceived(Conn c, size_t n);
@@ -0,0 +1,278 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <assert.h>
+#include <time.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "asgn2_helper_funcs.h"
+#include "config.h"
+#include "connection.h"
+#include "eventloop.h"
+
+#define MAX_EVENTS 64
+
+// Structs --------------------------------------------------------------------
+
+// private activityList type, connections under one timeout kept oldest to
+// newest activity
+typedef struct activityList {
+    struct eventConn *oldest;
+    struct eventConn *newest;
+    long timeoutMs;
+} activityList;
+
+// private eventConn type, a connection as the loop sees it
+typedef struct eventConn {
+    Conn conn;
+    int fd;
+    uint32_t events;
+    bool parked;
+    struct eventConn *nextParked;
+    long lastActive;
+    activityList *list; // NULL while parked
+    struct eventConn *older;
+    struct eventConn *newer;
+} eventConn;
+
+// private eventLoop type. Connections waiting for a request head are held
+// to the idle timeout, those in the middle of a request to the send
+// timeout, and parked ones, waiting on other requests, to neither.
+typedef struct eventLoop {
+    int epfd;
+    int listenFd;
+    int wakeFd; // written to when a parked connection may go on
+    eventConn *parked;
+    activityList idle;
+    activityList busy;
+    long now;
+} eventLoop;
+
+// Helper Functions -----------------------------------------------------------
+
+// Milliseconds on a coarse monotonic clock
+static long nowMs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Remove ec from its activity list, if it is on one
+static void detach(eventConn *ec) {
+    activityList *list = ec->list;
+    if (list == NULL) {
+        return;
+    }
+    if (ec->older != NULL) {
+        ec->older->newer = ec->newer;
+    } else {
+        list->oldest = ec->newer;
+    }
+    if (ec->newer != NULL) {
+        ec->newer->older = ec->older;
+    } else {
+        list->newest = ec->older;
+    }
+    ec->older = NULL;
+    ec->newer = NULL;
+    ec->list = NULL;
+}
+
+// Mark ec as just active, moving it to the newest end of list
+static void touch(eventLoop *loop, eventConn *ec, activityList *list) {
+    if (ec->list != list || list->newest != ec) {
+        detach(ec);
+        ec->older = list->newest;
+        if (list->newest != NULL) {
+            list->newest->newer = ec;
+        } else {
+            list->oldest = ec;
+        }
+        list->newest = ec;
+        ec->list = list;
+    }
+    ec->lastActive = loop->now;
+}
+
+// The list ec's timeout is kept on, by what it waits for
+static activityList *timeoutList(eventLoop *loop, eventConn *ec) {
+    return connAwaitingRequest(ec->conn) ? &loop->idle : &loop->busy;
+}
+
+// Stop watching ec and release it
+static void closeEventConn(eventLoop *loop, eventConn *ec) {
+    detach(ec);
+    epoll_ctl(loop->epfd, EPOLL_CTL_DEL, ec->fd, NULL);
+    freeConn(&ec->conn);
+    free(ec);
+}
+
+// Change the events watched for ec, skipping the syscall if unchanged
+static void watch(eventLoop *loop, eventConn *ec, uint32_t events) {
+    if (ec->events == events) {
+        return;
+    }
+    struct epoll_event ev = { .events = events, .data.ptr = ec };
+    epoll_ctl(loop->epfd, EPOLL_CTL_MOD, ec->fd, &ev);
+    ec->events = events;
+}
+
+// Advance ec and wait on whatever it blocks on next. Connections waiting
+// for a per-URI lock or a group commit are parked and retried once the
+// loop's wakeFd says one of them may go on.
+static void drive(eventLoop *loop, eventConn *ec) {
+    switch (connAdvance(ec->conn)) {
+    case CONN_WANT_READ:
+        watch(loop, ec, EPOLLIN);
+        touch(loop, ec, timeoutList(loop, ec));
+        break;
+    case CONN_WANT_WRITE:
+        watch(loop, ec, EPOLLOUT);
+        touch(loop, ec, timeoutList(loop, ec));
+        break;
+    case CONN_WANT_LOCK:
+        watch(loop, ec, 0);
+        detach(ec);
+        ec->parked = true;
+        ec->nextParked = loop->parked;
+        loop->parked = ec;
+        break;
+    case CONN_CLOSE: closeEventConn(loop, ec); break;
+    }
+}
+
+// Accept every pending connection on the listening socket
+static void acceptAll(eventLoop *loop) {
+    while (1) {
+        int fd = accept4(loop->listenFd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                fprintf(stderr, "Err: %s\n", strerror(errno));
+            }
+            return;
+        }
+
+        eventConn *ec = malloc(sizeof(eventConn));
+        assert(ec != NULL);
+        ec->conn = newConn(fd, true, loop->wakeFd);
+        ec->fd = fd;
+        ec->events = EPOLLIN;
+        ec->parked = false;
+        ec->nextParked = NULL;
+        ec->list = NULL;
+        ec->older = NULL;
+        ec->newer = NULL;
+
+        struct epoll_event ev = { .events = EPOLLIN, .data.ptr = ec };
+        if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            freeConn(&ec->conn);
+            free(ec);
+            continue;
+        }
+        drive(loop, ec);
+    }
+}
+
+// Give every parked connection another try at its lock or group commit
+static void retryParked(eventLoop *loop) {
+    eventConn *ec = loop->parked;
+    loop->parked = NULL;
+    while (ec != NULL) {
+        eventConn *next = ec->nextParked;
+        ec->parked = false;
+        drive(loop, ec);
+        ec = next;
+    }
+}
+
+// Close the connections on list that made no progress for its timeout. A
+// request cut short is aborted first, so it isn't logged as answered.
+static void expire(eventLoop *loop, activityList *list) {
+    while (list->oldest != NULL && loop->now - list->oldest->lastActive >= list->timeoutMs) {
+        eventConn *ec = list->oldest;
+        connTimedOut(ec->conn);
+        closeEventConn(loop, ec);
+    }
+}
+
+// Milliseconds until the oldest connection on list times out, -1 if none
+static long dueIn(eventLoop *loop, activityList *list) {
+    if (list->oldest == NULL) {
+        return -1;
+    }
+    long due = list->oldest->lastActive + list->timeoutMs - loop->now;
+    return due > 0 ? due : 0;
+}
+
+// How long epoll_wait may sleep before a timeout is due
+static int waitTimeout(eventLoop *loop) {
+    long idle = dueIn(loop, &loop->idle);
+    long busy = dueIn(loop, &loop->busy);
+    if (idle < 0 || (busy >= 0 && busy < idle)) {
+        return (int) busy;
+    }
+    return (int) idle;
+}
+
+// event_worker_thread()
+// Runs an epoll loop over the Listener_Socket passed in args.
+void *event_worker_thread(void *args) {
+    Listener_Socket *socket = (Listener_Socket *) args;
+    eventLoop loop = { .epfd = epoll_create1(0),
+        .listenFd = socket->fd,
+        .wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+        .parked = NULL,
+        .idle = { .oldest = NULL, .newest = NULL, .timeoutMs = config.idleTimeout * 1000L },
+        .busy = { .oldest = NULL, .newest = NULL, .timeoutMs = config.sendTimeout * 1000L },
+        .now = nowMs() };
+    if (loop.epfd < 0) {
+        fprintf(stderr, "epoll_create1 error\n");
+        exit(1);
+    }
+    if (loop.wakeFd < 0) {
+        fprintf(stderr, "eventfd error\n");
+        exit(1);
+    }
+
+    // Only one waiting worker is woken per incoming connection
+    struct epoll_event ev = { .events = EPOLLIN | EPOLLEXCLUSIVE, .data.ptr = NULL };
+    struct epoll_event wake = { .events = EPOLLIN, .data.ptr = &loop.wakeFd };
+    if (epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.listenFd, &ev) < 0
+        || epoll_ctl(loop.epfd, EPOLL_CTL_ADD, loop.wakeFd, &wake) < 0) {
+        fprintf(stderr, "epoll_ctl error\n");
+        exit(1);
+    }
+
+    struct epoll_event events[MAX_EVENTS];
+    while (1) {
+        int n = epoll_wait(loop.epfd, events, MAX_EVENTS, waitTimeout(&loop));
+        loop.now = nowMs();
+        bool woken = false;
+        for (int i = 0; i < n; i++) {
+            eventConn *ec = events[i].data.ptr;
+            if (ec == NULL) {
+                acceptAll(&loop);
+            } else if (events[i].data.ptr == &loop.wakeFd) {
+                uint64_t wakes;
+                woken = read(loop.wakeFd, &wakes, sizeof(wakes)) > 0;
+            } else if (!ec->parked) {
+                drive(&loop, ec);
+            }
+        }
+        if (woken) {
+            retryParked(&loop);
+        }
+        expire(&loop, &loop.idle);
+        expire(&loop, &loop.busy);
+    }
+    return args;
+}
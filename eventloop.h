@@ -0,0 +1,13 @@
+/**
+ * @File eventloop.h
+ *
+ * Non-blocking epoll worker. Each event worker accepts from the shared
+ * listening socket and multiplexes all of its connections on one thread.
+ */
+
+#pragma once
+
+// event_worker_thread()
+// Runs an epoll loop over the Listener_Socket passed in args, which must
+// already be O_NONBLOCK. Never returns.
+void *event_worker_thread(void *args);
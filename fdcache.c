@@ -0,0 +1,296 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/stat.h>
+#include "fdcache.h"
+#include "uritable.h"
+
+#define FD_SHARDS     16
+#define SHARD_BUCKETS 256
+
+typedef struct fdEntry {
+    char uri[65];
+    uint32_t hash;
+    int fd; // -1 for a negative entry
+    struct stat st;
+    int refs;
+    bool cached;
+    struct fdEntry *next;
+    struct fdEntry *newer;
+    struct fdEntry *older;
+} fdEntry_t;
+
+// Each shard has its own lock, LRU list and share of the budget
+typedef struct fdShard {
+    _Alignas(64) pthread_mutex_t mutex;
+    fdEntry_t *buckets[SHARD_BUCKETS];
+    fdEntry_t *newest;
+    fdEntry_t *oldest;
+    int entries;
+    long fds;
+    long hits;
+    long negativeHits;
+    long misses;
+    long evictions;
+    long invalidations;
+} fdShard;
+
+typedef struct fdCache {
+    int shardBudget;
+    fdShard *shards;
+} fdCache_t;
+
+static fdShard *shardFor(fdCache_t *c, uint32_t hash) {
+    return &c->shards[hash % FD_SHARDS];
+}
+
+static fdEntry_t **bucketFor(fdShard *s, uint32_t hash) {
+    return &s->buckets[(hash / FD_SHARDS) % SHARD_BUCKETS];
+}
+
+static void freeEntry(fdEntry_t *e) {
+    if (e->fd >= 0) {
+        close(e->fd);
+    }
+    free(e);
+}
+
+// Find uri in its shard, shard is locked
+static fdEntry_t *find(fdShard *s, uint32_t hash, const char *uri) {
+    fdEntry_t *e = *bucketFor(s, hash);
+    while (e != NULL && (e->hash != hash || strcmp(e->uri, uri) != 0)) {
+        e = e->next;
+    }
+    return e;
+}
+
+// Unlink e from the LRU list, shard is locked
+static void lruRemove(fdShard *s, fdEntry_t *e) {
+    if (e->newer != NULL) {
+        e->newer->older = e->older;
+    } else {
+        s->newest = e->older;
+    }
+    if (e->older != NULL) {
+        e->older->newer = e->newer;
+    } else {
+        s->oldest = e->newer;
+    }
+    e->newer = NULL;
+    e->older = NULL;
+}
+
+// Make e the most recently used entry, shard is locked
+static void lruPush(fdShard *s, fdEntry_t *e) {
+    e->older = s->newest;
+    e->newer = NULL;
+    if (s->newest != NULL) {
+        s->newest->newer = e;
+    } else {
+        s->oldest = e;
+    }
+    s->newest = e;
+}
+
+// Take e out of the cache, closing it unless a response still holds it,
+// shard is locked
+static void removeEntry(fdShard *s, fdEntry_t *e) {
+    fdEntry_t **link = bucketFor(s, e->hash);
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    lruRemove(s, e);
+    s->entries -= 1;
+    s->fds -= e->fd >= 0;
+    e->cached = false;
+    if (e->refs == 0) {
+        freeEntry(e);
+    }
+}
+
+static fdEntry_t *newEntry(const char *uri, uint32_t hash, int fd) {
+    fdEntry_t *e = (fdEntry_t *) malloc(sizeof(fdEntry_t));
+    assert(e != NULL);
+    strncpy(e->uri, uri, sizeof(e->uri) - 1);
+    e->uri[sizeof(e->uri) - 1] = '\0';
+    e->hash = hash;
+    e->fd = fd;
+    e->refs = 1;
+    e->cached = false;
+    e->next = NULL;
+    e->newer = NULL;
+    e->older = NULL;
+    return e;
+}
+
+// Add e to its shard, or if another thread added uri first move e's
+// references to that entry instead and free e. Returns the entry in use.
+static fdEntry_t *insert(fdCache_t *c, fdEntry_t *e) {
+    fdShard *s = shardFor(c, e->hash);
+    pthread_mutex_lock(&(s->mutex));
+    fdEntry_t *old = find(s, e->hash, e->uri);
+    if (old != NULL && old->fd < 0 && e->fd >= 0) {
+        // The file appeared without a PUT, the open file is the truth
+        removeEntry(s, old);
+        old = NULL;
+    }
+    if (old != NULL) {
+        old->refs += e->refs;
+        pthread_mutex_unlock(&(s->mutex));
+        freeEntry(e);
+        return old;
+    }
+    while (s->oldest != NULL && s->entries >= c->shardBudget) {
+        removeEntry(s, s->oldest);
+        s->evictions += 1;
+    }
+    fdEntry_t **bucket = bucketFor(s, e->hash);
+    e->next = *bucket;
+    *bucket = e;
+    lruPush(s, e);
+    e->cached = true;
+    s->entries += 1;
+    s->fds += e->fd >= 0;
+    pthread_mutex_unlock(&(s->mutex));
+    return e;
+}
+
+//  Dynamically allocates and initializes a new fd cache.
+fdCache_t *fdcache_new(int maxEntries) {
+    fdCache_t *c = (fdCache_t *) calloc(1, sizeof(fdCache_t));
+    assert(c != NULL);
+    c->shardBudget = maxEntries / FD_SHARDS > 0 ? maxEntries / FD_SHARDS : 1;
+    c->shards = (fdShard *) aligned_alloc(64, FD_SHARDS * sizeof(fdShard));
+    assert(c->shards != NULL);
+    memset(c->shards, 0, FD_SHARDS * sizeof(fdShard));
+    for (int i = 0; i < FD_SHARDS; i++) {
+        int rc = pthread_mutex_init(&(c->shards[i].mutex), NULL);
+        assert(!rc);
+    }
+    return c;
+}
+
+//  Delete the cache, closing its files and freeing all of its memory.
+void fdcache_delete(fdCache_t **c) {
+    if (*c != NULL) {
+        for (int i = 0; i < FD_SHARDS; i++) {
+            fdShard *s = &(*c)->shards[i];
+            while (s->oldest != NULL) {
+                removeEntry(s, s->oldest);
+            }
+            pthread_mutex_destroy(&(s->mutex));
+        }
+        free((*c)->shards);
+        free(*c);
+    }
+    *c = NULL;
+}
+
+//  Open uri, or find it already open, and take a reference on its entry.
+fdEntry_t *fdcache_open(fdCache_t *c, const char *uri, int *err) {
+    uint32_t hash = uritable_hash(uri);
+    fdShard *s = shardFor(c, hash);
+
+    pthread_mutex_lock(&(s->mutex));
+    fdEntry_t *e = find(s, hash, uri);
+    if (e != NULL && e->fd < 0) {
+        s->negativeHits += 1;
+        pthread_mutex_unlock(&(s->mutex));
+        *err = ENOENT;
+        return NULL;
+    }
+    if (e != NULL) {
+        e->refs += 1;
+        lruRemove(s, e);
+        lruPush(s, e);
+        s->hits += 1;
+    } else {
+        s->misses += 1;
+    }
+    pthread_mutex_unlock(&(s->mutex));
+    if (e != NULL) {
+        return e;
+    }
+
+    // O_NONBLOCK keeps a FIFO without a writer from blocking the open
+    int fd = open(uri, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        *err = errno;
+        if (errno == ENOENT) {
+            fdEntry_t *negative = newEntry(uri, hash, -1);
+            negative->refs = 0;
+            insert(c, negative);
+        }
+        return NULL;
+    }
+
+    e = newEntry(uri, hash, fd);
+    if (fstat(fd, &e->st) < 0) {
+        *err = errno;
+        freeEntry(e);
+        return NULL;
+    }
+    if (!S_ISREG(e->st.st_mode)) {
+        return e;
+    }
+    return insert(c, e);
+}
+
+//  Drop a reference taken by fdcache_open.
+void fdcache_release(fdCache_t *c, fdEntry_t *e) {
+    fdShard *s = shardFor(c, e->hash);
+    pthread_mutex_lock(&(s->mutex));
+    e->refs -= 1;
+    bool orphan = e->refs == 0 && !e->cached;
+    pthread_mutex_unlock(&(s->mutex));
+    if (orphan) {
+        freeEntry(e);
+    }
+}
+
+//  Remove uri's entry, if any, so the next GET opens the file again.
+void fdcache_invalidate(fdCache_t *c, const char *uri) {
+    uint32_t hash = uritable_hash(uri);
+    fdShard *s = shardFor(c, hash);
+    pthread_mutex_lock(&(s->mutex));
+    fdEntry_t *e = find(s, hash, uri);
+    if (e != NULL) {
+        removeEntry(s, e);
+        s->invalidations += 1;
+    }
+    pthread_mutex_unlock(&(s->mutex));
+}
+
+//  The entry's file descriptor.
+int fdcache_fd(fdEntry_t *e) {
+    return e->fd;
+}
+
+//  The file's metadata when it was opened.
+const struct stat *fdcache_stat(fdEntry_t *e) {
+    return &e->st;
+}
+
+//  Fill *stats with the cache's counters.
+void fdcache_stats(fdCache_t *c, fdCacheStats *stats) {
+    memset(stats, 0, sizeof(fdCacheStats));
+    for (int i = 0; i < FD_SHARDS; i++) {
+        fdShard *s = &c->shards[i];
+        pthread_mutex_lock(&(s->mutex));
+        stats->hits += s->hits;
+        stats->negativeHits += s->negativeHits;
+        stats->misses += s->misses;
+        stats->evictions += s->evictions;
+        stats->invalidations += s->invalidations;
+        stats->fds += s->fds;
+        stats->negatives += s->entries - s->fds;
+        pthread_mutex_unlock(&(s->mutex));
+    }
+}
@@ -0,0 +1,90 @@
+/**
+ * @File fdcache.h
+ *
+ * Cache of open file descriptors for GET, with each file's fstat()
+ * metadata and negative entries for files that don't exist, so a hot
+ * URI is served without a path lookup, an open or a stat. Entries are
+ * reference counted, an fd evicted or invalidated while a response still
+ * sends from it is closed once that response lets go of it.
+ */
+
+#pragma once
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** @struct fdCache_t
+ *
+ *  @brief A sharded cache of open files, evicting the least recently used
+ *  entries of a shard when it holds more than its share of the budget.
+ */
+typedef struct fdCache fdCache_t;
+
+/** @struct fdEntry_t
+ *
+ *  @brief An open file and its metadata at the time it was opened.
+ */
+typedef struct fdEntry fdEntry_t;
+
+/** @struct fdCacheStats
+ *
+ *  @brief Counters summed over every shard.
+ */
+typedef struct fdCacheStats {
+    long hits;
+    long negativeHits;
+    long misses;
+    long evictions;
+    long invalidations;
+    long fds;
+    long negatives;
+} fdCacheStats;
+
+/** @brief Dynamically allocates and initializes a new fd cache.
+ *
+ *  @param maxEntries the most entries held at once, open files and
+ *  negative entries together
+ *
+ *  @return a pointer to a new fdCache_t
+ */
+fdCache_t *fdcache_new(int maxEntries);
+
+/** @brief Delete the cache, closing its files and freeing all of its
+ *  memory, sets *c = NULL. Entries still referenced must be released
+ *  before this is called.
+ */
+void fdcache_delete(fdCache_t **c);
+
+/** @brief Open uri read-only, or find it already open, and take a
+ *  reference on its entry. Only regular files and missing ones are kept
+ *  in the cache, anything else is opened just for the caller. The caller
+ *  must hold the URI's lock, so no writer changes the file meanwhile.
+ *
+ *  @param err set to the errno of the failed open when NULL is returned,
+ *  ENOENT for a negative entry
+ *
+ *  @return the entry, or NULL if uri can't be opened
+ */
+fdEntry_t *fdcache_open(fdCache_t *c, const char *uri, int *err);
+
+/** @brief Drop a reference taken by fdcache_open.
+ */
+void fdcache_release(fdCache_t *c, fdEntry_t *e);
+
+/** @brief Remove uri's entry, if any, so the next GET opens the file
+ *  again. Called by writers while they hold the URI's writer lock.
+ */
+void fdcache_invalidate(fdCache_t *c, const char *uri);
+
+/** @brief The entry's file descriptor. Callers share it, so it must only
+ *  be read at explicit offsets (pread, sendfile with an offset).
+ */
+int fdcache_fd(fdEntry_t *e);
+
+/** @brief The file's metadata at the time it was opened.
+ */
+const struct stat *fdcache_stat(fdEntry_t *e);
+
+/** @brief Fill *stats with the cache's counters.
+ */
+void fdcache_stats(fdCache_t *c, fdCacheStats *stats);
@@ -0,0 +1,230 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <assert.h>
+#include "groupcommit.h"
+#include "wakelist.h"
+
+// Tickets from through to, all covered by one flush that failed
+typedef struct failedBatch {
+    long from;
+    long to;
+} failedBatch;
+
+typedef struct groupCommit {
+    int fd;
+    int windowUs;
+
+    // Tickets are numbered from 1. Every ticket up to committed has been
+    // flushed, those in one of the failed batches by a flush that failed.
+    // Batches are appended in ticket order, under the mutex.
+    pthread_mutex_t mutex;
+    pthread_cond_t requested; // a ticket was taken, for the committer
+    pthread_cond_t flushed;   // committed moved, for blocked waiters
+    wakeList parked;          // committed moved, for event loops
+    long nextTicket;
+    _Atomic long committed;
+    failedBatch *failed;
+    int failedSize;
+    bool stop;
+
+    long flushes;
+    _Atomic long failures; // also the number of failed batches
+    long maxBatch;
+    pthread_t committer;
+} groupCommit_t;
+
+// Helper Functions -----------------------------------------------------------
+
+// Whether ticket is in a failed batch, searched in halves. The mutex is
+// held.
+static bool ticketFailed(groupCommit_t *g, long ticket) {
+    long lo = 0;
+    long hi = atomic_load(&g->failures);
+    while (lo < hi) {
+        long mid = (lo + hi) / 2;
+        if (g->failed[mid].to < ticket) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo < atomic_load(&g->failures) && g->failed[lo].from <= ticket;
+}
+
+// A failed batch is recorded before committed moves past it, so as long
+// as no flush ever failed a flushed ticket is known good without the
+// mutex. locked says the caller holds it already.
+static int ticketState(groupCommit_t *g, long ticket, bool locked) {
+    if (atomic_load(&g->committed) < ticket) {
+        return 0;
+    }
+    if (atomic_load(&g->failures) == 0) {
+        return 1;
+    }
+    if (!locked) {
+        pthread_mutex_lock(&g->mutex);
+    }
+    bool failed = ticketFailed(g, ticket);
+    if (!locked) {
+        pthread_mutex_unlock(&g->mutex);
+    }
+    return failed ? -1 : 1;
+}
+
+// Remember a flush of tickets from through to that failed, the mutex is
+// held
+static void recordFailure(groupCommit_t *g, long from, long to) {
+    long n = atomic_load(&g->failures);
+    if (n == g->failedSize) {
+        g->failedSize = g->failedSize == 0 ? 8 : g->failedSize * 2;
+        g->failed = (failedBatch *) realloc(g->failed, g->failedSize * sizeof(failedBatch));
+        assert(g->failed != NULL);
+    }
+    g->failed[n].from = from;
+    g->failed[n].to = to;
+    atomic_store(&g->failures, n + 1);
+}
+
+// Flush whenever tickets are waiting. Tickets taken while a flush runs
+// go into the next one, so the busier the writers the bigger the batches.
+static void *committer_thread(void *args) {
+    groupCommit_t *g = (groupCommit_t *) args;
+    struct timespec window = { .tv_sec = 0, .tv_nsec = g->windowUs * 1000L };
+
+    pthread_mutex_lock(&g->mutex);
+    while (1) {
+        while (!g->stop && g->nextTicket - 1 == atomic_load(&g->committed)) {
+            pthread_cond_wait(&g->requested, &g->mutex);
+        }
+        if (g->stop && g->nextTicket - 1 == atomic_load(&g->committed)) {
+            break;
+        }
+        pthread_mutex_unlock(&g->mutex);
+
+        if (g->windowUs > 0) {
+            nanosleep(&window, NULL);
+        }
+
+        pthread_mutex_lock(&g->mutex);
+        long from = atomic_load(&g->committed) + 1;
+        long to = g->nextTicket - 1;
+        pthread_mutex_unlock(&g->mutex);
+
+        int rc = syncfs(g->fd);
+
+        pthread_mutex_lock(&g->mutex);
+        if (rc < 0) {
+            recordFailure(g, from, to);
+        }
+        atomic_store(&g->committed, to);
+        g->flushes += 1;
+        if (to - from + 1 > g->maxBatch) {
+            g->maxBatch = to - from + 1;
+        }
+        pthread_cond_broadcast(&g->flushed);
+        wakelist_wake(&g->parked);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    return args;
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+groupCommit_t *groupcommit_new(int fd, int windowUs) {
+    groupCommit_t *g = malloc(sizeof(groupCommit_t));
+    assert(g != NULL);
+    g->fd = fd;
+    g->windowUs = windowUs;
+    g->nextTicket = 1;
+    atomic_init(&g->committed, 0);
+    g->failed = NULL;
+    g->failedSize = 0;
+    g->stop = false;
+    g->flushes = 0;
+    atomic_init(&g->failures, 0);
+    g->maxBatch = 0;
+    wakelist_init(&g->parked);
+
+    int rc;
+    rc = pthread_mutex_init(&g->mutex, NULL);
+    assert(!rc);
+    rc = pthread_cond_init(&g->requested, NULL);
+    assert(!rc);
+    rc = pthread_cond_init(&g->flushed, NULL);
+    assert(!rc);
+    rc = pthread_create(&g->committer, NULL, committer_thread, g);
+    assert(!rc);
+    return g;
+}
+
+void groupcommit_delete(groupCommit_t **g) {
+    if (*g == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&(*g)->mutex);
+    (*g)->stop = true;
+    pthread_cond_signal(&(*g)->requested);
+    pthread_mutex_unlock(&(*g)->mutex);
+    pthread_join((*g)->committer, NULL);
+
+    pthread_mutex_destroy(&(*g)->mutex);
+    pthread_cond_destroy(&(*g)->requested);
+    pthread_cond_destroy(&(*g)->flushed);
+    wakelist_free(&(*g)->parked);
+    free((*g)->failed);
+    free(*g);
+    *g = NULL;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+long groupcommit_request(groupCommit_t *g) {
+    pthread_mutex_lock(&g->mutex);
+    long ticket = g->nextTicket++;
+    pthread_cond_signal(&g->requested);
+    pthread_mutex_unlock(&g->mutex);
+    return ticket;
+}
+
+// Parking rechecks under the mutex the committer moves committed under,
+// so a flush finishing in between can't be missed
+int groupcommit_poll(groupCommit_t *g, long ticket, int wakeFd) {
+    int state = ticketState(g, ticket, false);
+    if (state != 0 || wakeFd < 0) {
+        return state;
+    }
+    pthread_mutex_lock(&g->mutex);
+    state = ticketState(g, ticket, true);
+    if (state == 0) {
+        wakelist_add(&g->parked, wakeFd);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    return state;
+}
+
+int groupcommit_wait(groupCommit_t *g, long ticket) {
+    int state = ticketState(g, ticket, false);
+    if (state != 0) {
+        return state;
+    }
+    pthread_mutex_lock(&g->mutex);
+    while ((state = ticketState(g, ticket, true)) == 0) {
+        pthread_cond_wait(&g->flushed, &g->mutex);
+    }
+    pthread_mutex_unlock(&g->mutex);
+    return state;
+}
+
+void groupcommit_stats(groupCommit_t *g, groupCommitStats *stats) {
+    pthread_mutex_lock(&g->mutex);
+    stats->tickets = g->nextTicket - 1;
+    stats->flushes = g->flushes;
+    stats->failures = g->failures;
+    stats->maxBatch = g->maxBatch;
+    pthread_mutex_unlock(&g->mutex);
+}
@@ -0,0 +1,73 @@
+/**
+ * @File groupcommit.h
+ *
+ * Group commit for PUTs. Writers that need their data on disk take a
+ * ticket, and a committer thread makes every ticket taken so far durable
+ * with one syncfs() of the served filesystem, so PUTs finishing close
+ * together share a single flush instead of paying for one each.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+
+/** @struct groupCommit_t
+ *
+ *  @brief The committer thread and the tickets waiting on it.
+ */
+typedef struct groupCommit groupCommit_t;
+
+/** @struct groupCommitStats
+ *
+ *  @brief Counters of the commits made so far.
+ */
+typedef struct groupCommitStats {
+    long tickets;
+    long flushes;
+    long failures;
+    long maxBatch;
+} groupCommitStats;
+
+/** @brief Dynamically allocates a new group commit and starts its
+ *  committer thread.
+ *
+ *  @param fd any file descriptor on the filesystem to flush, e.g. of the
+ *  served directory. It must stay open while the group commit is in use.
+ *
+ *  @param windowUs how long the committer waits after the first ticket of
+ *  a batch for more to join it, 0 to flush right away
+ *
+ *  @return a pointer to a new groupCommit_t
+ */
+groupCommit_t *groupcommit_new(int fd, int windowUs);
+
+/** @brief Stop the committer after its last flush, free the group commit
+ *  and set *g = NULL.
+ */
+void groupcommit_delete(groupCommit_t **g);
+
+/** @brief Ask for everything written to the filesystem so far to be made
+ *  durable.
+ *
+ *  @return the ticket to wait for
+ */
+long groupcommit_request(groupCommit_t *g);
+
+/** @brief Check on a ticket without waiting.
+ *
+ *  @param wakeFd an event loop's eventfd, written to once the flush the
+ *  ticket is pending on finished, -1 for none
+ *
+ *  @return 1 once its flush succeeded, -1 if it failed, 0 while pending
+ */
+int groupcommit_poll(groupCommit_t *g, long ticket, int wakeFd);
+
+/** @brief Wait for a ticket's flush.
+ *
+ *  @return 1 if the flush succeeded, -1 if it failed
+ */
+int groupcommit_wait(groupCommit_t *g, long ticket);
+
+/** @brief Fill *stats with the group commit's counters.
+ */
+void groupcommit_stats(groupCommit_t *g, groupCommitStats *stats);
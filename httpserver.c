@@ -3,30 +3,99 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
-#include <regex.h>
 #include <errno.h>
-#include <sys/stat.h>
+#include <stdbool.h>
+#include <stdatomic.h>
 #include <pthread.h>
-#include <semaphore.h>
+#include <signal.h>
+#include <sys/socket.h>
 #include "queue.h"
-#include "rwlock.h"
 #include "asgn2_helper_funcs.h"
-#include "List.h"
-
-#define ARRAY_SIZE(arr) (sizeof((arr))) / sizeof((arr)[0])
-#define BAD_REQUEST     "HTTP/1.1 400 Bad Request\r\nContent-Length: 12\r\n\r\nBad Request\n";
-#define NOT_IMPLEMENTED                                                                            \
-    "HTTP/1.1 501 Not Implemented\r\nContent-Length: 16\r\n\r\nNot Implemented\n";
-#define UNSUPPORTED_VERSION                                                                        \
-    "HTTP/1.1 505 Version Not Supported\r\nContent-Length: 22\r\n\r\nVersion Not Supported\n";
-#define NOT_FOUND "HTTP/1.1 404 Not Found\r\nContent-Length: 10\r\n\r\nNot Found\n";
-#define FORBIDDEN "HTTP/1.1 403 Forbidden\r\nContent-Length: 10\r\n\r\nForbidden\n";
-#define INTERNAL_SERVER_ERROR                                                                      \
-    "HTTP/1.1 500 Internal Server Error\r\nContent-Length: 22\r\n\r\nInternal Server Error\n";
+#include "uritable.h"
+#include "cache.h"
+#include "fdcache.h"
+#include "config.h"
+#include "connection.h"
+#include "eventloop.h"
+#include "uring.h"
+#include "uringloop.h"
+#include "listensock.h"
+#include "auditlog.h"
+#include "metrics.h"
+#include "bufpool.h"
+#include "groupcommit.h"
+#include "logstore.h"
+
+#define URI_SHARDS       64
+#define CACHE_MAX_OBJECT (1 << 20)
+#define LOG_MAX_OBJECT_KB 64 // a logged body is collected in one 64 KB copy buffer
+#define BUF_CACHE_BYTES  (1 << 20) // free connection buffers each thread keeps
+#define TOP_CONTENDED    10
+#define AUTO_MAX_THREADS  64  // pool ceiling for -t auto
+#define POOL_TICK_MS      10  // how often the pool checks its queue and idle workers
+#define POOL_IDLE_TICKS   200 // samples a worker must stay spare to retire
+#define POOL_GROW_WAIT_MS 5   // queue wait that grows the pool when -w sets no target
+#define SHED_INTERVAL_MS  100 // how long waits must stay past the target to shed
 
 // Global variables
 queue_t *q;
-List listURI;
+uriTable_t *uriLocks;
+cache_t *objectCache;
+fdCache_t *fdCache;
+auditLog_t *auditLog;
+metrics_t *serverMetrics;
+bufPool_t *bufPool;
+groupCommit_t *putCommits;
+logStore_t *logStore;
+serverConfig config = {
+    .nThreads = 4,
+    .maxThreads = 0,
+    .queueSize = 0,
+    .maxQueued = 0,
+    .queueTargetMs = 0,
+    .eventMode = false,
+    .uringMode = false,
+    .lockFreeQueue = false,
+    .reusePort = false,
+    .idleTimeout = 5,
+    .sendTimeout = 60,
+    .maxRequests = 100,
+    .cacheMB = 0,
+    .maxHeadKB = 64,
+    .cachedFds = 0,
+    .atomicPut = false,
+    .logObjectKB = 0,
+    .durability = DURABLE_NONE,
+    .commitWindowUs = 200,
+    .auditPath = NULL,
+    .dropAuditRecords = false,
+    .futexLocks = false,
+    .lockStats = false
+};
+
+// Worker pool of the dispatcher mode. live counts the workers that haven't
+// been told to retire, idle those waiting on the queue for a connection,
+// queued the connections in the queue not yet taken by one and retiring
+// the NULLs in the queue that tell a worker to exit, which take up slots
+// just the same.
+static _Atomic int liveWorkers;
+static _Atomic int idleWorkers;
+static _Atomic int queuedConns;
+static _Atomic int retiringWorkers;
+
+// When queue waits went past the target, 0 while connections are taken in
+// time, and a time since which the connection at the queue's head has
+// waited at least
+static _Atomic long lateSince;
+static _Atomic long headSince;
+
+// Sent as is to connections turned away, nothing about them is parsed
+static const char overloadedResponse[] = "HTTP/1.1 503 Service Unavailable\r\n"
+                                         "Content-Length: 20\r\n"
+                                         "Retry-After: 1\r\n"
+                                         "Connection: close\r\n"
+                                         "\r\n"
+                                         "Service Unavailable\n";
 
 // Send error message
 void errorMessage(const char *msg) {
@@ -35,11 +104,120 @@ void errorMessage(const char *msg) {
 }
 
 // Process the arguments given
-void processArgs(int argc, char *argv[], int *port, int *nThreads) {
+void processArgs(int argc, char *argv[], int *port) {
     int opt = 0;
-    opt = getopt(argc, argv, "t:");
-    if (opt == 't') {
-        *nThreads = atoi(optarg);
+    while ((opt = getopt(argc, argv, "t:b:a:w:euqri:k:m:c:h:o:vg:y:l:dfs")) != -1) {
+        if (opt == 't') {
+            // A fixed count, a min-max range, or auto for one per CPU up
+            // to AUTO_MAX_THREADS
+            if (strcmp(optarg, "auto") == 0) {
+                long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+                config.nThreads = cpus > 2 ? (int) cpus : 2;
+                config.maxThreads = AUTO_MAX_THREADS;
+            } else if (sscanf(optarg, "%d-%d", &config.nThreads, &config.maxThreads) != 2) {
+                config.nThreads = atoi(optarg);
+                config.maxThreads = 0;
+            }
+        } else if (opt == 'b') {
+            config.queueSize = atoi(optarg);
+        } else if (opt == 'a') {
+            config.maxQueued = atoi(optarg);
+        } else if (opt == 'w') {
+            config.queueTargetMs = atoi(optarg);
+        } else if (opt == 'e') {
+            config.eventMode = true;
+        } else if (opt == 'u') {
+            config.eventMode = true;
+            config.uringMode = true;
+        } else if (opt == 'q') {
+            config.lockFreeQueue = true;
+        } else if (opt == 'r') {
+            config.reusePort = true;
+        } else if (opt == 'i') {
+            config.idleTimeout = atoi(optarg);
+        } else if (opt == 'k') {
+            config.sendTimeout = atoi(optarg);
+        } else if (opt == 'm') {
+            config.maxRequests = atoi(optarg);
+        } else if (opt == 'c') {
+            config.cacheMB = atoi(optarg);
+        } else if (opt == 'h') {
+            config.maxHeadKB = atoi(optarg);
+        } else if (opt == 'o') {
+            config.cachedFds = atoi(optarg);
+        } else if (opt == 'v') {
+            config.atomicPut = true;
+        } else if (opt == 'g') {
+            config.logObjectKB = atoi(optarg);
+        } else if (opt == 'y') {
+            // none, sync, or group with an optional window as group:usecs
+            if (strcmp(optarg, "none") == 0) {
+                config.durability = DURABLE_NONE;
+            } else if (strcmp(optarg, "sync") == 0) {
+                config.durability = DURABLE_SYNC;
+            } else if (strcmp(optarg, "group") == 0
+                       || sscanf(optarg, "group:%d", &config.commitWindowUs) == 1) {
+                config.durability = DURABLE_GROUP;
+            } else {
+                errorMessage("Invalid durability level\n");
+            }
+        } else if (opt == 'l') {
+            config.auditPath = optarg;
+        } else if (opt == 'd') {
+            config.dropAuditRecords = true;
+        } else if (opt == 'f') {
+            config.futexLocks = true;
+        } else if (opt == 's') {
+            config.lockStats = true;
+        }
+    }
+
+    if (config.nThreads < 1) {
+        errorMessage("Invalid thread count\n");
+    }
+    if (config.maxThreads < config.nThreads) {
+        config.maxThreads = config.nThreads;
+    }
+    if (config.queueSize == 0) {
+        config.queueSize = config.maxThreads;
+    }
+    if (config.queueSize < 1) {
+        errorMessage("Invalid queue size\n");
+    }
+    if (config.maxQueued < 0 || config.queueTargetMs < 0) {
+        errorMessage("Invalid admission limit\n");
+    }
+    if (config.maxQueued > config.queueSize) {
+        config.queueSize = config.maxQueued;
+    }
+    if (config.idleTimeout < 1) {
+        errorMessage("Invalid idle timeout\n");
+    }
+    if (config.sendTimeout < 1) {
+        errorMessage("Invalid send timeout\n");
+    }
+    if (config.maxRequests < 1) {
+        errorMessage("Invalid max requests\n");
+    }
+    if (config.cacheMB < 0) {
+        errorMessage("Invalid cache size\n");
+    }
+    if (config.commitWindowUs < 0 || config.commitWindowUs > 1000000) {
+        errorMessage("Invalid group commit window\n");
+    }
+    if (config.cachedFds < 0) {
+        errorMessage("Invalid fd cache size\n");
+    }
+    if (config.logObjectKB < 0 || config.logObjectKB > LOG_MAX_OBJECT_KB) {
+        errorMessage("Invalid log store object size\n");
+    }
+    if (config.maxHeadKB < 1 || config.maxHeadKB > (1 << 20)) {
+        errorMessage("Invalid request head size\n");
+    }
+    if (config.uringMode && !uring_supported()) {
+        // Kernel too old, or io_uring turned off for this process
+        fprintf(stderr, "io_uring unavailable, using epoll\n");
+        config.uringMode = false;
     }
 
     if (argv[optind] == NULL) {
@@ -52,381 +230,411 @@ void processArgs(int argc, char *argv[], int *port, int *nThreads) {
     }
 }
 
-// Get the substring from index start to len in str[], place in sub[]
-void subStr(int start, int len, char str[], char sub[]) {
-    for (int i = 0; i < len; i++) {
-        sub[i] = str[start + i];
+// Print the URIs whose locks were waited on longest, times in milliseconds
+static void printLockStats(void) {
+    uriLockStats top[TOP_CONTENDED];
+    int n = uritable_contended(uriLocks, top, TOP_CONTENDED);
+    printf("locks: %d contended URIs\n", n);
+    for (int i = 0; i < n; i++) {
+        rwlockStats *l = &top[i].lock;
+        printf("  /%s reads %ld contended %ld wait %.3f max %.3f held %.3f max %.3f | "
+               "writes %ld contended %ld wait %.3f max %.3f held %.3f max %.3f\n",
+            top[i].uri, l->acquired[0], l->contended[0], l->waitNs[0] / 1e6,
+            l->maxWaitNs[0] / 1e6, l->heldNs[0] / 1e6, l->maxHeldNs[0] / 1e6, l->acquired[1],
+            l->contended[1], l->waitNs[1] / 1e6, l->maxWaitNs[1] / 1e6, l->heldNs[1] / 1e6,
+            l->maxHeldNs[1] / 1e6);
     }
-    sub[len] = '\0';
-    return;
 }
 
-// write response with bad status code and stop client socket
-void reset(char full[], char *res, regex_t regx, int socket) {
-    sprintf(full, "%s", res);
-    write_n_bytes(socket, full, strlen(full));
-    regfree(&regx);
-    close(socket);
-    return;
+// Print server statistics to stdout every time SIGUSR1 arrives, and
+// write out the audit log before exiting on SIGINT or SIGTERM
+void *report_thread(void *args) {
+    sigset_t *signals = (sigset_t *) args;
+    int sig;
+    while (sigwait(signals, &sig) == 0) {
+        if (sig != SIGUSR1) {
+            auditlog_flush(auditLog);
+            exit(0);
+        }
+        if (objectCache != NULL) {
+            cacheStats stats;
+            cache_stats(objectCache, &stats);
+            long lookups = stats.hits + stats.misses;
+            printf("cache: hits %ld misses %ld hit-rate %.1f%% objects %ld bytes %ld "
+                   "insertions %ld evictions %ld invalidations %ld\n",
+                stats.hits, stats.misses, lookups > 0 ? 100.0 * stats.hits / lookups : 0.0,
+                stats.objects, stats.bytes, stats.insertions, stats.evictions,
+                stats.invalidations);
+        }
+        if (fdCache != NULL) {
+            fdCacheStats fds;
+            fdcache_stats(fdCache, &fds);
+            long lookups = fds.hits + fds.negativeHits + fds.misses;
+            printf("fd cache: hits %ld negative-hits %ld misses %ld hit-rate %.1f%% fds %ld "
+                   "negatives %ld evictions %ld invalidations %ld\n",
+                fds.hits, fds.negativeHits, fds.misses,
+                lookups > 0 ? 100.0 * (fds.hits + fds.negativeHits) / lookups : 0.0, fds.fds,
+                fds.negatives, fds.evictions, fds.invalidations);
+        }
+        if (logStore != NULL) {
+            logStoreStats log;
+            logstore_stats(logStore, &log);
+            printf("log store: objects %ld segments %ld bytes %ld live %ld appends %ld "
+                   "tombstones %ld compactions %ld moved %ld\n",
+                log.objects, log.segments, log.bytes, log.liveBytes, log.appends, log.tombstones,
+                log.compactions, log.moved);
+        }
+        if (putCommits != NULL) {
+            groupCommitStats commits;
+            groupcommit_stats(putCommits, &commits);
+            printf("group commit: puts %ld flushes %ld puts/flush %.1f max batch %ld failures %ld\n",
+                commits.tickets, commits.flushes,
+                commits.flushes > 0 ? (double) commits.tickets / commits.flushes : 0.0,
+                commits.maxBatch, commits.failures);
+        }
+        bufPoolStats buffers;
+        bufpool_stats(bufPool, &buffers);
+        printf("buffers: in use %ld cached %ld high water %ld gets %ld reused %ld\n",
+            buffers.bytesInUse, buffers.bytesCached, buffers.highWaterBytes, buffers.gets,
+            buffers.reused);
+        auditStats audit;
+        auditlog_stats(auditLog, &audit);
+        printf("audit log: written %ld dropped %ld blocked %ld\n", audit.written, audit.dropped,
+            audit.blocked);
+        if (config.lockStats) {
+            printLockStats();
+        }
+        if (!config.eventMode && !config.reusePort) {
+            printf("workers: live %d idle %d\n", atomic_load(&liveWorkers),
+                atomic_load(&idleWorkers));
+        }
+        fflush(stdout);
+    }
+    return args;
 }
 
-// Get different header fields
-void headerFields(char headerFields[], int *reqID, int *contentLen) {
-    char *reHeader = "([a-zA-Z0-9.-]{1,128}): ([a-zA-Z0-9.-]{1,128})\r\n";
-    regex_t regexH;
-    regmatch_t pmatchH[3];
-    regoff_t off, len;
-
-    char match[500];
-    char key[129];
-    char value[129];
-    char *headerP = headerFields;
+// An accepted connection waiting in the queue for a worker
+typedef struct queuedConn {
+    int fd;
+    long enqueued;
+} queuedConn;
+
+void *worker_thread(void *args);
+
+// Start one more worker if the pool is below its ceiling
+static void growPool(void) {
+    int live = atomic_load(&liveWorkers);
+    while (live < config.maxThreads) {
+        if (atomic_compare_exchange_weak(&liveWorkers, &live, live + 1)) {
+            pthread_t thread;
+            pthread_attr_t attr;
+            pthread_attr_init(&attr);
+            pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+            if (pthread_create(&thread, &attr, worker_thread, NULL) != 0) {
+                atomic_fetch_sub(&liveWorkers, 1);
+            }
+            pthread_attr_destroy(&attr);
+            return;
+        }
+    }
+}
 
-    if (strlen(headerFields) == 0) {
-        // No Header fields
+// Start another worker when connections wait on workers that can't take
+// them: the one at the queue's head waited past the -w target, or
+// POOL_GROW_WAIT_MS without one, or workers sleep on URI locks while more
+// connections are queued than there are workers idle. A burst the idle
+// workers drain in time grows nothing.
+static void growIfStalled(long now) {
+    int queued = atomic_load(&queuedConns);
+    if (queued == 0) {
         return;
     }
-
-    if (regcomp(&regexH, reHeader, REG_NEWLINE | REG_EXTENDED)) {
-        errorMessage("RegexH failed to compile\n");
+    long target = (config.queueTargetMs > 0 ? config.queueTargetMs : POOL_GROW_WAIT_MS) * 1000000L;
+    if (now - atomic_load(&headSince) >= target
+        || (connLockSleepers() > 0 && queued > atomic_load(&idleWorkers))) {
+        growPool();
     }
+}
 
+// Every POOL_TICK_MS, grow the pool if its queue stalled, and retire the
+// workers that stayed idle for POOL_IDLE_TICKS samples in a row, down to
+// the pool's floor. A retiring worker is handed NULL in place of a
+// connection.
+void *pool_thread(void *args) {
+    struct timespec tick = { .tv_sec = 0, .tv_nsec = POOL_TICK_MS * 1000000L };
+    int spare = config.maxThreads;
+    int ticks = 0;
     while (1) {
-        if (regexec(&regexH, headerP, ARRAY_SIZE(pmatchH), pmatchH, 0) != 0) {
-            break;
-        }
-
-        off = pmatchH[0].rm_so;
-        len = pmatchH[0].rm_eo;
-        subStr((int) off, (int) len, headerFields, match);
-
-        // Key
-        off = pmatchH[1].rm_so;
-        len = pmatchH[1].rm_eo - pmatchH[1].rm_so;
-        subStr(0, (int) len, headerP + pmatchH[1].rm_so, key);
-
-        // Value
-        off = pmatchH[2].rm_so;
-        len = pmatchH[2].rm_eo - pmatchH[2].rm_so;
-        subStr(0, (int) len, headerP + pmatchH[2].rm_so, value);
+        nanosleep(&tick, NULL);
+        growIfStalled(metrics_now());
 
-        if (strcmp(key, "Request-Id") == 0) {
-            *reqID = atoi(value);
+        int idle = atomic_load(&idleWorkers);
+        spare = idle < spare ? idle : spare;
+        ticks += 1;
+        if (spare > 0 && ticks < POOL_IDLE_TICKS) {
+            continue;
         }
-        if (strcmp(key, "Content-Length") == 0) {
-            *contentLen = atoi(value);
+        int live = atomic_load(&liveWorkers);
+        while (ticks == POOL_IDLE_TICKS && spare > 0 && live > config.nThreads) {
+            if (atomic_compare_exchange_weak(&liveWorkers, &live, live - 1)) {
+                atomic_fetch_add(&retiringWorkers, 1);
+                queue_push(q, NULL);
+                spare--;
+                live--;
+            }
         }
-
-        headerP += pmatchH[0].rm_eo;
+        spare = config.maxThreads;
+        ticks = 0;
     }
-    regfree(&regexH);
+    return args;
 }
 
-void flushBuffer(char buf[], int size) {
-    for (int i = 0; i < size; i++) {
-        buf[i] = '\0';
-    }
-    return;
+// Start the late period unless it already started
+static void noteLate(long now) {
+    long none = 0;
+    atomic_compare_exchange_strong(&lateSince, &none, now);
 }
 
-int getMethod(char buffer[], size_t bufSize, char uri[], char fullResponse[], char *startResponse,
-    regex_t regex, int fileSoc, int *statusCode) {
-    startResponse = "HTTP/1.1 200 OK\r\nContent-Length: ";
-    int bytesRead;
-    int bytesWritten;
-    int fileOpen = open(uri, O_RDWR);
-
-    if (fileOpen < 0) {
-        // Forbidden
-        if (errno == EISDIR) {
-            *statusCode = 403;
-            startResponse = FORBIDDEN;
-            reset(fullResponse, startResponse, regex, fileSoc);
-            close(fileOpen);
-            return -1;
-        }
-
-        // Not Found
-        *statusCode = 404;
-        startResponse = NOT_FOUND;
-        reset(fullResponse, startResponse, regex, fileSoc);
-        close(fileOpen);
-        return -1;
-    }
-
-    // write content len of file
-    off_t contentLen = lseek(fileOpen, 0, SEEK_END);
-    sprintf(fullResponse, "%s%d\r\n\r\n", startResponse, (int) contentLen);
-    write_n_bytes(fileSoc, fullResponse, strlen(fullResponse));
-    lseek(fileOpen, 0, SEEK_SET);
-
-    // Write message body
-    while ((bytesRead = read_n_bytes(fileOpen, buffer, bufSize)) != 0) {
-        if (bytesRead < 0) {
-            // Internal server err
-            *statusCode = 500;
-            startResponse = INTERNAL_SERVER_ERROR;
-            reset(fullResponse, startResponse, regex, fileSoc);
-            close(fileOpen);
-            return -1;
-        }
-        int remainingBytes = bytesRead;
-        bytesWritten = write_n_bytes(fileSoc, buffer, remainingBytes);
-        if (bytesWritten < 0) {
-            // Internal Server err
-            *statusCode = 500;
-            startResponse = INTERNAL_SERVER_ERROR;
-            reset(fullResponse, startResponse, regex, fileSoc);
-            close(fileOpen);
-            return -1;
-        }
+// Whether a new connection should be turned away: the queue holds the
+// most it may, or queue waits stayed past the target for SHED_INTERVAL_MS
+// (CoDel). Waits are measured as workers take connections, and also at
+// the queue's head, since with every worker stuck nothing is taken. An
+// empty queue ends the overload. With admission control on, a full queue
+// sheds rather than blocking the dispatcher.
+static bool overloaded(long now) {
+    if (config.maxQueued == 0 && config.queueTargetMs == 0) {
+        return false;
     }
-    close(fileOpen);
-    return 0;
-}
-
-int putMethod(char buffer[], size_t bufSize, char *bufP, regoff_t startIndex, int contentLenInt,
-    char uri[], char fullResponse[], char *startResponse, regex_t regex, int fileSoc, int bytesRead,
-    int *statusCode) {
-    int isCreated = 0;
-    int bytesWritten;
-    int fileOpen = open(uri, O_WRONLY | O_TRUNC, 0666);
-
-    if (fileOpen < 0) {
-        if (errno == ENOENT) {
-            fileOpen = open(uri, O_WRONLY | O_CREAT | O_TRUNC, 0666);
-            isCreated = 1;
-        } else {
-            fprintf(stderr, "Internal: open on put\n");
-            *statusCode = 500;
-            startResponse = INTERNAL_SERVER_ERROR;
-            reset(fullResponse, startResponse, regex, fileSoc);
-            return -1;
-        }
+    int queued = atomic_load(&queuedConns);
+    int slots = config.queueSize - atomic_load(&retiringWorkers);
+    if (queued >= (config.maxQueued > 0 && config.maxQueued < slots ? config.maxQueued : slots)) {
+        return true;
     }
-
-    int bytesToWrCurrBuf = bytesRead - startIndex;
-    if (contentLenInt < bytesToWrCurrBuf) {
-        bytesToWrCurrBuf = contentLenInt;
+    if (config.queueTargetMs == 0) {
+        return false;
     }
-    int totalBytesToWrite = contentLenInt - bytesToWrCurrBuf;
-
-    bytesWritten = write_n_bytes(fileOpen, bufP + startIndex, bytesToWrCurrBuf);
-    if (bytesWritten < 0) {
-        fprintf(stderr, "Internal server err (put: bytesWritten: %d)\n", bytesWritten);
-        *statusCode = 500;
-        startResponse = INTERNAL_SERVER_ERROR;
-        reset(fullResponse, startResponse, regex, fileSoc);
-        close(fileOpen);
-        return -1;
+    if (queued == 0) {
+        atomic_store(&lateSince, 0);
+        return false;
     }
-
-    // Check if buffer was full from initial read
-    while (totalBytesToWrite > 0) {
-        buffer[0] = '\0';
-        bytesRead = read_n_bytes(fileSoc, buffer, bufSize);
-        bytesWritten = write_n_bytes(fileOpen, buffer, bytesRead);
-        totalBytesToWrite -= bytesWritten;
+    if (now - atomic_load(&headSince) >= config.queueTargetMs * 1000000L) {
+        noteLate(now);
     }
+    long since = atomic_load(&lateSince);
+    return since != 0 && now - since >= SHED_INTERVAL_MS * 1000000L;
+}
 
-    if (isCreated == 1) {
-        *statusCode = 201;
-        startResponse = "HTTP/1.1 201 Created\r\nContent-Length: 8\r\n\r\nCreated\n";
+// Note how long a connection waited for the worker that took it
+static void noteQueueWait(long now, long waited) {
+    atomic_store(&headSince, now);
+    if (config.queueTargetMs == 0) {
+        return;
+    }
+    if (waited < config.queueTargetMs * 1000000L) {
+        atomic_store(&lateSince, 0);
     } else {
-        startResponse = "HTTP/1.1 200 OK\r\nContent-Length: 3\r\n\r\nOK\n";
+        noteLate(now);
     }
-    sprintf(fullResponse, "%s", startResponse);
-    write_n_bytes(fileSoc, fullResponse, strlen(fullResponse));
-    close(fileOpen);
-    return 0;
+}
+
+// Answer 503 and close, without the connection ever reaching a worker.
+// What the client already sent is read first, so closing doesn't reset
+// the connection before the client gets the response.
+static void shed(int fd) {
+    char drain[4096];
+    send(fd, overloadedResponse, sizeof(overloadedResponse) - 1, MSG_DONTWAIT | MSG_NOSIGNAL);
+    while (recv(fd, drain, sizeof(drain), MSG_DONTWAIT) > 0) {
+    }
+    close(fd);
+    metrics_shed(serverMetrics);
 }
 
 void *dispatcher_thread(void *args) {
     Listener_Socket *socket = (Listener_Socket *) args;
     while (1) {
         // Start Listening to new socket with args as soc
-        int *currFileSoc = malloc(sizeof(int));
-        *currFileSoc = listener_accept(socket);
-        if (*currFileSoc == -1) {
+        queuedConn *currFileSoc = malloc(sizeof(queuedConn));
+        currFileSoc->fd = listener_accept(socket);
+        if (currFileSoc->fd == -1) {
             fprintf(stderr, "Err: %s\n", strerror(errno));
+            free(currFileSoc);
+            continue;
         }
 
         // Handoff request file descriptor to Worker Thread
+        currFileSoc->enqueued = metrics_now();
+        if (overloaded(currFileSoc->enqueued)) {
+            shed(currFileSoc->fd);
+            free(currFileSoc);
+            continue;
+        }
+        metrics_enqueued(serverMetrics);
+        if (atomic_fetch_add(&queuedConns, 1) == 0) {
+            atomic_store(&headSince, currFileSoc->enqueued);
+        }
         queue_push(q, (void *) currFileSoc);
+        growIfStalled(currFileSoc->enqueued);
     }
 }
 
+// Serve one accepted connection on a blocking socket until it closes
+void serveConnection(int fd) {
+    // Blocking sockets never wait, so one advance serves the whole connection
+    Conn c = newConn(fd, false, -1);
+    connAdvance(c);
+    freeConn(&c);
+}
+
 void *worker_thread(void *args) {
     void *fileSocP;
     int myFileSoc;
 
-    char buffer[2100];
-    char *bufP = buffer;
-
-    // Request Buffers
-    char method[9];
-    char uri[65];
-    char version[9];
-    char headers[2100];
-
-    int requestId;
-    int contentLenInt;
-    int statusCode;
-
-    // Regex
-    char *re = "^([a-zA-Z]{1,8}) (/[a-zA-Z0-9.-]{2,63}) "
-               "(HTTP/[0-9]\\.[0-9])\r\n(([a-zA-Z0-9.-]{1,128}: .{1,128}\r\n)*)\r\n((.|\n)+)*$";
-    regex_t regex;
-    regmatch_t pmatch[8];
-    regoff_t off, len;
-
     while (1) {
-        char fullResponse[2100];
-        char *startResponse = NULL;
-        requestId = 0;
-        contentLenInt = 0;
-        statusCode = 200;
-
-        // Flush Buffer to be empty
-        flushBuffer(buffer, sizeof(buffer));
-
         // Wait for dispatcher to add to queue
+        atomic_fetch_add(&idleWorkers, 1);
         queue_pop(q, (void **) &fileSocP);
-        myFileSoc = (*(int *) fileSocP);
-
-        // Compile regex and collect match values
-        if (regcomp(&regex, re, REG_NEWLINE | REG_EXTENDED)) {
-            errorMessage("Regex failed to compile\n");
-        }
-
-        // Read Request from socket
-        int readBytes = read_n_bytes(myFileSoc, buffer, sizeof(buffer));
-
-        // regex, get match of readbytes
-        if (regexec(&regex, bufP, ARRAY_SIZE(pmatch), pmatch, 0)) {
-            statusCode = 400;
-            startResponse = BAD_REQUEST;
-            reset(fullResponse, startResponse, regex, myFileSoc);
-            continue;
-        }
-
-        // Collect group tokens on valid request --------------------------------------------------------
-
-        // Method
-        off = pmatch[1].rm_so + (bufP - buffer);
-        len = pmatch[1].rm_eo - pmatch[1].rm_so;
-        subStr((int) off, (int) len, buffer, method);
-        if (strcmp(method, "GET") != 0 && strcmp(method, "PUT") != 0) {
-            statusCode = 501;
-            startResponse = NOT_IMPLEMENTED;
-            reset(fullResponse, startResponse, regex, myFileSoc);
-            continue;
+        atomic_fetch_sub(&idleWorkers, 1);
+        if (fileSocP == NULL) {
+            atomic_fetch_sub(&retiringWorkers, 1);
+            break;
         }
+        atomic_fetch_sub(&queuedConns, 1);
+        queuedConn *queued = (queuedConn *) fileSocP;
+        myFileSoc = queued->fd;
+        long now = metrics_now();
+        metrics_dequeued(serverMetrics, now - queued->enqueued);
+        noteQueueWait(now, now - queued->enqueued);
+        free(fileSocP);
+
+        serveConnection(myFileSoc);
+    }
+    connThreadDone();
+    return args;
+}
 
-        // URI
-        off = pmatch[2].rm_so + (bufP - buffer);
-        len = pmatch[2].rm_eo - pmatch[2].rm_so;
-        subStr((int) off + 1, (int) len - 1, buffer, uri);
-
-        // Version
-        off = pmatch[3].rm_so + (bufP - buffer);
-        len = pmatch[3].rm_eo - pmatch[3].rm_so;
-        subStr((int) off, (int) len, buffer, version);
-        if (strcmp(version, "HTTP/1.1") != 0) {
-            statusCode = 505;
-            startResponse = UNSUPPORTED_VERSION;
-            reset(fullResponse, startResponse, regex, myFileSoc);
+// Worker with its own SO_REUSEPORT listener, accepting without a dispatcher
+void *accepting_worker_thread(void *args) {
+    Listener_Socket *socket = (Listener_Socket *) args;
+    while (1) {
+        int fd = accept(socket->fd, NULL, NULL);
+        if (fd == -1) {
+            fprintf(stderr, "Err: %s\n", strerror(errno));
             continue;
         }
-
-        // Header Fields
-        if (pmatch[4].rm_so != 0) {
-            off = pmatch[4].rm_so + (bufP - buffer);
-            len = pmatch[4].rm_eo - pmatch[4].rm_so;
-            subStr((int) off, (int) len, buffer, headers);
-        }
-        headerFields(headers, &requestId, &contentLenInt);
-
-        // Message
-        if (pmatch[6].rm_so != -1) {
-            off = pmatch[6].rm_so;
-            len = pmatch[6].rm_eo - pmatch[6].rm_so;
-        }
-
-        // Add URI to the list for file syncronization -------------------------------
-        incrementURI(listURI, uri);
-
-        // Get or PUT ----------------------------------------------------------------
-        if (strcmp(method, "GET") == 0) {
-            // GET method gets contents of existing URI
-            listReaderLock(listURI, uri);
-
-            int result = getMethod(buffer, sizeof(buffer), uri, fullResponse, startResponse, regex,
-                myFileSoc, &statusCode);
-            fprintf(stderr, "%s,/%s,%d,%d\n", method, uri, statusCode, requestId);
-
-            listReaderUnlock(listURI, uri);
-
-            decrementURI(listURI, uri);
-
-            if (result == -1) {
-                continue;
-            }
-        } else {
-            // PUT method puts content into URI if it exists or not
-
-            listWriterLock(listURI, uri);
-
-            int result = putMethod(buffer, sizeof(buffer), bufP, off, contentLenInt, uri,
-                fullResponse, startResponse, regex, myFileSoc, readBytes, &statusCode);
-            fprintf(stderr, "%s,/%s,%d,%d\n", method, uri, statusCode, requestId);
-
-            listWriterUnlock(listURI, uri);
-
-            decrementURI(listURI, uri);
-
-            if (result == -1) {
-                continue;
-            }
-        }
-
-        regfree(&regex);
-        close(myFileSoc);
+        serveConnection(fd);
     }
     return args;
 }
 
 int main(int argc, char *argv[]) {
     int port = -1;
-    int nThreads = 4;
-    q = queue_new(nThreads);
-    listURI = newList();
 
     // Get Thread and Port Argument
-    processArgs(argc, argv, &port, &nThreads);
+    processArgs(argc, argv, &port);
+    uriLocks = uritable_new(URI_SHARDS, config.futexLocks, config.lockStats);
+    q = config.lockFreeQueue ? queue_new_lockfree(config.queueSize) : queue_new(config.queueSize);
+    serverMetrics = metrics_new();
+    bufPool = bufpool_new(BUF_CACHE_BYTES);
+    if (config.cacheMB > 0) {
+        objectCache = cache_new((size_t) config.cacheMB << 20, CACHE_MAX_OBJECT);
+    }
+    if (config.cachedFds > 0) {
+        fdCache = fdcache_new(config.cachedFds);
+    }
 
-    // Initialize Socket with port
-    Listener_Socket soc;
-    if (listener_init(&soc, port) != 0) {
-        errorMessage("listener_init error\n");
+    // Peers that hang up mid-response must not kill the server, and
+    // SIGUSR1, SIGINT and SIGTERM are only taken by the report thread
+    signal(SIGPIPE, SIG_IGN);
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGUSR1);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    int auditFd = STDERR_FILENO;
+    if (config.auditPath != NULL) {
+        auditFd = open(config.auditPath, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (auditFd < 0) {
+            errorMessage("Cannot open audit log\n");
+        }
+    }
+    auditLog = auditlog_new(auditFd, config.dropAuditRecords);
+    if (config.durability == DURABLE_GROUP) {
+        int dirFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (dirFd < 0) {
+            errorMessage("Cannot open served directory\n");
+        }
+        putCommits = groupcommit_new(dirFd, config.commitWindowUs);
+    }
+    if (config.logObjectKB > 0) {
+        logStore = logstore_new(config.durability == DURABLE_SYNC);
+        if (logStore == NULL) {
+            errorMessage("Cannot create log store segment\n");
+        }
+    }
+
+    pthread_t reporter;
+    pthread_create(&reporter, NULL, report_thread, &signals);
+
+    // Initialize Socket with port, or one socket per worker sharing the
+    // port so the kernel balances connections across them
+    int nThreads = config.nThreads;
+    int nListeners = config.reusePort ? nThreads : 1;
+    Listener_Socket socs[nListeners];
+    for (int i = 0; i < nListeners; i++) {
+        if (config.reusePort) {
+            socs[i].fd = openReusePortListener(port);
+            if (socs[i].fd < 0) {
+                errorMessage("listener error\n");
+            }
+        } else if (listener_init(&socs[i], port) != 0) {
+            errorMessage("listener_init error\n");
+        }
     }
 
     // Create Threads
     pthread_t threads[nThreads + 1];
+    int nStarted = nThreads;
 
-    for (int i = 0; i < nThreads; i++) {
-        int *threadNumber;
-        threadNumber = (int *) malloc(sizeof(int));
-        *threadNumber = i;
-        pthread_create(threads + i, NULL, worker_thread, threadNumber);
+    if (config.uringMode) {
+        // Every worker runs its own ring, accepting on it for itself
+        for (int i = 0; i < nThreads; i++) {
+            pthread_create(threads + i, NULL, uring_worker_thread, &socs[i % nListeners]);
+        }
+    } else if (config.eventMode) {
+        // Every worker runs its own epoll loop and accepts for itself
+        for (int i = 0; i < nListeners; i++) {
+            if (fcntl(socs[i].fd, F_SETFL, fcntl(socs[i].fd, F_GETFL) | O_NONBLOCK) < 0) {
+                errorMessage("fcntl error\n");
+            }
+        }
+        for (int i = 0; i < nThreads; i++) {
+            pthread_create(threads + i, NULL, event_worker_thread, &socs[i % nListeners]);
+        }
+    } else if (config.reusePort) {
+        for (int i = 0; i < nThreads; i++) {
+            pthread_create(threads + i, NULL, accepting_worker_thread, &socs[i]);
+        }
+    } else {
+        // The pool starts at its floor and only the dispatcher and the
+        // pool thread are joined
+        for (int i = 0; i < nThreads; i++) {
+            growPool();
+        }
+        pthread_create(threads, NULL, dispatcher_thread, &socs[0]);
+        pthread_create(threads + 1, NULL, pool_thread, NULL);
+        nStarted = 2;
     }
-    pthread_create(threads + nThreads, NULL, dispatcher_thread, &soc);
 
-    for (int i = 0; i < nThreads + 1; i++) {
+    for (int i = 0; i < nStarted; i++) {
         pthread_join(threads[i], NULL);
     }
 
     queue_delete(&q);
-    freeList(&listURI);
+    uritable_delete(&uriLocks);
+    cache_delete(&objectCache);
+    auditlog_delete(&auditLog);
+    metrics_delete(&serverMetrics);
     return (0);
 }
@@ -0,0 +1,15 @@
+/**
+ * @File listensock.h
+ *
+ * Listening sockets opened by the server itself instead of through the
+ * starter listener_init, for the case where every worker owns one.
+ */
+
+#pragma once
+
+// openReusePortListener()
+// Opens a TCP socket listening on port on every interface with
+// SO_REUSEPORT set, so each worker can open its own on the same port and
+// the kernel spreads new connections across them. Returns the socket, or
+// -1 with errno set.
+int openReusePortListener(int port);
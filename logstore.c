@@ -0,0 +1,775 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+#include <sys/uio.h>
+#include "logstore.h"
+#include "uritable.h"
+
+// Segments are named under a prefix no URI can have
+#define SEGMENT_PREFIX "segment_"
+#define SEGMENT_BYTES  (64 << 20) // the active segment is sealed once it grows past this
+
+#define INDEX_SHARDS  16
+#define FIRST_BUCKETS 1024 // per shard, doubled whenever it has twice as many entries
+#define MAX_URI       64
+#define RECORD_MAGIC  0x314c5448u
+
+#define COMPACT_INTERVAL     1  // seconds between the compactor's rounds
+#define COMPACT_LIVE_PERCENT 50 // sealed segments with less live data than this are compacted
+
+// Head of a record, followed by the URI, the body and padding up to a
+// multiple of 8 bytes
+typedef struct recordHead {
+    uint32_t magic;
+    uint32_t checksum; // of the rest of the head, the URI and the body
+    uint64_t seq;      // orders the versions of a URI, kept when a record is moved
+    int64_t mtimeNs;   // when the PUT stored it
+    uint32_t bodyLen;
+    uint8_t uriLen;
+    uint8_t tombstone; // the URI was removed, there is no body
+    uint16_t pad;
+} recordHead;
+
+typedef struct logSegment {
+    unsigned id;
+    int fd;
+    off_t size;        // bytes of whole records, grown under appendMutex
+    _Atomic long live; // bytes of the records the index points at
+    _Atomic int refs;  // one for being in the store, one per holder
+    struct logSegment *next; // the next newer segment
+} logSegment_t;
+
+typedef struct logEntry {
+    char uri[MAX_URI + 1];
+    uint32_t hash;
+    logSegment_t *segment;
+    off_t offset; // of the record
+    uint32_t length;
+    uint64_t seq;
+    int64_t mtimeNs;
+    bool tombstone; // only while the index is rebuilt
+    struct logEntry *next;
+} logEntry;
+
+typedef struct logShard {
+    _Alignas(64) pthread_mutex_t mutex;
+    logEntry **buckets;
+    size_t nBuckets;
+    long entries;
+} logShard;
+
+// A shard's mutex is always taken before appendMutex. Appends are
+// serialized, so a segment can only end in a torn record, never have one
+// in the middle.
+typedef struct logStore {
+    logShard *shards;
+    bool syncRemovals;
+
+    pthread_mutex_t appendMutex;
+    logSegment_t *oldest; // segments from oldest to newest, which is active
+    logSegment_t *active;
+    unsigned nextId;
+    uint64_t nextSeq;
+    long segments;
+    long appends;
+    long tombstones;
+    long compactions;
+    long moved;
+
+    pthread_mutex_t stopMutex;
+    pthread_cond_t stopCond;
+    bool stop;
+    pthread_t compactor;
+} logStore_t;
+
+// Helper Functions -----------------------------------------------------------
+
+static size_t recordSize(size_t uriLen, size_t bodyLen) {
+    return (sizeof(recordHead) + uriLen + bodyLen + 7) & ~(size_t) 7;
+}
+
+// Running checksum, a word at a time: cheap enough for every append, and
+// only there to find where a crash tore the last record
+static uint64_t mix(uint64_t h, const void *data, size_t len) {
+    const unsigned char *p = (const unsigned char *) data;
+    for (; len >= 8; p += 8, len -= 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        h = (h ^ w) * 0x100000001b3ULL;
+        h ^= h >> 32;
+    }
+    for (; len > 0; p++, len--) {
+        h = (h ^ *p) * 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t payloadSum(const char *uri, size_t uriLen, const char *body, size_t bodyLen) {
+    return mix(mix(0xcbf29ce484222325ULL, uri, uriLen), body, bodyLen);
+}
+
+static uint32_t recordChecksum(uint64_t payload, recordHead h) {
+    h.checksum = 0;
+    uint64_t sum = mix(payload, &h, sizeof(h));
+    return (uint32_t) (sum ^ (sum >> 32));
+}
+
+static int64_t nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void segmentName(unsigned id, char *name, size_t size) {
+    snprintf(name, size, SEGMENT_PREFIX "%08u", id);
+}
+
+static void segmentRelease(logSegment_t *g) {
+    if (atomic_fetch_sub(&g->refs, 1) == 1) {
+        close(g->fd);
+        free(g);
+    }
+}
+
+// Add a segment as the newest, appendMutex is held
+static void addSegment(logStore_t *s, unsigned id, int fd) {
+    logSegment_t *g = (logSegment_t *) malloc(sizeof(logSegment_t));
+    assert(g != NULL);
+    g->id = id;
+    g->fd = fd;
+    g->size = 0;
+    atomic_init(&g->live, 0);
+    atomic_init(&g->refs, 1);
+    g->next = NULL;
+    if (s->active != NULL) {
+        s->active->next = g;
+    } else {
+        s->oldest = g;
+    }
+    s->active = g;
+    s->segments += 1;
+    if (id >= s->nextId) {
+        s->nextId = id + 1;
+    }
+}
+
+// Seal the active segment and start a new one, appendMutex is held
+static bool roll(logStore_t *s) {
+    char name[32];
+    int fd;
+    do {
+        segmentName(s->nextId++, name, sizeof(name));
+        fd = open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    } while (fd < 0 && errno == EEXIST);
+    if (fd < 0) {
+        return false;
+    }
+
+    // The new name must survive a crash as well as the records put in it
+    int dirFd = open(".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    addSegment(s, s->nextId - 1, fd);
+    return true;
+}
+
+// Write a record at the end of the active segment, rolling to a new one
+// if it is full. A new version (seq 0) gets the next sequence number, a
+// moved record keeps its own. appendMutex is held. Returns the segment
+// with a reference for the caller, NULL if the write failed.
+static logSegment_t *append(logStore_t *s, recordHead *h, uint64_t payload, const char *uri,
+    const char *body, off_t *offset) {
+    size_t size = recordSize(h->uriLen, h->bodyLen);
+    if (s->active->size > 0 && s->active->size + (off_t) size > SEGMENT_BYTES) {
+        roll(s);
+    }
+    if (h->seq == 0) {
+        h->seq = s->nextSeq++;
+    }
+    h->checksum = recordChecksum(payload, *h);
+
+    static const char zeros[8];
+    struct iovec iov[4] = {
+        { h, sizeof(recordHead) },
+        { (void *) uri, h->uriLen },
+        { (void *) body, h->bodyLen },
+        { (void *) zeros, size - sizeof(recordHead) - h->uriLen - h->bodyLen },
+    };
+    logSegment_t *g = s->active;
+    if (pwritev(g->fd, iov, 4, g->size) != (ssize_t) size) {
+        // Nothing may follow a torn record, so records go to a new segment,
+        // or over this one again if none can be made
+        roll(s);
+        return NULL;
+    }
+    *offset = g->size;
+    g->size += (off_t) size;
+    s->appends += 1;
+    atomic_fetch_add(&g->refs, 1);
+    return g;
+}
+
+static logShard *shardFor(logStore_t *s, uint32_t hash) {
+    return &s->shards[hash % INDEX_SHARDS];
+}
+
+static logEntry **bucketFor(logShard *sh, uint32_t hash) {
+    return &sh->buckets[(hash / INDEX_SHARDS) & (sh->nBuckets - 1)];
+}
+
+// Find uri in its shard, shard is locked
+static logEntry *find(logShard *sh, uint32_t hash, const char *uri) {
+    logEntry *e = *bucketFor(sh, hash);
+    while (e != NULL && (e->hash != hash || strcmp(e->uri, uri) != 0)) {
+        e = e->next;
+    }
+    return e;
+}
+
+// Double the shard's buckets, shard is locked
+static void grow(logShard *sh) {
+    logEntry **old = sh->buckets;
+    size_t oldCount = sh->nBuckets;
+    sh->nBuckets *= 2;
+    sh->buckets = (logEntry **) calloc(sh->nBuckets, sizeof(logEntry *));
+    assert(sh->buckets != NULL);
+    for (size_t i = 0; i < oldCount; i++) {
+        while (old[i] != NULL) {
+            logEntry *e = old[i];
+            old[i] = e->next;
+            logEntry **bucket = bucketFor(sh, e->hash);
+            e->next = *bucket;
+            *bucket = e;
+        }
+    }
+    free(old);
+}
+
+// Add an entry for uri to the shard, shard is locked
+static logEntry *insert(logShard *sh, uint32_t hash, const char *uri) {
+    if (sh->entries >= 2 * (long) sh->nBuckets) {
+        grow(sh);
+    }
+    logEntry *e = (logEntry *) calloc(1, sizeof(logEntry));
+    assert(e != NULL);
+    strncpy(e->uri, uri, MAX_URI);
+    e->hash = hash;
+    logEntry **bucket = bucketFor(sh, hash);
+    e->next = *bucket;
+    *bucket = e;
+    sh->entries += 1;
+    return e;
+}
+
+// Unlink e from its shard and free it, shard is locked
+static void removeEntry(logShard *sh, logEntry *e) {
+    logEntry **link = bucketFor(sh, e->hash);
+    while (*link != e) {
+        link = &(*link)->next;
+    }
+    *link = e->next;
+    sh->entries -= 1;
+    free(e);
+}
+
+static size_t entrySize(const logEntry *e) {
+    return recordSize(strlen(e->uri), e->length);
+}
+
+// A stored body looks like a regular file to GET. Its sequence number
+// stands in for the inode, so every version gets a new ETag.
+static void fillStat(const logEntry *e, struct stat *st) {
+    memset(st, 0, sizeof(*st));
+    st->st_mode = S_IFREG | 0644;
+    st->st_nlink = 1;
+    st->st_ino = (ino_t) e->seq;
+    st->st_size = e->length;
+    st->st_mtim.tv_sec = e->mtimeNs / 1000000000;
+    st->st_mtim.tv_nsec = e->mtimeNs % 1000000000;
+}
+
+// Make the record uri's entry unless a later version was seen already,
+// while the index is rebuilt
+static void indexRecord(logStore_t *s, logSegment_t *g, off_t offset, const recordHead *h,
+    const char *uri) {
+    uint32_t hash = uritable_hash(uri);
+    logShard *sh = shardFor(s, hash);
+    logEntry *e = find(sh, hash, uri);
+    if (e == NULL) {
+        e = insert(sh, hash, uri);
+    } else if (e->seq >= h->seq) {
+        return;
+    }
+    e->segment = g;
+    e->offset = offset;
+    e->length = h->bodyLen;
+    e->seq = h->seq;
+    e->mtimeNs = h->mtimeNs;
+    e->tombstone = h->tombstone;
+    if (h->seq >= s->nextSeq) {
+        s->nextSeq = h->seq + 1;
+    }
+}
+
+// Read the record at offset into *buf (URI then body), growing it as
+// needed. Returns false if there is no whole record there.
+static bool readRecord(logSegment_t *g, off_t offset, off_t end, recordHead *h, char **buf,
+    size_t *bufSize) {
+    if (offset + (off_t) sizeof(recordHead) > end
+        || pread(g->fd, h, sizeof(recordHead), offset) != (ssize_t) sizeof(recordHead)) {
+        return false;
+    }
+    if (h->magic != RECORD_MAGIC || h->uriLen == 0 || h->uriLen > MAX_URI
+        || offset + (off_t) recordSize(h->uriLen, h->bodyLen) > end) {
+        return false;
+    }
+    size_t len = h->uriLen + (size_t) h->bodyLen;
+    if (len > *bufSize) {
+        free(*buf);
+        *bufSize = len;
+        *buf = (char *) malloc(len);
+        assert(*buf != NULL);
+    }
+    return pread(g->fd, *buf, len, offset + sizeof(recordHead)) == (ssize_t) len;
+}
+
+// Index every intact record of g, up to the first that isn't one, which
+// can only be the last record a crash tore
+static void scanSegment(logStore_t *s, logSegment_t *g, char **buf, size_t *bufSize) {
+    struct stat st;
+    if (fstat(g->fd, &st) < 0) {
+        return;
+    }
+    recordHead h;
+    while (readRecord(g, g->size, st.st_size, &h, buf, bufSize)) {
+        uint64_t payload = payloadSum(*buf, h.uriLen, *buf + h.uriLen, h.bodyLen);
+        if (recordChecksum(payload, h) != h.checksum) {
+            break;
+        }
+        char uri[MAX_URI + 1];
+        memcpy(uri, *buf, h.uriLen);
+        uri[h.uriLen] = '\0';
+        indexRecord(s, g, g->size, &h, uri);
+        g->size += (off_t) recordSize(h.uriLen, h.bodyLen);
+    }
+}
+
+static int compareIds(const void *a, const void *b) {
+    unsigned x = *(const unsigned *) a;
+    unsigned y = *(const unsigned *) b;
+    return (x > y) - (x < y);
+}
+
+// Rebuild the index from the segments in the directory, oldest first
+static void recover(logStore_t *s) {
+    DIR *dir = opendir(".");
+    if (dir == NULL) {
+        return;
+    }
+    unsigned *ids = NULL;
+    size_t nIds = 0;
+    size_t idsSize = 0;
+    struct dirent *d;
+    while ((d = readdir(dir)) != NULL) {
+        unsigned id;
+        char name[32];
+        if (sscanf(d->d_name, SEGMENT_PREFIX "%u", &id) != 1) {
+            continue;
+        }
+        segmentName(id, name, sizeof(name));
+        if (strcmp(name, d->d_name) != 0) {
+            continue;
+        }
+        if (nIds == idsSize) {
+            idsSize = idsSize > 0 ? idsSize * 2 : 64;
+            ids = (unsigned *) realloc(ids, idsSize * sizeof(unsigned));
+            assert(ids != NULL);
+        }
+        ids[nIds++] = id;
+    }
+    closedir(dir);
+    qsort(ids, nIds, sizeof(unsigned), compareIds);
+
+    char *buf = NULL;
+    size_t bufSize = 0;
+    for (size_t i = 0; i < nIds; i++) {
+        char name[32];
+        segmentName(ids[i], name, sizeof(name));
+        int fd = open(name, O_RDONLY | O_CLOEXEC);
+        if (fd >= 0) {
+            addSegment(s, ids[i], fd);
+            scanSegment(s, s->active, &buf, &bufSize);
+        }
+    }
+    free(buf);
+    free(ids);
+
+    // Tombstones only mattered while older versions could still turn up
+    for (int i = 0; i < INDEX_SHARDS; i++) {
+        logShard *sh = &s->shards[i];
+        for (size_t b = 0; b < sh->nBuckets; b++) {
+            logEntry *e = sh->buckets[b];
+            while (e != NULL) {
+                logEntry *next = e->next;
+                if (e->tombstone) {
+                    removeEntry(sh, e);
+                } else {
+                    atomic_fetch_add(&e->segment->live, (long) entrySize(e));
+                }
+                e = next;
+            }
+        }
+    }
+}
+
+// Copy the records of victim that are still needed to the active segment.
+// A version is needed while the index points at it, a tombstone while an
+// older segment may hold a version it removed and the URI hasn't been
+// stored again since. Returns true once nothing live is left in victim.
+static bool compact(logStore_t *s, logSegment_t *victim, bool oldest) {
+    char *buf = NULL;
+    size_t bufSize = 0;
+    bool ok = true;
+    recordHead h;
+    for (off_t offset = 0; ok && readRecord(victim, offset, victim->size, &h, &buf, &bufSize);
+         offset += (off_t) recordSize(h.uriLen, h.bodyLen)) {
+        char uri[MAX_URI + 1];
+        memcpy(uri, buf, h.uriLen);
+        uri[h.uriLen] = '\0';
+        uint64_t payload = payloadSum(buf, h.uriLen, buf + h.uriLen, h.bodyLen);
+        uint32_t hash = uritable_hash(uri);
+        logShard *sh = shardFor(s, hash);
+
+        // The shard stays locked from the check to the index update, so a
+        // PUT of the URI either comes first and makes the record dead or
+        // comes after and replaces the moved copy
+        pthread_mutex_lock(&(sh->mutex));
+        logEntry *e = find(sh, hash, uri);
+        bool needed = h.tombstone ? e == NULL && !oldest
+                                  : e != NULL && e->segment == victim && e->offset == offset;
+        if (needed) {
+            off_t to;
+            pthread_mutex_lock(&s->appendMutex);
+            logSegment_t *g = append(s, &h, payload, buf, buf + h.uriLen, &to);
+            s->moved += g != NULL;
+            pthread_mutex_unlock(&s->appendMutex);
+            if (g == NULL) {
+                ok = false;
+            } else {
+                if (!h.tombstone) {
+                    long size = (long) entrySize(e);
+                    atomic_fetch_sub(&victim->live, size);
+                    atomic_fetch_add(&g->live, size);
+                    e->segment = g;
+                    e->offset = to;
+                }
+                segmentRelease(g);
+            }
+        }
+        pthread_mutex_unlock(&(sh->mutex));
+    }
+    free(buf);
+    return ok && atomic_load(&victim->live) == 0;
+}
+
+// Compact the sealed segment with the smallest share of live data, if it
+// is small enough, and delete it. Returns true if a segment was deleted.
+static bool compactOne(logStore_t *s) {
+    pthread_mutex_lock(&s->appendMutex);
+    logSegment_t *victim = NULL;
+    long victimLive = 0;
+    for (logSegment_t *g = s->oldest; g != s->active; g = g->next) {
+        long live = atomic_load(&g->live);
+        if (live > 0 && live * 100 >= (long) g->size * COMPACT_LIVE_PERCENT) {
+            continue;
+        }
+        if (victim == NULL || live * (long) victim->size < victimLive * (long) g->size) {
+            victim = g;
+            victimLive = live;
+        }
+    }
+    bool oldest = victim == s->oldest;
+    if (victim != NULL) {
+        atomic_fetch_add(&victim->refs, 1);
+    }
+    pthread_mutex_unlock(&s->appendMutex);
+    if (victim == NULL) {
+        return false;
+    }
+
+    // The copies must be on disk before the originals are gone
+    bool emptied = compact(s, victim, oldest) && syncfs(victim->fd) == 0;
+    if (emptied) {
+        pthread_mutex_lock(&s->appendMutex);
+        logSegment_t **link = &s->oldest;
+        while (*link != victim) {
+            link = &(*link)->next;
+        }
+        *link = victim->next;
+        s->segments -= 1;
+        s->compactions += 1;
+        pthread_mutex_unlock(&s->appendMutex);
+
+        // Readers still sending from it keep the file open until they finish
+        char name[32];
+        segmentName(victim->id, name, sizeof(name));
+        unlink(name);
+        segmentRelease(victim);
+    }
+    segmentRelease(victim);
+    return emptied;
+}
+
+// Look for segments to compact every COMPACT_INTERVAL seconds
+static void *compactor_thread(void *args) {
+    logStore_t *s = (logStore_t *) args;
+    pthread_mutex_lock(&s->stopMutex);
+    while (!s->stop) {
+        struct timespec until;
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += COMPACT_INTERVAL;
+        pthread_cond_timedwait(&s->stopCond, &s->stopMutex, &until);
+        while (!s->stop) {
+            pthread_mutex_unlock(&s->stopMutex);
+            bool more = compactOne(s);
+            pthread_mutex_lock(&s->stopMutex);
+            if (!more) {
+                break;
+            }
+        }
+    }
+    pthread_mutex_unlock(&s->stopMutex);
+    return args;
+}
+
+// Free the index and drop the store's references on its segments
+static void freeStore(logStore_t *s) {
+    for (int i = 0; i < INDEX_SHARDS; i++) {
+        logShard *sh = &s->shards[i];
+        for (size_t b = 0; b < sh->nBuckets; b++) {
+            while (sh->buckets[b] != NULL) {
+                removeEntry(sh, sh->buckets[b]);
+            }
+        }
+        free(sh->buckets);
+        pthread_mutex_destroy(&(sh->mutex));
+    }
+    free(s->shards);
+    while (s->oldest != NULL) {
+        logSegment_t *next = s->oldest->next;
+        segmentRelease(s->oldest);
+        s->oldest = next;
+    }
+    pthread_mutex_destroy(&s->appendMutex);
+    free(s);
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+logStore_t *logstore_new(bool syncRemovals) {
+    logStore_t *s = (logStore_t *) calloc(1, sizeof(logStore_t));
+    assert(s != NULL);
+    s->syncRemovals = syncRemovals;
+    s->shards = (logShard *) aligned_alloc(64, INDEX_SHARDS * sizeof(logShard));
+    assert(s->shards != NULL);
+    memset(s->shards, 0, INDEX_SHARDS * sizeof(logShard));
+    for (int i = 0; i < INDEX_SHARDS; i++) {
+        logShard *sh = &s->shards[i];
+        sh->nBuckets = FIRST_BUCKETS;
+        sh->buckets = (logEntry **) calloc(FIRST_BUCKETS, sizeof(logEntry *));
+        assert(sh->buckets != NULL);
+        int rc = pthread_mutex_init(&(sh->mutex), NULL);
+        assert(!rc);
+    }
+    int rc = pthread_mutex_init(&s->appendMutex, NULL);
+    assert(!rc);
+    s->nextId = 1;
+    s->nextSeq = 1;
+
+    // Recovered segments are only read, new records go to a new segment
+    recover(s);
+    if (!roll(s)) {
+        freeStore(s);
+        return NULL;
+    }
+
+    rc = pthread_mutex_init(&s->stopMutex, NULL);
+    assert(!rc);
+    rc = pthread_cond_init(&s->stopCond, NULL);
+    assert(!rc);
+    rc = pthread_create(&s->compactor, NULL, compactor_thread, s);
+    assert(!rc);
+    return s;
+}
+
+void logstore_delete(logStore_t **s) {
+    if (*s == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&(*s)->stopMutex);
+    (*s)->stop = true;
+    pthread_cond_signal(&(*s)->stopCond);
+    pthread_mutex_unlock(&(*s)->stopMutex);
+    pthread_join((*s)->compactor, NULL);
+    pthread_mutex_destroy(&(*s)->stopMutex);
+    pthread_cond_destroy(&(*s)->stopCond);
+    freeStore(*s);
+    *s = NULL;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+bool logstore_get(logStore_t *s, const char *uri, logObject *o) {
+    uint32_t hash = uritable_hash(uri);
+    logShard *sh = shardFor(s, hash);
+    pthread_mutex_lock(&(sh->mutex));
+    logEntry *e = find(sh, hash, uri);
+    if (e != NULL) {
+        atomic_fetch_add(&e->segment->refs, 1);
+        o->segment = e->segment;
+        o->fd = e->segment->fd;
+        o->offset = e->offset + (off_t) (sizeof(recordHead) + strlen(e->uri));
+        fillStat(e, &o->st);
+    }
+    pthread_mutex_unlock(&(sh->mutex));
+    return e != NULL;
+}
+
+bool logstore_stat(logStore_t *s, const char *uri, struct stat *st) {
+    uint32_t hash = uritable_hash(uri);
+    logShard *sh = shardFor(s, hash);
+    pthread_mutex_lock(&(sh->mutex));
+    logEntry *e = find(sh, hash, uri);
+    if (e != NULL) {
+        fillStat(e, st);
+    }
+    pthread_mutex_unlock(&(sh->mutex));
+    return e != NULL;
+}
+
+int logstore_put(logStore_t *s, const char *uri, const char *body, size_t len, logObject *o) {
+    recordHead h;
+    memset(&h, 0, sizeof(h));
+    h.magic = RECORD_MAGIC;
+    h.mtimeNs = nowNs();
+    h.bodyLen = (uint32_t) len;
+    h.uriLen = (uint8_t) strlen(uri);
+    assert(h.uriLen > 0 && strlen(uri) <= MAX_URI);
+    uint64_t payload = payloadSum(uri, h.uriLen, body, len);
+    uint32_t hash = uritable_hash(uri);
+    logShard *sh = shardFor(s, hash);
+
+    // Appending under the shard's lock keeps the compactor from seeing
+    // the record before the index does
+    pthread_mutex_lock(&(sh->mutex));
+    off_t offset;
+    pthread_mutex_lock(&s->appendMutex);
+    logSegment_t *g = append(s, &h, payload, uri, body, &offset);
+    pthread_mutex_unlock(&s->appendMutex);
+    if (g == NULL) {
+        pthread_mutex_unlock(&(sh->mutex));
+        return -1;
+    }
+
+    logEntry *e = find(sh, hash, uri);
+    if (e != NULL) {
+        atomic_fetch_sub(&e->segment->live, (long) entrySize(e));
+    } else {
+        e = insert(sh, hash, uri);
+    }
+    e->segment = g;
+    e->offset = offset;
+    e->length = h.bodyLen;
+    e->seq = h.seq;
+    e->mtimeNs = h.mtimeNs;
+    atomic_fetch_add(&g->live, (long) entrySize(e));
+
+    o->segment = g;
+    o->fd = g->fd;
+    o->offset = offset + (off_t) (sizeof(recordHead) + h.uriLen);
+    fillStat(e, &o->st);
+    pthread_mutex_unlock(&(sh->mutex));
+    return 0;
+}
+
+int logstore_remove(logStore_t *s, const char *uri) {
+    uint32_t hash = uritable_hash(uri);
+    logShard *sh = shardFor(s, hash);
+    pthread_mutex_lock(&(sh->mutex));
+    logEntry *e = find(sh, hash, uri);
+    if (e == NULL) {
+        pthread_mutex_unlock(&(sh->mutex));
+        return 0;
+    }
+
+    recordHead h;
+    memset(&h, 0, sizeof(h));
+    h.magic = RECORD_MAGIC;
+    h.mtimeNs = nowNs();
+    h.uriLen = (uint8_t) strlen(uri);
+    h.tombstone = 1;
+    off_t offset;
+    pthread_mutex_lock(&s->appendMutex);
+    logSegment_t *g = append(s, &h, payloadSum(uri, h.uriLen, NULL, 0), uri, NULL, &offset);
+    s->tombstones += g != NULL;
+    pthread_mutex_unlock(&s->appendMutex);
+
+    // Without its tombstone the old version would come back when the
+    // index is rebuilt and shadow whatever replaces it, so it stays
+    if (g == NULL) {
+        pthread_mutex_unlock(&(sh->mutex));
+        return -1;
+    }
+
+    atomic_fetch_sub(&e->segment->live, (long) entrySize(e));
+    removeEntry(sh, e);
+    pthread_mutex_unlock(&(sh->mutex));
+
+    if (s->syncRemovals) {
+        fdatasync(g->fd);
+    }
+    segmentRelease(g);
+    return 1;
+}
+
+void logstore_release(logStore_t *s, logObject *o) {
+    (void) s;
+    if (o->segment != NULL) {
+        segmentRelease(o->segment);
+        o->segment = NULL;
+    }
+}
+
+void logstore_stats(logStore_t *s, logStoreStats *stats) {
+    memset(stats, 0, sizeof(*stats));
+    for (int i = 0; i < INDEX_SHARDS; i++) {
+        logShard *sh = &s->shards[i];
+        pthread_mutex_lock(&(sh->mutex));
+        stats->objects += sh->entries;
+        pthread_mutex_unlock(&(sh->mutex));
+    }
+    pthread_mutex_lock(&s->appendMutex);
+    for (logSegment_t *g = s->oldest; g != NULL; g = g->next) {
+        stats->bytes += (long) g->size;
+        stats->liveBytes += atomic_load(&g->live);
+    }
+    stats->segments = s->segments;
+    stats->appends = s->appends;
+    stats->tombstones = s->tombstones;
+    stats->compactions = s->compactions;
+    stats->moved = s->moved;
+    pthread_mutex_unlock(&s->appendMutex);
+}
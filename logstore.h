@@ -0,0 +1,116 @@
+/**
+ * @File logstore.h
+ *
+ * Log-structured store for small PUT bodies. Each PUT is appended as one
+ * checksummed record to the active segment file, and an in-memory index
+ * maps the URI to the record holding its current version, so storing an
+ * object costs one write instead of an open, a truncate and a close of a
+ * file of its own. GETs send the body straight from the segment at its
+ * offset. A compactor thread copies the live records out of segments
+ * that are mostly overwritten and deletes them. The index is rebuilt by
+ * scanning the segments when the store is opened.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/** @struct logStore_t
+ *
+ *  @brief The segment files of the served directory and the index of the
+ *  objects stored in them.
+ */
+typedef struct logStore logStore_t;
+
+/** @struct logSegment_t
+ *
+ *  @brief A segment file, kept open while anything still reads from it.
+ */
+typedef struct logSegment logSegment_t;
+
+/** @struct logObject
+ *
+ *  @brief One version of a stored object, holding its segment open.
+ */
+typedef struct logObject {
+    int fd;       // the segment, shared, so only read at explicit offsets
+    off_t offset; // where the body starts in it
+    struct stat st;        // regular file of the body's size, the version as st_ino
+    logSegment_t *segment; // NULL when no object is held
+} logObject;
+
+/** @struct logStoreStats
+ *
+ *  @brief Counters and sizes of the store.
+ */
+typedef struct logStoreStats {
+    long objects;
+    long segments;
+    long bytes;
+    long liveBytes;
+    long appends;
+    long tombstones;
+    long compactions;
+    long moved;
+} logStoreStats;
+
+/** @brief Open the store in the current directory, rebuilding the index
+ *  from the segment files already there, and start the compactor thread.
+ *
+ *  @param syncRemovals fdatasync() the record of each removal before
+ *  logstore_remove returns, for servers that make every PUT durable on
+ *  its own
+ *
+ *  @return a pointer to a new logStore_t, NULL if no segment can be
+ *  created
+ */
+logStore_t *logstore_new(bool syncRemovals);
+
+/** @brief Stop the compactor, close the segments, free the store and set
+ *  *s = NULL. Objects still held must be released before this is called.
+ */
+void logstore_delete(logStore_t **s);
+
+/** @brief Find the current version of uri and take a reference on its
+ *  segment. The caller must hold the URI's lock.
+ *
+ *  @return true and *o filled in if uri is stored
+ */
+bool logstore_get(logStore_t *s, const char *uri, logObject *o);
+
+/** @brief Metadata of the current version of uri, as logstore_get would
+ *  give it, without holding anything.
+ *
+ *  @return true if uri is stored
+ */
+bool logstore_stat(logStore_t *s, const char *uri, struct stat *st);
+
+/** @brief Append a new version of uri and make it the current one. The
+ *  caller must hold the URI's writer lock.
+ *
+ *  @param o filled in with the new version, whose fd the caller syncs
+ *  for durability before releasing it
+ *
+ *  @return 0, or -1 if the record couldn't be written
+ */
+int logstore_put(logStore_t *s, const char *uri, const char *body, size_t len, logObject *o);
+
+/** @brief Forget uri, for a PUT that stores it as a file of its own. A
+ *  tombstone record keeps the old version from coming back when the
+ *  index is rebuilt. The caller must hold the URI's writer lock.
+ *
+ *  @return 1 if uri was stored, 0 if it wasn't, or -1 if the tombstone
+ *  couldn't be written, in which case uri is still stored
+ */
+int logstore_remove(logStore_t *s, const char *uri);
+
+/** @brief Drop the reference *o holds on its segment.
+ */
+void logstore_release(logStore_t *s, logObject *o);
+
+/** @brief Fill *stats with the store's counters.
+ */
+void logstore_stats(logStore_t *s, logStoreStats *stats);
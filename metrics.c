@@ -0,0 +1,308 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <assert.h>
+#include <pthread.h>
+#include "metrics.h"
+
+// Histogram bucket bounds in nanoseconds, the last bucket is +Inf
+static const long bucketBounds[] = { 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000,
+    10000000, 25000000, 50000000, 100000000, 250000000, 500000000, 1000000000, 2500000000,
+    5000000000, 10000000000 };
+#define N_BOUNDS  (int) (sizeof(bucketBounds) / sizeof(bucketBounds[0]))
+#define N_BUCKETS (N_BOUNDS + 1)
+
+// Status codes counted by name, anything else is counted as "other"
+static const int statusCodes[] = { 200, 201, 206, 304, 400, 403, 404, 408, 412, 416, 431, 500,
+    501, 503, 505 };
+#define N_CODES (int) (sizeof(statusCodes) / sizeof(statusCodes[0]) + 1)
+
+static const char *methods[] = { "GET", "PUT", "other" };
+#define N_METHODS 3
+
+static const char *phaseNames[N_PHASES] = { "read", "lock", "io", "respond" };
+
+// Only the owning thread writes a shard, readers may see a count a
+// moment old but never a torn one
+typedef _Atomic long counter;
+
+typedef struct histogram {
+    counter buckets[N_BUCKETS];
+    counter sumNs;
+} histogram;
+
+typedef struct metricsShard {
+    counter requests[N_METHODS][N_CODES];
+    counter bytesIn;
+    counter bytesOut;
+    counter enqueued;
+    counter dequeued;
+    counter shed;
+    histogram total;
+    histogram phases[N_PHASES];
+    histogram lockWait[2];
+    histogram queueWait;
+    struct metricsShard *next;
+    struct metricsShard *nextSpare;
+} metricsShard;
+
+typedef struct metrics {
+    pthread_mutex_t mutex;
+    _Atomic(metricsShard *) shards;
+    metricsShard *spares; // shards of threads that exited, under mutex
+} metrics_t;
+
+// The calling thread's shard, created on its first record
+static _Thread_local metricsShard *myShard;
+
+// Helper Functions -----------------------------------------------------------
+
+static void bump(counter *c, long n) {
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n,
+        memory_order_relaxed);
+}
+
+static long value(counter *c) {
+    return atomic_load_explicit(c, memory_order_relaxed);
+}
+
+static metricsShard *shard(metrics_t *m) {
+    if (myShard == NULL) {
+        // Counts are summed over shards, so a shard left by a thread that
+        // exited is taken over and added to as it is
+        pthread_mutex_lock(&m->mutex);
+        myShard = m->spares;
+        if (myShard != NULL) {
+            m->spares = myShard->nextSpare;
+        }
+        pthread_mutex_unlock(&m->mutex);
+    }
+    if (myShard == NULL) {
+        metricsShard *s = aligned_alloc(64, (sizeof(metricsShard) + 63) & ~(size_t) 63);
+        assert(s != NULL);
+        memset(s, 0, sizeof(*s));
+
+        // Shards are only added, at the front, so rendering walks the
+        // list without the lock
+        pthread_mutex_lock(&m->mutex);
+        s->next = atomic_load(&m->shards);
+        atomic_store(&m->shards, s);
+        pthread_mutex_unlock(&m->mutex);
+        myShard = s;
+    }
+    return myShard;
+}
+
+static void observe(histogram *h, long ns) {
+    int i = 0;
+    while (i < N_BOUNDS && ns > bucketBounds[i]) {
+        i++;
+    }
+    bump(&h->buckets[i], 1);
+    bump(&h->sumNs, ns);
+}
+
+// Write one histogram summed over shards. offset is where the histogram
+// sits inside a shard.
+static void renderHistogram(FILE *out, metrics_t *m, const char *name, const char *labels,
+    size_t offset) {
+    long buckets[N_BUCKETS] = { 0 };
+    long sumNs = 0;
+    for (metricsShard *s = atomic_load(&m->shards); s != NULL; s = s->next) {
+        histogram *h = (histogram *) ((char *) s + offset);
+        for (int i = 0; i < N_BUCKETS; i++) {
+            buckets[i] += value(&h->buckets[i]);
+        }
+        sumNs += value(&h->sumNs);
+    }
+
+    const char *sep = labels[0] != '\0' ? "," : "";
+    long cumulative = 0;
+    for (int i = 0; i < N_BUCKETS; i++) {
+        cumulative += buckets[i];
+        if (i < N_BOUNDS) {
+            fprintf(out, "%s_bucket{%s%sle=\"%g\"} %ld\n", name, labels, sep,
+                bucketBounds[i] / 1e9, cumulative);
+        } else {
+            fprintf(out, "%s_bucket{%s%sle=\"+Inf\"} %ld\n", name, labels, sep, cumulative);
+        }
+    }
+    fprintf(out, "%s_sum%s%s%s %.9f\n", name, labels[0] ? "{" : "", labels, labels[0] ? "}" : "",
+        sumNs / 1e9);
+    fprintf(out, "%s_count%s%s%s %ld\n", name, labels[0] ? "{" : "", labels,
+        labels[0] ? "}" : "", cumulative);
+}
+
+static long sumCounter(metrics_t *m, size_t offset) {
+    long total = 0;
+    for (metricsShard *s = atomic_load(&m->shards); s != NULL; s = s->next) {
+        total += value((counter *) ((char *) s + offset));
+    }
+    return total;
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+metrics_t *metrics_new(void) {
+    metrics_t *m = malloc(sizeof(metrics_t));
+    assert(m != NULL);
+    int rc = pthread_mutex_init(&m->mutex, NULL);
+    assert(!rc);
+    atomic_init(&m->shards, NULL);
+    m->spares = NULL;
+    return m;
+}
+
+void metrics_delete(metrics_t **m) {
+    if (*m == NULL) {
+        return;
+    }
+    metricsShard *s = atomic_load(&(*m)->shards);
+    while (s != NULL) {
+        metricsShard *next = s->next;
+        free(s);
+        s = next;
+    }
+    pthread_mutex_destroy(&(*m)->mutex);
+    free(*m);
+    *m = NULL;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+void metrics_thread_done(metrics_t *m) {
+    if (myShard == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&m->mutex);
+    myShard->nextSpare = m->spares;
+    m->spares = myShard;
+    pthread_mutex_unlock(&m->mutex);
+    myShard = NULL;
+}
+
+long metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void metrics_request(metrics_t *m, const char *method, int statusCode, long bytesIn,
+    long bytesOut, long ns) {
+    metricsShard *s = shard(m);
+    int methodIndex = N_METHODS - 1;
+    for (int i = 0; i < N_METHODS - 1; i++) {
+        if (strcmp(method, methods[i]) == 0) {
+            methodIndex = i;
+        }
+    }
+    int codeIndex = N_CODES - 1;
+    for (int i = 0; i < N_CODES - 1; i++) {
+        if (statusCode == statusCodes[i]) {
+            codeIndex = i;
+        }
+    }
+    bump(&s->requests[methodIndex][codeIndex], 1);
+    bump(&s->bytesIn, bytesIn);
+    bump(&s->bytesOut, bytesOut);
+    observe(&s->total, ns);
+}
+
+void metrics_phase(metrics_t *m, metricsPhase phase, long ns) {
+    observe(&shard(m)->phases[phase], ns);
+}
+
+void metrics_lock_wait(metrics_t *m, bool writer, long ns) {
+    observe(&shard(m)->lockWait[writer], ns);
+}
+
+void metrics_enqueued(metrics_t *m) {
+    bump(&shard(m)->enqueued, 1);
+}
+
+void metrics_shed(metrics_t *m) {
+    bump(&shard(m)->shed, 1);
+}
+
+void metrics_dequeued(metrics_t *m, long ns) {
+    metricsShard *s = shard(m);
+    bump(&s->dequeued, 1);
+    observe(&s->queueWait, ns);
+}
+
+char *metrics_render(metrics_t *m, size_t *len) {
+    char *text = NULL;
+    FILE *out = open_memstream(&text, len);
+    assert(out != NULL);
+
+    fprintf(out, "# HELP http_requests_total Requests served, by method and status code.\n"
+                 "# TYPE http_requests_total counter\n");
+    for (int i = 0; i < N_METHODS; i++) {
+        for (int j = 0; j < N_CODES; j++) {
+            size_t offset = offsetof(metricsShard, requests) + (i * N_CODES + j) * sizeof(counter);
+            long n = sumCounter(m, offset);
+            if (n == 0) {
+                continue;
+            }
+            if (j < N_CODES - 1) {
+                fprintf(out, "http_requests_total{method=\"%s\",code=\"%d\"} %ld\n", methods[i],
+                    statusCodes[j], n);
+            } else {
+                fprintf(out, "http_requests_total{method=\"%s\",code=\"other\"} %ld\n",
+                    methods[i], n);
+            }
+        }
+    }
+
+    fprintf(out, "# HELP http_request_duration_seconds Time from a request's first byte to "
+                 "its last response byte.\n"
+                 "# TYPE http_request_duration_seconds histogram\n");
+    renderHistogram(out, m, "http_request_duration_seconds", "", offsetof(metricsShard, total));
+
+    fprintf(out, "# HELP http_phase_duration_seconds Time requests spent in each phase.\n"
+                 "# TYPE http_phase_duration_seconds histogram\n");
+    for (int i = 0; i < N_PHASES; i++) {
+        char labels[32];
+        snprintf(labels, sizeof(labels), "phase=\"%s\"", phaseNames[i]);
+        renderHistogram(out, m, "http_phase_duration_seconds", labels,
+            offsetof(metricsShard, phases) + i * sizeof(histogram));
+    }
+
+    fprintf(out, "# HELP http_received_bytes_total Bytes read from clients.\n"
+                 "# TYPE http_received_bytes_total counter\n"
+                 "http_received_bytes_total %ld\n",
+        sumCounter(m, offsetof(metricsShard, bytesIn)));
+    fprintf(out, "# HELP http_sent_bytes_total Bytes sent to clients.\n"
+                 "# TYPE http_sent_bytes_total counter\n"
+                 "http_sent_bytes_total %ld\n",
+        sumCounter(m, offsetof(metricsShard, bytesOut)));
+
+    fprintf(out, "# HELP uri_lock_wait_seconds Time spent waiting for a per-URI lock.\n"
+                 "# TYPE uri_lock_wait_seconds histogram\n");
+    size_t offset = offsetof(metricsShard, lockWait);
+    renderHistogram(out, m, "uri_lock_wait_seconds", "mode=\"reader\"", offset);
+    renderHistogram(
+        out, m, "uri_lock_wait_seconds", "mode=\"writer\"", offset + sizeof(histogram));
+
+    long enqueued = sumCounter(m, offsetof(metricsShard, enqueued));
+    long dequeued = sumCounter(m, offsetof(metricsShard, dequeued));
+    fprintf(out, "# HELP worker_queue_depth Connections waiting for a worker thread.\n"
+                 "# TYPE worker_queue_depth gauge\n"
+                 "worker_queue_depth %ld\n",
+        enqueued > dequeued ? enqueued - dequeued : 0);
+    fprintf(out, "# HELP worker_queue_shed_total Connections turned away with 503 because "
+                 "the queue was overloaded.\n"
+                 "# TYPE worker_queue_shed_total counter\n"
+                 "worker_queue_shed_total %ld\n",
+        sumCounter(m, offsetof(metricsShard, shed)));
+    fprintf(out, "# HELP worker_queue_wait_seconds Time connections waited for a worker.\n"
+                 "# TYPE worker_queue_wait_seconds histogram\n");
+    renderHistogram(out, m, "worker_queue_wait_seconds", "", offsetof(metricsShard, queueWait));
+
+    fclose(out);
+    return text;
+}
@@ -0,0 +1,82 @@
+/**
+ * @File metrics.h
+ *
+ * Server metrics for the GET /metrics endpoint. Every thread counts into
+ * a shard of its own with plain relaxed stores, so recording never takes
+ * a lock or contends for a cache line; rendering sums the shards.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/** @struct metrics_t
+ *
+ *  @brief Counters and latency histograms, sharded by thread.
+ */
+typedef struct metrics metrics_t;
+
+/** @enum metricsPhase
+ *
+ *  @brief The parts of serving a request that are timed separately.
+ */
+typedef enum {
+    PHASE_READ,    // first byte of the request head to parsed
+    PHASE_LOCK,    // waiting for the per-URI lock
+    PHASE_IO,      // moving the body between socket and file
+    PHASE_RESPOND, // sending a response without a file body
+    N_PHASES
+} metricsPhase;
+
+/** @brief Dynamically allocates a new, zeroed set of metrics.
+ */
+metrics_t *metrics_new(void);
+
+/** @brief Free the metrics and every shard and set *m = NULL. No thread
+ *  may record after this.
+ */
+void metrics_delete(metrics_t **m);
+
+/** @brief Hand the calling thread's shard to the next thread that
+ *  records, for a thread that is about to exit. Its counts stay in the
+ *  totals.
+ */
+void metrics_thread_done(metrics_t *m);
+
+/** @brief Nanoseconds on the monotonic clock all durations are taken on.
+ */
+long metrics_now(void);
+
+/** @brief Count a finished request and the time from its first byte to
+ *  its last.
+ */
+void metrics_request(metrics_t *m, const char *method, int statusCode, long bytesIn,
+    long bytesOut, long ns);
+
+/** @brief Record time a request spent in phase.
+ */
+void metrics_phase(metrics_t *m, metricsPhase phase, long ns);
+
+/** @brief Record how long a request waited for its per-URI lock.
+ */
+void metrics_lock_wait(metrics_t *m, bool writer, long ns);
+
+/** @brief Count a connection handed to the worker queue.
+ */
+void metrics_enqueued(metrics_t *m);
+
+/** @brief Count a connection turned away instead of queued.
+ */
+void metrics_shed(metrics_t *m);
+
+/** @brief Count a connection taken off the worker queue after waiting in
+ *  it for ns.
+ */
+void metrics_dequeued(metrics_t *m, long ns);
+
+/** @brief Render every metric in the Prometheus text format.
+ *
+ *  @return a malloc'd string the caller frees, its length in *len
+ */
+char *metrics_render(metrics_t *m, size_t *len);
@@ -0,0 +1,457 @@
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include "parser.h"
+
+// Token limits, the same ones the request regex enforced
+#define MAX_METHOD 8
+#define MAX_URI    64
+#define MAX_KEY    128
+#define MAX_VALUE  128
+
+// Longest chunk-size line (extensions included) or trailer line accepted
+#define MAX_CHUNK_LINE 256
+
+// Range positions past this are treated as this, far beyond any file
+#define MAX_RANGE_VALUE ((off_t) 1 << 60)
+
+// Parser states, one per expected part of the request head
+enum {
+    P_METHOD,
+    P_URI,
+    P_VERSION,
+    P_REQUEST_LF,
+    P_HEADER,
+    P_KEY,
+    P_KEY_SPACE,
+    P_VALUE,
+    P_VALUE_LF,
+    P_END_LF
+};
+
+// Helper Functions -----------------------------------------------------------
+
+static bool isAlpha(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
+
+static bool isDigit(char ch) {
+    return ch >= '0' && ch <= '9';
+}
+
+// Characters allowed in URIs and header keys
+static bool isTokenChar(char ch) {
+    return isAlpha(ch) || isDigit(ch) || ch == '.' || ch == '-';
+}
+
+// Reads the digits at buf[*pos, end) into *value, false if there are none.
+// Values too big for a file offset saturate.
+static bool readNumber(const char *buf, int *pos, int end, off_t *value) {
+    int start = *pos;
+    *value = 0;
+    for (; *pos < end && isDigit(buf[*pos]); *pos += 1) {
+        if (*value < MAX_RANGE_VALUE) {
+            *value = *value * 10 + (buf[*pos] - '0');
+        }
+    }
+    return *pos > start;
+}
+
+static void skipSpaces(const char *buf, int *pos, int end) {
+    while (*pos < end && (buf[*pos] == ' ' || buf[*pos] == '\t')) {
+        *pos += 1;
+    }
+}
+
+static strSlice slice(int start, int end) {
+    strSlice s = { .off = start, .len = end - start };
+    return s;
+}
+
+// Parser ---------------------------------------------------------------------
+
+// parserReset()
+// Prepares p to parse a new request head starting at offset 0.
+void parserReset(httpParser *p) {
+    p->state = P_METHOD;
+    p->pos = 0;
+    p->tokStart = 0;
+}
+
+// parseRequestHead()
+// Continues parsing buf[0, len) where the last call stopped, filling req.
+parseResult parseRequestHead(httpParser *p, const char *buf, int len, httpRequest *req) {
+    if (p->pos == 0) {
+        req->nHeaders = 0;
+        req->headLen = 0;
+    }
+
+    for (; p->pos < len; p->pos++) {
+        char ch = buf[p->pos];
+        int tokLen = p->pos - p->tokStart;
+
+        switch (p->state) {
+        case P_METHOD:
+            if (isAlpha(ch) && tokLen < MAX_METHOD) {
+                continue;
+            }
+            if (ch == ' ' && tokLen > 0) {
+                req->method = slice(p->tokStart, p->pos);
+                p->tokStart = p->pos + 1;
+                p->state = P_URI;
+                continue;
+            }
+            return PARSE_ERROR;
+
+        case P_URI:
+            // A '/' followed by 2 to 63 name characters
+            if (tokLen == 0) {
+                if (ch == '/') {
+                    continue;
+                }
+                return PARSE_ERROR;
+            }
+            if (isTokenChar(ch) && tokLen < MAX_URI) {
+                continue;
+            }
+            if (ch == ' ' && tokLen >= 3) {
+                req->uri = slice(p->tokStart, p->pos);
+                p->tokStart = p->pos + 1;
+                p->state = P_VERSION;
+                continue;
+            }
+            return PARSE_ERROR;
+
+        case P_VERSION:
+            // HTTP/[0-9].[0-9]
+            if (tokLen < 5 && ch == "HTTP/"[tokLen]) {
+                continue;
+            }
+            if ((tokLen == 5 || tokLen == 7) && isDigit(ch)) {
+                continue;
+            }
+            if (tokLen == 6 && ch == '.') {
+                continue;
+            }
+            if (tokLen == 8 && ch == '\r') {
+                req->version = slice(p->tokStart, p->pos);
+                p->state = P_REQUEST_LF;
+                continue;
+            }
+            return PARSE_ERROR;
+
+        case P_REQUEST_LF:
+        case P_VALUE_LF:
+            if (ch != '\n') {
+                return PARSE_ERROR;
+            }
+            p->state = P_HEADER;
+            continue;
+
+        case P_HEADER:
+            if (ch == '\r') {
+                p->state = P_END_LF;
+                continue;
+            }
+            if (isTokenChar(ch)) {
+                p->tokStart = p->pos;
+                p->state = P_KEY;
+                continue;
+            }
+            return PARSE_ERROR;
+
+        case P_KEY:
+            if (isTokenChar(ch) && tokLen < MAX_KEY) {
+                continue;
+            }
+            if (ch == ':') {
+                // A header that isn't recorded could still be one that
+                // decides where the body ends
+                if (req->nHeaders == MAX_HEADERS) {
+                    return PARSE_TOO_MANY_HEADERS;
+                }
+                req->headerNames[req->nHeaders] = slice(p->tokStart, p->pos);
+                p->state = P_KEY_SPACE;
+                continue;
+            }
+            return PARSE_ERROR;
+
+        case P_KEY_SPACE:
+            if (ch != ' ') {
+                return PARSE_ERROR;
+            }
+            p->tokStart = p->pos + 1;
+            p->state = P_VALUE;
+            continue;
+
+        case P_VALUE:
+            if (ch == '\r' && tokLen > 0) {
+                req->headerValues[req->nHeaders] = slice(p->tokStart, p->pos);
+                req->nHeaders += 1;
+                p->state = P_VALUE_LF;
+                continue;
+            }
+            if (ch != '\r' && ch != '\n' && tokLen < MAX_VALUE) {
+                continue;
+            }
+            return PARSE_ERROR;
+
+        case P_END_LF:
+            if (ch != '\n') {
+                return PARSE_ERROR;
+            }
+            p->pos += 1;
+            req->headLen = p->pos;
+            return PARSE_DONE;
+        }
+    }
+    return PARSE_INCOMPLETE;
+}
+
+// Ranges ---------------------------------------------------------------------
+
+// parseByteRanges()
+// Resolves "bytes=first-last, first-, -suffix, ..." against a file of size
+// bytes. Ranges starting past the end are skipped, ends past it are cut.
+int parseByteRanges(const char *buf, strSlice s, off_t size, byteRange *ranges, int max) {
+    int pos = s.off;
+    int end = s.off + s.len;
+    if (s.len < 6 || strncasecmp(buf + pos, "bytes=", 6) != 0) {
+        return RANGES_IGNORED;
+    }
+    pos += 6;
+
+    int n = 0;
+    bool any = false;
+    while (pos < end) {
+        skipSpaces(buf, &pos, end);
+        if (pos < end && buf[pos] == ',') {
+            pos += 1;
+            continue;
+        }
+        if (pos == end) {
+            break;
+        }
+
+        off_t first;
+        off_t last;
+        if (buf[pos] == '-') {
+            // The last "suffix" bytes
+            pos += 1;
+            off_t suffix;
+            if (!readNumber(buf, &pos, end, &suffix)) {
+                return RANGES_IGNORED;
+            }
+            first = suffix < size ? size - suffix : 0;
+            last = suffix > 0 ? size - 1 : -1;
+        } else {
+            if (!readNumber(buf, &pos, end, &first) || pos == end || buf[pos] != '-') {
+                return RANGES_IGNORED;
+            }
+            pos += 1;
+            if (!readNumber(buf, &pos, end, &last)) {
+                last = size - 1;
+            } else if (last < first) {
+                return RANGES_IGNORED;
+            } else if (last >= size) {
+                last = size - 1;
+            }
+        }
+
+        skipSpaces(buf, &pos, end);
+        if (pos < end && buf[pos] != ',') {
+            return RANGES_IGNORED;
+        }
+        any = true;
+
+        if (first <= last && first < size) {
+            if (n == max) {
+                return RANGES_IGNORED;
+            }
+            ranges[n].first = first;
+            ranges[n].last = last;
+            n += 1;
+        }
+    }
+    return any ? n : RANGES_IGNORED;
+}
+
+// Chunked bodies -------------------------------------------------------------
+
+// Chunk decoder states
+enum {
+    C_SIZE,
+    C_EXT,
+    C_SIZE_LF,
+    C_DATA,
+    C_DATA_CR,
+    C_DATA_LF,
+    C_TRAILER,
+    C_TRAILER_LF,
+    C_DONE
+};
+
+static int hexValue(char ch) {
+    if (isDigit(ch)) {
+        return ch - '0';
+    }
+    if (ch >= 'a' && ch <= 'f') {
+        return ch - 'a' + 10;
+    }
+    if (ch >= 'A' && ch <= 'F') {
+        return ch - 'A' + 10;
+    }
+    return -1;
+}
+
+// chunkReset()
+// Prepares d to decode a new chunked body.
+void chunkReset(chunkDecoder *d) {
+    d->state = C_SIZE;
+    d->lineLen = 0;
+    d->size = 0;
+    d->remaining = 0;
+}
+
+// chunkFraming()
+// Consumes framing from buf[0, len) until chunk data is due.
+int chunkFraming(chunkDecoder *d, const char *buf, int len) {
+    int pos = 0;
+    while (pos < len && d->state != C_DONE) {
+        char ch = buf[pos];
+        if (d->state == C_DATA) {
+            if (d->remaining > 0) {
+                return pos;
+            }
+            d->state = C_DATA_CR;
+        }
+
+        d->lineLen += 1;
+        if (d->lineLen > MAX_CHUNK_LINE) {
+            return -1;
+        }
+
+        switch (d->state) {
+        case C_SIZE:
+            if (hexValue(ch) >= 0 && d->size < MAX_RANGE_VALUE / 16) {
+                d->size = d->size * 16 + hexValue(ch);
+                break;
+            }
+            if (d->lineLen == 1) {
+                return -1;
+            }
+            if (ch == '\r') {
+                d->state = C_SIZE_LF;
+                break;
+            }
+            if (ch == ';' || ch == ' ' || ch == '\t') {
+                d->state = C_EXT;
+                break;
+            }
+            return -1;
+
+        case C_EXT:
+            // Chunk extensions are skipped
+            if (ch == '\r') {
+                d->state = C_SIZE_LF;
+            } else if (ch == '\n') {
+                return -1;
+            }
+            break;
+
+        case C_SIZE_LF:
+            if (ch != '\n') {
+                return -1;
+            }
+            d->lineLen = 0;
+            d->remaining = d->size;
+            d->size = 0;
+            d->state = d->remaining > 0 ? C_DATA : C_TRAILER;
+            break;
+
+        case C_DATA_CR:
+            if (ch != '\r') {
+                return -1;
+            }
+            d->state = C_DATA_LF;
+            break;
+
+        case C_DATA_LF:
+            if (ch != '\n') {
+                return -1;
+            }
+            d->lineLen = 0;
+            d->state = C_SIZE;
+            break;
+
+        case C_TRAILER:
+            // Trailer fields are skipped, an empty line ends the body
+            if (ch == '\r') {
+                d->state = C_TRAILER_LF;
+            } else if (ch == '\n') {
+                return -1;
+            }
+            break;
+
+        case C_TRAILER_LF:
+            if (ch != '\n') {
+                return -1;
+            }
+            d->state = d->lineLen == 2 ? C_DONE : C_TRAILER;
+            d->lineLen = 0;
+            break;
+        }
+        pos += 1;
+    }
+    return pos;
+}
+
+// chunkDone()
+// Returns true once the last chunk and trailers were decoded.
+bool chunkDone(const chunkDecoder *d) {
+    return d->state == C_DONE;
+}
+
+// Slices ---------------------------------------------------------------------
+
+// sliceIs()
+// Returns true if slice s of buf is exactly str.
+bool sliceIs(const char *buf, strSlice s, const char *str) {
+    return (int) strlen(str) == s.len && memcmp(buf + s.off, str, s.len) == 0;
+}
+
+// sliceIsCase()
+// Returns true if slice s of buf is str, ignoring ASCII case.
+bool sliceIsCase(const char *buf, strSlice s, const char *str) {
+    return (int) strlen(str) == s.len && strncasecmp(buf + s.off, str, s.len) == 0;
+}
+
+// findHeader()
+// Returns the index of the header named name (case-insensitive), or -1.
+int findHeader(const char *buf, const httpRequest *req, const char *name) {
+    for (int i = 0; i < req->nHeaders; i++) {
+        if (sliceIsCase(buf, req->headerNames[i], name)) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// countHeader()
+// Returns how many headers are named name (case-insensitive).
+static int countHeader(const char *buf, const httpRequest *req, const char *name) {
+    int n = 0;
+    for (int i = 0; i < req->nHeaders; i++) {
+        if (sliceIsCase(buf, req->headerNames[i], name)) {
+            n += 1;
+        }
+    }
+    return n;
+}
+
+// ambiguousFraming()
+// Returns true if more than one header says where the body ends.
+bool ambiguousFraming(const char *buf, const httpRequest *req) {
+    return countHeader(buf, req, "Content-Length") + countHeader(buf, req, "Transfer-Encoding")
+           > 1;
+}
@@ -0,0 +1,112 @@
+/**
+ * @File parser.h
+ *
+ * Incremental HTTP request-head parser. It works in place over the
+ * receive buffer, never allocates, and can be called again with more
+ * bytes whenever a request arrives across several reads.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+// A request head with more headers than this is refused
+#define MAX_HEADERS 32
+
+// Exported types -------------------------------------------------------------
+
+// A token of the parsed buffer, as an offset so the buffer may move
+typedef struct strSlice {
+    int off;
+    int len;
+} strSlice;
+
+typedef struct httpRequest {
+    strSlice method;
+    strSlice uri;
+    strSlice version;
+    int nHeaders;
+    strSlice headerNames[MAX_HEADERS];
+    strSlice headerValues[MAX_HEADERS];
+    int headLen; // bytes up to and including the blank line
+} httpRequest;
+
+typedef enum { PARSE_INCOMPLETE, PARSE_DONE, PARSE_ERROR, PARSE_TOO_MANY_HEADERS } parseResult;
+
+// A byte range of a file, first and last byte included
+typedef struct byteRange {
+    off_t first;
+    off_t last;
+} byteRange;
+
+// parseByteRanges() result for a Range header that is to be ignored
+#define RANGES_IGNORED -1
+
+// Incremental decoder for a chunked request body. remaining is the data
+// of the current chunk still to come; between calls to chunkFraming() the
+// caller consumes it and counts it off.
+typedef struct chunkDecoder {
+    int state;
+    int lineLen;
+    off_t size;
+    off_t remaining;
+} chunkDecoder;
+
+typedef struct httpParser {
+    int state;
+    int pos;
+    int tokStart;
+} httpParser;
+
+// parserReset()
+// Prepares p to parse a new request head starting at offset 0.
+void parserReset(httpParser *p);
+
+// parseRequestHead()
+// Continues parsing buf[0, len) where the last call stopped, filling req.
+// Returns PARSE_DONE once the blank line ending the head is seen,
+// PARSE_INCOMPLETE if more bytes are needed, PARSE_ERROR if the bytes so
+// far can't be a valid request head and PARSE_TOO_MANY_HEADERS at the
+// start of a header past MAX_HEADERS.
+parseResult parseRequestHead(httpParser *p, const char *buf, int len, httpRequest *req);
+
+// sliceIs()
+// Returns true if slice s of buf is exactly str.
+bool sliceIs(const char *buf, strSlice s, const char *str);
+
+// sliceIsCase()
+// Returns true if slice s of buf is str, ignoring ASCII case.
+bool sliceIsCase(const char *buf, strSlice s, const char *str);
+
+// findHeader()
+// Returns the index of the header named name (case-insensitive), or -1.
+int findHeader(const char *buf, const httpRequest *req, const char *name);
+
+// ambiguousFraming()
+// Returns true if the head has more than one Content-Length or
+// Transfer-Encoding, or both, so that where its body ends, and with it
+// where the next request starts, depends on which header is believed.
+bool ambiguousFraming(const char *buf, const httpRequest *req);
+
+// parseByteRanges()
+// Resolves the Range header value s of buf against a file of size bytes,
+// storing up to max satisfiable ranges in ranges. Returns how many were
+// stored, 0 if none is satisfiable, or RANGES_IGNORED if the value is
+// malformed, not in bytes or has more than max ranges, in which case the
+// whole file should be sent.
+int parseByteRanges(const char *buf, strSlice s, off_t size, byteRange *ranges, int max);
+
+// chunkReset()
+// Prepares d to decode a new chunked body.
+void chunkReset(chunkDecoder *d);
+
+// chunkFraming()
+// Consumes chunk sizes, extensions, line ends and trailers from buf[0, len)
+// until chunk data is due (d->remaining > 0), the body ended or buf ran
+// out. Returns the bytes consumed, or -1 if the framing is malformed.
+int chunkFraming(chunkDecoder *d, const char *buf, int len);
+
+// chunkDone()
+// Returns true once the last chunk and trailers were decoded.
+bool chunkDone(const chunkDecoder *d);
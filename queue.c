@@ -1,10 +1,43 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdatomic.h>
 #include <sys/types.h>
 #include <pthread.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define SPIN_TRIES 64
+
+// One slot of the lock-free ring. seq says whose turn the slot is: a
+// producer at position p may fill it when seq == p, a consumer at
+// position p may empty it when seq == p + 1.
+typedef struct slot {
+    _Atomic size_t seq;
+    void *elem;
+} slot;
+
+// Bounded MPMC ring (Vyukov). Positions only grow, the slot is pos & mask.
+// Each counter has a cache line to itself so producers and consumers
+// don't invalidate each other's lines.
+typedef struct ring {
+    size_t mask;
+    int spinTries;
+    slot *slots;
+    _Alignas(64) _Atomic size_t pushPos;
+    _Alignas(64) _Atomic size_t popPos;
+    // Futex words bumped on every push/pop, and who sleeps on them: the
+    // waiter count shifted left once, with the low bit set while a wake
+    // is already on its way to one of those waiters
+    _Alignas(64) _Atomic uint32_t pushes;
+    _Atomic uint32_t popSleepers;
+    _Alignas(64) _Atomic uint32_t pops;
+    _Atomic uint32_t pushSleepers;
+} ring;
 
 typedef struct queue {
     int head;
@@ -15,8 +48,170 @@ typedef struct queue {
     pthread_mutex_t mutex;
     pthread_cond_t empty;
     pthread_cond_t full;
+    ring *ring;
 } queue_t;
 
+// Lock-free ring ---------------------------------------------------------------
+
+static void futexWait(_Atomic uint32_t *word, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t *word) {
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+
+static void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static ring *ringNew(int size) {
+    size_t capacity = 2;
+    while (capacity < (size_t) size) {
+        capacity *= 2;
+    }
+
+    ring *r = (ring *) aligned_alloc(64, sizeof(ring));
+    assert(r != NULL);
+    r->mask = capacity - 1;
+    // Spinning only helps if the thread we wait on can run meanwhile
+    r->spinTries = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_TRIES : 0;
+    r->slots = (slot *) calloc(capacity, sizeof(slot));
+    assert(r->slots != NULL);
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&r->slots[i].seq, i);
+    }
+    atomic_init(&r->pushPos, 0);
+    atomic_init(&r->popPos, 0);
+    atomic_init(&r->pushes, 0);
+    atomic_init(&r->popSleepers, 0);
+    atomic_init(&r->pops, 0);
+    atomic_init(&r->pushSleepers, 0);
+    return r;
+}
+
+// Push without waiting, returns false if the ring is full
+static bool ringTryPush(ring *r, void *elem) {
+    size_t pos = atomic_load_explicit(&r->pushPos, memory_order_relaxed);
+    while (1) {
+        slot *s = &r->slots[pos & r->mask];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &r->pushPos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                s->elem = elem;
+                atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&r->pushPos, memory_order_relaxed);
+        }
+    }
+}
+
+// Pop without waiting, returns false if the ring is empty
+static bool ringTryPop(ring *r, void **elem) {
+    size_t pos = atomic_load_explicit(&r->popPos, memory_order_relaxed);
+    while (1) {
+        slot *s = &r->slots[pos & r->mask];
+        size_t seq = atomic_load_explicit(&s->seq, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) (pos + 1);
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(
+                    &r->popPos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed)) {
+                *elem = s->elem;
+                atomic_store_explicit(&s->seq, pos + r->mask + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&r->popPos, memory_order_relaxed);
+        }
+    }
+}
+
+#define WAKE_PENDING 1u
+#define ONE_SLEEPER  2u
+
+// Wake one sleeper if there is one and no wake is already in flight, so a
+// burst of operations costs one futex call rather than one each. The
+// pending bit is only set while someone is counted, and each counted
+// thread clears it as it leaves, so it can't stay set with nobody to
+// clear it.
+static void wakeOne(_Atomic uint32_t *events, _Atomic uint32_t *sleepers) {
+    uint32_t s = atomic_load(sleepers);
+    while (s >= ONE_SLEEPER && !(s & WAKE_PENDING)) {
+        if (atomic_compare_exchange_weak(sleepers, &s, s | WAKE_PENDING)) {
+            futexWake(events);
+            return;
+        }
+    }
+}
+
+static void leaveSleepers(_Atomic uint32_t *sleepers) {
+    uint32_t s = atomic_load(sleepers);
+    while (!atomic_compare_exchange_weak(sleepers, &s, (s - ONE_SLEEPER) & ~WAKE_PENDING)) {
+    }
+}
+
+// Run attempt until it succeeds, spinning briefly and then sleeping on the
+// futex the other side bumps. The sleeper count is raised before the last
+// attempt, so the other side either sees it and wakes us or we see its
+// element on that attempt.
+static void ringWait(bool (*attempt)(ring *, void **), ring *r, void **elem,
+    _Atomic uint32_t *events, _Atomic uint32_t *sleepers) {
+    for (int i = 0; i < r->spinTries; i++) {
+        if (attempt(r, elem)) {
+            return;
+        }
+        cpuRelax();
+    }
+    while (1) {
+        atomic_fetch_add(sleepers, ONE_SLEEPER);
+        uint32_t seen = atomic_load(events);
+        bool done = attempt(r, elem);
+        if (!done) {
+            futexWait(events, seen);
+        }
+        leaveSleepers(sleepers);
+        if (done) {
+            return;
+        }
+    }
+}
+
+static bool ringPushAttempt(ring *r, void **elem) {
+    return ringTryPush(r, *elem);
+}
+
+// Both sides pass a wake along when they leave work behind, since one
+// pending wake only reaches one of several sleepers.
+static void ringPush(ring *r, void *elem) {
+    ringWait(ringPushAttempt, r, &elem, &r->pops, &r->pushSleepers);
+    atomic_fetch_add(&r->pushes, 1);
+    wakeOne(&r->pushes, &r->popSleepers);
+    if (atomic_load(&r->pushPos) - atomic_load(&r->popPos) <= r->mask) {
+        wakeOne(&r->pops, &r->pushSleepers);
+    }
+}
+
+static void ringPop(ring *r, void **elem) {
+    ringWait(ringTryPop, r, elem, &r->pushes, &r->popSleepers);
+    atomic_fetch_add(&r->pops, 1);
+    wakeOne(&r->pops, &r->pushSleepers);
+    if (atomic_load(&r->pushPos) != atomic_load(&r->popPos)) {
+        wakeOne(&r->pushes, &r->popSleepers);
+    }
+}
+
+// Queue ----------------------------------------------------------------------
+
 // Dynamically allocates and initializes a new queue with a
 // maximum size, size
 // @param size the maximum size of the queue
@@ -28,6 +223,7 @@ queue_t *queue_new(int size) {
     q->len = 0;
     q->maxSize = size;
     q->buffer = (void **) calloc(size, sizeof(void *));
+    q->ring = NULL;
 
     int rc;
     rc = pthread_mutex_init(&(q->mutex), NULL);
@@ -39,12 +235,26 @@ queue_t *queue_new(int size) {
     return q;
 }
 
+// Dynamically allocates and initializes a new lock-free queue holding
+// at least size elements
+// @param size the minimum capacity, rounded up to a power of two
+// @return a pointer to a new queue_t
+queue_t *queue_new_lockfree(int size) {
+    queue_t *q = queue_new(1);
+    q->ring = ringNew(size);
+    return q;
+}
+
 //  Delete your queue and free all of its memory.
 //  @param q the queue to be deleted.  Note, you should assign the
 //  passed in pointer to NULL when returning (i.e., you should set
 //  *q = NULL after deallocation).
 void queue_delete(queue_t **q) {
     if (*q != NULL) {
+        if ((*q)->ring != NULL) {
+            free((*q)->ring->slots);
+            free((*q)->ring);
+        }
         pthread_mutex_destroy(&((*q)->mutex));
         pthread_cond_destroy(&((*q)->empty));
         pthread_cond_destroy(&((*q)->full));
@@ -63,6 +273,10 @@ bool queue_push(queue_t *q, void *elem) {
     if (q == NULL) {
         return false;
     }
+    if (q->ring != NULL) {
+        ringPush(q->ring, elem);
+        return true;
+    }
 
     pthread_mutex_lock(&(q->mutex));
     while (q->len == q->maxSize) {
@@ -87,6 +301,10 @@ bool queue_pop(queue_t *q, void **elem) {
     if (q == NULL) {
         return false;
     }
+    if (q->ring != NULL) {
+        ringPop(q->ring, elem);
+        return true;
+    }
 
     pthread_mutex_lock(&(q->mutex));
     while (q->len == 0) {
@@ -28,6 +28,19 @@ typedef struct queue queue_t;
  */
 queue_t *queue_new(int size);
 
+/** @brief Dynamically allocates and initializes a new lock-free queue
+ *         holding at least size elements. Pushes and pops on it never
+ *         take a lock; a thread only sleeps (on a futex) when the queue
+ *         is full for a push or empty for a pop. Every other queue_
+ *         function works on it unchanged.
+ *
+ *  @param size the minimum capacity of the queue, rounded up to a power
+ *         of two
+ *
+ *  @return a pointer to a new queue_t
+ */
+queue_t *queue_new_lockfree(int size);
+
 /** @brief Delete your queue and free all of its memory.
  *
  *  @param q the queue to be deleted.  Note, you should assign the
@@ -1,10 +1,43 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <stdatomic.h>
 #include <pthread.h>
 #include <semaphore.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "rwlock.h"
+
+#define SPIN_TRIES 64
+
+// The futex lock's state word: a bit for the writer holding the lock,
+// then fields counting, in units of their lowest bit, the readers holding
+// it, the writers and readers asleep waiting for it, and for N_WAY the
+// readers let in since the last writer left
+#define RW_WRITER      (1ULL << 0)
+#define RW_READER      (1ULL << 1)
+#define RW_WAIT_WRITER (1ULL << 17)
+#define RW_WAIT_READER (1ULL << 33)
+#define RW_TURN        (1ULL << 49)
+#define RW_MAX_FIELD   0xffffULL
+#define RW_MAX_TURNS   0x7fffULL
+#define RW_WAITERS     ((RW_TURN - 1) & ~(RW_WAIT_WRITER - 1))
+
+// private futexRw type, the lock behind rwlock_new_futex()
+typedef struct futexRw {
+    _Atomic uint64_t state;
+    // Bumped before every wake so a thread about to sleep notices it missed one
+    _Atomic uint32_t reader_seq;
+    _Atomic uint32_t writer_seq;
+    uint64_t max_turns; // N, as far as the state word can count
+} futexRw;
 
 typedef struct rwlock {
     int priority;
@@ -17,9 +50,248 @@ typedef struct rwlock {
     pthread_cond_t reader;
     pthread_cond_t writer;
     pthread_mutex_t mutex;
+    rwlockStats *stats; // NULL unless rwlock_track() was called
+    long read_start;    // when the current readers' hold began
+    long write_start;   // when the current writer took the lock
+    futexRw *futex;     // NULL for the mutex lock
 } rwlock_t;
 
-typedef enum { READERS, WRITERS, N_WAY } PRIORITY;
+// Statistics -----------------------------------------------------------------
+
+// Counted atomically, the futex lock has no mutex to count them under
+
+static long nowNs(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static void addTo(long *field, long n) {
+    __atomic_fetch_add(field, n, __ATOMIC_RELAXED);
+}
+
+static void raiseTo(long *field, long n) {
+    long current = __atomic_load_n(field, __ATOMIC_RELAXED);
+    while (n > current
+           && !__atomic_compare_exchange_n(
+               field, &current, n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+static void noteWait(rwlockStats *s, bool writer, long ns) {
+    addTo(&s->contended[writer], 1);
+    addTo(&s->waitNs[writer], ns);
+    raiseTo(&s->maxWaitNs[writer], ns);
+}
+
+// Count an acquisition, waitStart is 0 if it didn't have to wait. first
+// says a reader found no other reader holding the lock.
+static void noteAcquired(rwlock_t *rw, bool writer, long waitStart, bool first) {
+    long now = nowNs();
+    addTo(&rw->stats->acquired[writer], 1);
+    if (waitStart != 0) {
+        noteWait(rw->stats, writer, now - waitStart);
+    }
+    if (writer || first) {
+        __atomic_store_n(writer ? &rw->write_start : &rw->read_start, now, __ATOMIC_RELAXED);
+    }
+}
+
+static long holdStart(rwlock_t *rw, bool writer) {
+    return __atomic_load_n(writer ? &rw->write_start : &rw->read_start, __ATOMIC_RELAXED);
+}
+
+// Count the end of a hold that began at start
+static void noteHeld(rwlock_t *rw, bool writer, long start) {
+    long held = nowNs() - start;
+    addTo(&rw->stats->heldNs[writer], held);
+    raiseTo(&rw->stats->maxHeldNs[writer], held);
+}
+
+// Count the end of a hold, for readers only once the last one left
+static void noteReleased(rwlock_t *rw, bool writer) {
+    noteHeld(rw, writer, holdStart(rw, writer));
+}
+
+// Futex lock -----------------------------------------------------------------
+
+static int spinTries;
+static pthread_once_t spinOnce = PTHREAD_ONCE_INIT;
+
+// Spinning only helps if the thread we wait on can run meanwhile
+static void initSpinTries(void) {
+    spinTries = sysconf(_SC_NPROCESSORS_ONLN) > 1 ? SPIN_TRIES : 0;
+}
+
+static void futexWait(_Atomic uint32_t *word, uint32_t expected) {
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+static void futexWake(_Atomic uint32_t *word, int n) {
+    atomic_fetch_add(word, 1);
+    syscall(SYS_futex, (uint32_t *) word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+
+static void cpuRelax(void) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+}
+
+static uint64_t field(uint64_t state, uint64_t unit) {
+    return (state / unit) & RW_MAX_FIELD;
+}
+
+// The same conditions the mutex lock waits on, read off the state word
+static bool canRead(rwlock_t *rw, uint64_t s) {
+    if ((s & RW_WRITER) || field(s, RW_READER) == RW_MAX_FIELD) {
+        return false;
+    }
+    bool writersWait = field(s, RW_WAIT_WRITER) > 0;
+    if (rw->priority == WRITERS) {
+        return !writersWait;
+    }
+    if (rw->priority == N_WAY) {
+        return !(writersWait && field(s, RW_TURN) >= rw->futex->max_turns);
+    }
+    return true;
+}
+
+static bool canWrite(rwlock_t *rw, uint64_t s) {
+    if ((s & RW_WRITER) || field(s, RW_READER) > 0) {
+        return false;
+    }
+    // After a writer, readers that waited for it go first
+    return !(rw->priority == N_WAY && field(s, RW_WAIT_READER) > 0 && field(s, RW_TURN) == 0);
+}
+
+// Wake whoever the state now lets in, in the policy's order of preference.
+// Anyone left asleep is still blocked by a holder whose release wakes again.
+static void wakeWaiters(rwlock_t *rw, uint64_t s) {
+    futexRw *f = rw->futex;
+    bool readers = field(s, RW_WAIT_READER) > 0 && canRead(rw, s);
+    bool writer = field(s, RW_WAIT_WRITER) > 0 && canWrite(rw, s);
+    if (readers && (rw->priority != WRITERS || !writer)) {
+        // N_WAY only lets N readers past a waiting writer, so only wake N
+        bool turns = rw->priority == N_WAY && field(s, RW_WAIT_WRITER) > 0;
+        futexWake(&f->reader_seq, turns ? (int) f->max_turns : INT_MAX);
+    } else if (writer) {
+        futexWake(&f->writer_seq, 1);
+    }
+}
+
+// Take the lock once acquirable(state) holds: retry the state word with
+// one compare-and-swap while it does, spin a while when it doesn't, and
+// then count ourselves in its waiting field and sleep until woken.
+// Returns the state the lock was taken from.
+static uint64_t futexAcquire(rwlock_t *rw, bool writer, long *waitStart) {
+    futexRw *f = rw->futex;
+    bool (*acquirable)(rwlock_t *, uint64_t) = writer ? canWrite : canRead;
+    uint64_t waitUnit = writer ? RW_WAIT_WRITER : RW_WAIT_READER;
+    _Atomic uint32_t *seq = writer ? &f->writer_seq : &f->reader_seq;
+    bool waiting = false;
+    int spins = 0;
+
+    uint64_t s = atomic_load(&f->state);
+    while (1) {
+        if (acquirable(rw, s)) {
+            uint64_t next = s + (writer ? RW_WRITER : RW_READER) - (waiting ? waitUnit : 0);
+            if (!writer && rw->priority == N_WAY && field(s, RW_TURN) < f->max_turns) {
+                next += RW_TURN;
+            }
+            if (atomic_compare_exchange_weak(&f->state, &s, next)) {
+                return s;
+            }
+            continue;
+        }
+
+        if (rw->stats != NULL && *waitStart == 0) {
+            *waitStart = nowNs();
+        }
+        if (spins < spinTries) {
+            spins++;
+            cpuRelax();
+            s = atomic_load(&f->state);
+        } else if (!waiting) {
+            waiting = atomic_compare_exchange_weak(&f->state, &s, s + waitUnit);
+        } else {
+            // Whoever changes the state after this read bumps seq too, so
+            // the futex won't put us to sleep past it
+            uint32_t seen = atomic_load(seq);
+            s = atomic_load(&f->state);
+            if (!acquirable(rw, s)) {
+                futexWait(seq, seen);
+                s = atomic_load(&f->state);
+            }
+        }
+    }
+}
+
+// Take the lock only if it is acquirable right now
+static bool futexTry(rwlock_t *rw, bool writer, uint64_t *from) {
+    futexRw *f = rw->futex;
+    uint64_t s = atomic_load(&f->state);
+    while (writer ? canWrite(rw, s) : canRead(rw, s)) {
+        uint64_t next = s + (writer ? RW_WRITER : RW_READER);
+        if (!writer && rw->priority == N_WAY && field(s, RW_TURN) < f->max_turns) {
+            next += RW_TURN;
+        }
+        if (atomic_compare_exchange_weak(&f->state, &s, next)) {
+            *from = s;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void futexReaderLock(rwlock_t *rw) {
+    long waitStart = 0;
+    uint64_t from = futexAcquire(rw, false, &waitStart);
+    if (rw->stats != NULL) {
+        noteAcquired(rw, false, waitStart, field(from, RW_READER) == 0);
+    }
+}
+
+static void futexReaderUnlock(rwlock_t *rw) {
+    // The hold's start can't change while we are still in it, but once we
+    // are out a new first reader may restart it
+    long start = rw->stats != NULL ? holdStart(rw, false) : 0;
+    uint64_t s = atomic_fetch_sub(&rw->futex->state, RW_READER) - RW_READER;
+
+    // Only the last reader out ends the hold
+    if (rw->stats != NULL && field(s, RW_READER) == 0) {
+        noteHeld(rw, false, start);
+    }
+    if (s & RW_WAITERS) {
+        wakeWaiters(rw, s);
+    }
+}
+
+static void futexWriterLock(rwlock_t *rw) {
+    long waitStart = 0;
+    futexAcquire(rw, true, &waitStart);
+    if (rw->stats != NULL) {
+        noteAcquired(rw, true, waitStart, false);
+    }
+}
+
+// Leaving resets the N_WAY turns, so readers that waited get their turn
+static void futexWriterUnlock(rwlock_t *rw) {
+    if (rw->stats != NULL) {
+        noteReleased(rw, true);
+    }
+    futexRw *f = rw->futex;
+    uint64_t s = atomic_load(&f->state);
+    uint64_t next;
+    do {
+        next = (s - RW_WRITER) & (RW_TURN - 1);
+    } while (!atomic_compare_exchange_weak(&f->state, &s, next));
+    if (next & RW_WAITERS) {
+        wakeWaiters(rw, next);
+    }
+}
+
+// rwlock ---------------------------------------------------------------------
 
 //  Dynamically allocates and initializes a new rwlock with
 //  priority p, and, if using N_WAY priority, n.
@@ -46,11 +318,28 @@ rwlock_t *rwlock_new(PRIORITY p, uint32_t n) {
     return rw;
 }
 
+//  Dynamically allocates and initializes a new futex rwlock with
+//  priority p, and, if using N_WAY priority, n.
+//  @return a pointer to a new rwlock_t
+rwlock_t *rwlock_new_futex(PRIORITY p, uint32_t n) {
+    pthread_once(&spinOnce, initSpinTries);
+    rwlock_t *rw = rwlock_new(p, n);
+    rw->futex = (futexRw *) aligned_alloc(64, 64);
+    assert(rw->futex != NULL);
+    atomic_init(&rw->futex->state, 0);
+    atomic_init(&rw->futex->reader_seq, 0);
+    atomic_init(&rw->futex->writer_seq, 0);
+    rw->futex->max_turns = n < 1 ? 1 : (n > RW_MAX_TURNS ? RW_MAX_TURNS : n);
+    return rw;
+}
+
 //  Delete your rwlock and free all of its memory.
 //  @param rw the rwlock to be deleted.  Note, you should assign the
 //  passed in pointer to NULL when returning (i.e., you should set *rw
 //  = NULL after deallocation).
 void rwlock_delete(rwlock_t **rw) {
+    free((*rw)->futex);
+    free((*rw)->stats);
     pthread_mutex_destroy(&((*rw)->mutex));
     pthread_cond_destroy(&(*rw)->reader);
     pthread_cond_destroy(&(*rw)->writer);
@@ -60,28 +349,75 @@ void rwlock_delete(rwlock_t **rw) {
 
 // acquire rw for reading
 void reader_lock(rwlock_t *rw) {
+    if (rw->futex != NULL) {
+        futexReaderLock(rw);
+        return;
+    }
     pthread_mutex_lock(&(rw->mutex));
     rw->wait_rders += 1;
+    long waitStart = 0;
     while ((rw->priority == WRITERS && rw->wait_wrs > 0)
            || (rw->priority == N_WAY && rw->curr_N >= rw->N && rw->wait_wrs > 0)
            || rw->curr_wrs > 0) {
+        if (rw->stats != NULL && waitStart == 0) {
+            waitStart = nowNs();
+        }
         pthread_cond_wait(&(rw->reader), &(rw->mutex));
     }
     rw->curr_N += 1;
     rw->wait_rders -= 1;
     rw->curr_rders += 1;
+    if (rw->stats != NULL) {
+        noteAcquired(rw, false, waitStart, rw->curr_rders == 1);
+    }
     pthread_mutex_unlock(&(rw->mutex));
 }
 
+// acquire rw for reading if no wait is needed, returns true on success
+bool reader_trylock(rwlock_t *rw) {
+    uint64_t from;
+    if (rw->futex != NULL) {
+        bool acquired = futexTry(rw, false, &from);
+        if (acquired && rw->stats != NULL) {
+            noteAcquired(rw, false, 0, field(from, RW_READER) == 0);
+        }
+        return acquired;
+    }
+    pthread_mutex_lock(&(rw->mutex));
+    bool acquired = !((rw->priority == WRITERS && rw->wait_wrs > 0)
+                      || (rw->priority == N_WAY && rw->curr_N >= rw->N && rw->wait_wrs > 0)
+                      || rw->curr_wrs > 0);
+    if (acquired) {
+        rw->curr_N += 1;
+        rw->curr_rders += 1;
+        if (rw->stats != NULL) {
+            noteAcquired(rw, false, 0, rw->curr_rders == 1);
+        }
+    }
+    pthread_mutex_unlock(&(rw->mutex));
+    return acquired;
+}
+
 // release rw for reading--you can assume that the thread
 // releasing the lock has *already* acquired it for reading.
 void reader_unlock(rwlock_t *rw) {
+    if (rw->futex != NULL) {
+        futexReaderUnlock(rw);
+        return;
+    }
     pthread_mutex_lock(&(rw->mutex));
     rw->curr_rders -= 1;
+    if (rw->stats != NULL && rw->curr_rders == 0) {
+        noteReleased(rw, false);
+    }
     if (rw->priority == N_WAY) {
         if (rw->curr_rders == 0) {
             pthread_cond_signal(&(rw->writer));
         }
+        // Readers only held back for fairness go once no writer waits
+        if (rw->wait_wrs == 0 && rw->wait_rders > 0) {
+            pthread_cond_broadcast(&(rw->reader));
+        }
     } else if (rw->priority == READERS) {
         if (rw->curr_rders == 0) {
             pthread_cond_signal(&(rw->writer));
@@ -96,25 +432,69 @@ void reader_unlock(rwlock_t *rw) {
 
 // acquire rw for writing
 void writer_lock(rwlock_t *rw) {
+    if (rw->futex != NULL) {
+        futexWriterLock(rw);
+        return;
+    }
     pthread_mutex_lock(&(rw->mutex));
     rw->wait_wrs += 1;
+    long waitStart = 0;
     while (rw->curr_rders > 0 || rw->curr_wrs > 0
            || (rw->priority == N_WAY && rw->wait_rders > 0 && rw->curr_N == 0)) {
+        if (rw->stats != NULL && waitStart == 0) {
+            waitStart = nowNs();
+        }
         pthread_cond_wait(&(rw->writer), &(rw->mutex));
     }
     rw->wait_wrs -= 1;
     rw->curr_wrs += 1;
+    if (rw->stats != NULL) {
+        noteAcquired(rw, true, waitStart, false);
+    }
+    pthread_mutex_unlock(&(rw->mutex));
+}
+
+// acquire rw for writing if no wait is needed, returns true on success
+bool writer_trylock(rwlock_t *rw) {
+    uint64_t from;
+    if (rw->futex != NULL) {
+        bool acquired = futexTry(rw, true, &from);
+        if (acquired && rw->stats != NULL) {
+            noteAcquired(rw, true, 0, false);
+        }
+        return acquired;
+    }
+    pthread_mutex_lock(&(rw->mutex));
+    bool acquired = !(rw->curr_rders > 0 || rw->curr_wrs > 0
+                      || (rw->priority == N_WAY && rw->wait_rders > 0 && rw->curr_N == 0));
+    if (acquired) {
+        rw->curr_wrs += 1;
+        if (rw->stats != NULL) {
+            noteAcquired(rw, true, 0, false);
+        }
+    }
     pthread_mutex_unlock(&(rw->mutex));
+    return acquired;
 }
 
 // release rw for writing--you can assume that the thread
 // releasing the lock has *already* acquired it for writing.
 void writer_unlock(rwlock_t *rw) {
+    if (rw->futex != NULL) {
+        futexWriterUnlock(rw);
+        return;
+    }
     pthread_mutex_lock(&(rw->mutex));
     rw->curr_wrs -= 1;
     rw->curr_N = 0;
+    if (rw->stats != NULL) {
+        noteReleased(rw, true);
+    }
     if (rw->priority == N_WAY) {
-        if (rw->wait_rders > 0) {
+        if (rw->wait_rders > 0 && rw->wait_wrs == 0) {
+            // Nobody to take turns with, so every waiting reader may go
+            pthread_cond_broadcast(&(rw->reader));
+        } else if (rw->wait_rders > 0) {
             for (int i = 0; i < rw->N; i += 1) {
                 pthread_cond_signal(&(rw->reader));
             }
@@ -136,3 +516,80 @@ void writer_unlock(rwlock_t *rw) {
     }
     pthread_mutex_unlock(&(rw->mutex));
 }
+
+// Count the caller as a waiting writer or reader that retries the trylock
+void rwlock_wait_begin(rwlock_t *rw, bool writer) {
+    if (rw->futex != NULL) {
+        atomic_fetch_add(&rw->futex->state, writer ? RW_WAIT_WRITER : RW_WAIT_READER);
+        return;
+    }
+    pthread_mutex_lock(&(rw->mutex));
+    if (writer) {
+        rw->wait_wrs += 1;
+    } else {
+        rw->wait_rders += 1;
+    }
+    pthread_mutex_unlock(&(rw->mutex));
+}
+
+// Stop counting the caller as waiting. Readers held back for a writer, or
+// a writer held back for readers' turn, may be free to go now.
+void rwlock_wait_end(rwlock_t *rw, bool writer) {
+    if (rw->futex != NULL) {
+        uint64_t unit = writer ? RW_WAIT_WRITER : RW_WAIT_READER;
+        uint64_t s = atomic_fetch_sub(&rw->futex->state, unit) - unit;
+        if (s & RW_WAITERS) {
+            wakeWaiters(rw, s);
+        }
+        return;
+    }
+    pthread_mutex_lock(&(rw->mutex));
+    if (writer) {
+        rw->wait_wrs -= 1;
+        if (rw->wait_rders > 0) {
+            pthread_cond_broadcast(&(rw->reader));
+        }
+    } else {
+        rw->wait_rders -= 1;
+        if (rw->wait_wrs > 0) {
+            pthread_cond_signal(&(rw->writer));
+        }
+    }
+    pthread_mutex_unlock(&(rw->mutex));
+}
+
+// Start keeping contention statistics for rw, before it is shared
+void rwlock_track(rwlock_t *rw) {
+    rwlockStats *stats = (rwlockStats *) calloc(1, sizeof(rwlockStats));
+    assert(stats != NULL);
+    pthread_mutex_lock(&(rw->mutex));
+    if (rw->stats == NULL) {
+        rw->stats = stats;
+        stats = NULL;
+    }
+    pthread_mutex_unlock(&(rw->mutex));
+    free(stats);
+}
+
+// Copy rw's statistics, all zero if rw isn't tracked
+void rwlock_stats(rwlock_t *rw, rwlockStats *stats) {
+    pthread_mutex_lock(&(rw->mutex));
+    if (rw->stats != NULL) {
+        // The futex lock counts without the mutex
+        long *from = (long *) rw->stats;
+        long *to = (long *) stats;
+        for (size_t i = 0; i < sizeof(rwlockStats) / sizeof(long); i++) {
+            to[i] = __atomic_load_n(&from[i], __ATOMIC_RELAXED);
+        }
+    } else {
+        memset(stats, 0, sizeof(*stats));
+    }
+    pthread_mutex_unlock(&(rw->mutex));
+}
+
+// Count a wait the caller measured across trylock retries
+void rwlock_waited(rwlock_t *rw, bool writer, long ns) {
+    if (rw->stats != NULL) {
+        noteWait(rw->stats, writer, ns);
+    }
+}
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include <stdbool.h>
 #include <stdint.h>
 
 /** @struct rwlock_t
@@ -20,6 +21,20 @@ typedef struct rwlock rwlock_t;
 
 typedef enum { READERS, WRITERS, N_WAY } PRIORITY;
 
+/** @struct rwlockStats
+ *
+ *  @brief Contention statistics of one rwlock, every pair indexed by
+ *  [false] for readers and [true] for writers. Times are nanoseconds.
+ */
+typedef struct rwlockStats {
+    long acquired[2];  // acquisitions
+    long contended[2]; // acquisitions that had to wait
+    long waitNs[2];    // total time spent waiting
+    long maxWaitNs[2];
+    long heldNs[2]; // total time held, for readers from the first one in to the last one out
+    long maxHeldNs[2];
+} rwlockStats;
+
 /** @brief Dynamically allocates and initializes a new rwlock with
  *         priority p, and, if using N_WAY priority, n.
  *
@@ -31,6 +46,20 @@ typedef enum { READERS, WRITERS, N_WAY } PRIORITY;
  */
 rwlock_t *rwlock_new(PRIORITY p, uint32_t n);
 
+/** @brief Dynamically allocates and initializes a new rwlock with the
+ *         same priorities as rwlock_new, kept in one atomic state word.
+ *         Taking or releasing it uncontended is one atomic instruction;
+ *         a thread that has to wait spins briefly and then sleeps on a
+ *         futex. Every other rwlock function works on it unchanged.
+ *
+ *  @param The priority of the rwlock
+ *
+ *  @param The n value, if using N_WAY priority, at most 32767
+ *
+ *  @return a pointer to a new rwlock_t
+ */
+rwlock_t *rwlock_new_futex(PRIORITY p, uint32_t n);
+
 /** @brief Delete your rwlock and free all of its memory.
  *
  *  @param rw the rwlock to be deleted.  Note, you should assign the
@@ -56,3 +85,46 @@ void writer_lock(rwlock_t *rw);
  * releasing the lock has *already* acquired it for writing.
  */
 void writer_unlock(rwlock_t *rw);
+
+/** @brief acquire rw for reading only if that can be done without
+ *  waiting.
+ *
+ *  @return true if the lock was acquired, false otherwise.
+ */
+bool reader_trylock(rwlock_t *rw);
+
+/** @brief acquire rw for writing only if that can be done without
+ *  waiting.
+ *
+ *  @return true if the lock was acquired, false otherwise.
+ */
+bool writer_trylock(rwlock_t *rw);
+
+/** @brief Count the caller among the writers (or readers) waiting for rw
+ *  without blocking, for a caller that retries the trylock later instead.
+ *  The lock's priority then holds back the other side for it as it would
+ *  for a thread asleep in writer_lock() or reader_lock(). Every call must
+ *  be matched by one rwlock_wait_end(), once the trylock succeeded or the
+ *  caller gave up.
+ */
+void rwlock_wait_begin(rwlock_t *rw, bool writer);
+
+/** @brief Stop counting the caller as waiting for rw, waking whoever that
+ *  lets in.
+ */
+void rwlock_wait_end(rwlock_t *rw, bool writer);
+
+/** @brief Start keeping contention statistics for rw, before it is
+ *  shared with other threads. Off by default, since it costs a clock
+ *  read on every acquire and release.
+ */
+void rwlock_track(rwlock_t *rw);
+
+/** @brief Copy rw's statistics into *stats, all zero if rw isn't tracked.
+ */
+void rwlock_stats(rwlock_t *rw, rwlockStats *stats);
+
+/** @brief Count a wait the caller measured itself, for a lock it only
+ *  got after retrying the trylock. No-op if rw isn't tracked.
+ */
+void rwlock_waited(rwlock_t *rw, bool writer, long ns);
@@ -0,0 +1,107 @@
+/**
+ * @File parser_test.c
+ *
+ * Checks that the request-head parser refuses heads whose body framing
+ * could be read more than one way: headers past MAX_HEADERS, which would
+ * otherwise go unseen, and repeated or conflicting Content-Length and
+ * Transfer-Encoding headers.
+ *
+ * Usage: ./tests/parser_test
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "parser.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);                             \
+            failures += 1;                                                                         \
+        }                                                                                          \
+    } while (0)
+
+// Parse the whole head in buf in one call
+static parseResult parse(const char *buf, httpRequest *req) {
+    httpParser p;
+    parserReset(&p);
+    return parseRequestHead(&p, buf, (int) strlen(buf), req);
+}
+
+// A PUT with n "X-Pad" headers followed by the header line last
+static void paddedHead(char *buf, size_t size, int n, const char *last) {
+    int len = snprintf(buf, size, "PUT /a.txt HTTP/1.1\r\n");
+    for (int i = 0; i < n; i++) {
+        len += snprintf(buf + len, size - len, "X-Pad: %d\r\n", i);
+    }
+    snprintf(buf + len, size - len, "%s\r\n\r\n", last);
+}
+
+static void testHeaderLimit(void) {
+    char buf[4096];
+    httpRequest req;
+
+    // Exactly MAX_HEADERS still parses and keeps every header
+    paddedHead(buf, sizeof(buf), MAX_HEADERS - 1, "Content-Length: 5");
+    CHECK(parse(buf, &req) == PARSE_DONE);
+    CHECK(req.nHeaders == MAX_HEADERS);
+    CHECK(findHeader(buf, &req, "Content-Length") == MAX_HEADERS - 1);
+
+    // One more, and the framing header would have been dropped
+    paddedHead(buf, sizeof(buf), MAX_HEADERS, "Content-Length: 5");
+    CHECK(parse(buf, &req) == PARSE_TOO_MANY_HEADERS);
+    paddedHead(buf, sizeof(buf), MAX_HEADERS, "Transfer-Encoding: chunked");
+    CHECK(parse(buf, &req) == PARSE_TOO_MANY_HEADERS);
+
+    // Refused as soon as the extra header's name ends, before the blank line
+    paddedHead(buf, sizeof(buf), MAX_HEADERS, "Content-Length: 5");
+    char *extra = strstr(buf, "Content-Length:");
+    httpParser p;
+    parserReset(&p);
+    CHECK(parseRequestHead(&p, buf, (int) (extra - buf) + 15, &req) == PARSE_TOO_MANY_HEADERS);
+}
+
+static void testFraming(void) {
+    httpRequest req;
+    const char *head;
+
+    head = "PUT /a.txt HTTP/1.1\r\nContent-Length: 5\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && !ambiguousFraming(head, &req));
+
+    head = "PUT /a.txt HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && !ambiguousFraming(head, &req));
+
+    head = "GET /a.txt HTTP/1.1\r\nHost: x\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && !ambiguousFraming(head, &req));
+
+    // Duplicates, conflicting or not, and in any case
+    head = "PUT /a.txt HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 50\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && ambiguousFraming(head, &req));
+
+    head = "PUT /a.txt HTTP/1.1\r\nContent-Length: 5\r\ncontent-length: 5\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && ambiguousFraming(head, &req));
+
+    head = "PUT /a.txt HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+           "Transfer-Encoding: chunked\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && ambiguousFraming(head, &req));
+
+    // Both kinds, in either order
+    head = "PUT /a.txt HTTP/1.1\r\nContent-Length: 5\r\nTransfer-Encoding: chunked\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && ambiguousFraming(head, &req));
+
+    head = "PUT /a.txt HTTP/1.1\r\nTRANSFER-ENCODING: chunked\r\nContent-Length: 5\r\n\r\n";
+    CHECK(parse(head, &req) == PARSE_DONE && ambiguousFraming(head, &req));
+}
+
+int main(void) {
+    testHeaderLimit();
+    testFraming();
+    if (failures > 0) {
+        fprintf(stderr, "parser_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("parser_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,194 @@
+/**
+ * @File rwlock_test.c
+ *
+ * Checks how N_WAY locks hand over to waiting readers, for the mutex lock
+ * and the futex lock: with no writer waiting every waiting reader must be
+ * let in once the writer leaves, and with one waiting only N readers go
+ * before it.
+ *
+ * Usage: ./tests/rwlock_test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include "rwlock.h"
+
+#define READERS_WAITING 3
+#define SETTLE_MS       100 // long enough for a woken thread to take the lock
+#define DEADLINE_MS     2000
+
+static int failures = 0;
+
+#define CHECK(cond)                                                                                \
+    do {                                                                                           \
+        if (!(cond)) {                                                                             \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);                             \
+            failures += 1;                                                                         \
+        }                                                                                          \
+    } while (0)
+
+typedef struct lockTest {
+    rwlock_t *rw;
+    int failures;            // failures before the test began
+    _Atomic int readersIn;   // readers that took the lock
+    _Atomic int readersDone; // readers that released it again
+    _Atomic int writersIn;
+    sem_t release; // posted once for each holder the test lets go
+} lockTest;
+
+static void sleepMs(long ms) {
+    struct timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+    nanosleep(&ts, NULL);
+}
+
+// Wait up to DEADLINE_MS for *counter to reach n
+static bool reaches(_Atomic int *counter, int n) {
+    for (long waited = 0; waited < DEADLINE_MS; waited += 10) {
+        if (atomic_load(counter) >= n) {
+            return true;
+        }
+        sleepMs(10);
+    }
+    return atomic_load(counter) >= n;
+}
+
+// Take the lock for reading and hold it until the test posts release
+static void *reader(void *args) {
+    lockTest *t = (lockTest *) args;
+    reader_lock(t->rw);
+    atomic_fetch_add(&t->readersIn, 1);
+    sem_wait(&t->release);
+    reader_unlock(t->rw);
+    atomic_fetch_add(&t->readersDone, 1);
+    return NULL;
+}
+
+// Take the lock for writing and hold it until the test posts release
+static void *writer(void *args) {
+    lockTest *t = (lockTest *) args;
+    writer_lock(t->rw);
+    atomic_fetch_add(&t->writersIn, 1);
+    sem_wait(&t->release);
+    writer_unlock(t->rw);
+    return NULL;
+}
+
+static lockTest *setUp(rwlock_t *rw) {
+    lockTest *t = (lockTest *) malloc(sizeof(lockTest));
+    t->rw = rw;
+    t->failures = failures;
+    atomic_store(&t->readersIn, 0);
+    atomic_store(&t->readersDone, 0);
+    atomic_store(&t->writersIn, 0);
+    sem_init(&t->release, 0, 0);
+    return t;
+}
+
+static void tearDown(lockTest *t, pthread_t *threads, int n) {
+    // A reader that was never woken would never be joined, so after a
+    // failure the threads, and what they use, are left until the test exits
+    if (failures > t->failures) {
+        return;
+    }
+    // Whatever still holds or waits gets let go, so every thread ends
+    for (int i = 0; i < n; i++) {
+        sem_post(&t->release);
+    }
+    for (int i = 0; i < n; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    sem_destroy(&t->release);
+    rwlock_delete(&t->rw);
+    free(t);
+}
+
+// A writer leaves while readers wait and no other writer does: all of
+// them go, not just the N the writer wakes for their turn
+static void testReadersAfterLastWriter(rwlock_t *rw) {
+    lockTest *t = setUp(rw);
+    writer_lock(rw);
+    pthread_t threads[READERS_WAITING];
+    for (int i = 0; i < READERS_WAITING; i++) {
+        pthread_create(&threads[i], NULL, reader, t);
+    }
+    sleepMs(SETTLE_MS);
+    CHECK(atomic_load(&t->readersIn) == 0);
+
+    writer_unlock(rw);
+    CHECK(reaches(&t->readersIn, READERS_WAITING));
+    tearDown(t, threads, READERS_WAITING);
+}
+
+// Readers let in one at a time still finish when the last reader leaves
+// without any writer waiting
+static void testReadersAfterLastReader(rwlock_t *rw) {
+    lockTest *t = setUp(rw);
+    writer_lock(rw);
+    pthread_t threads[READERS_WAITING];
+    for (int i = 0; i < READERS_WAITING; i++) {
+        pthread_create(&threads[i], NULL, reader, t);
+    }
+    sleepMs(SETTLE_MS);
+    writer_unlock(rw);
+    for (int i = 0; i < READERS_WAITING; i++) {
+        sem_post(&t->release);
+    }
+    CHECK(reaches(&t->readersDone, READERS_WAITING));
+    tearDown(t, threads, READERS_WAITING);
+}
+
+// With a writer waiting, only N = 1 reader goes after the first writer,
+// then the waiting writer, then the remaining readers
+static void testTurnsWithWriterWaiting(rwlock_t *rw) {
+    lockTest *t = setUp(rw);
+    writer_lock(rw);
+    pthread_t threads[READERS_WAITING + 1];
+    for (int i = 0; i < READERS_WAITING; i++) {
+        pthread_create(&threads[i], NULL, reader, t);
+    }
+    sleepMs(SETTLE_MS);
+    pthread_create(&threads[READERS_WAITING], NULL, writer, t);
+    sleepMs(SETTLE_MS);
+
+    writer_unlock(rw);
+    CHECK(reaches(&t->readersIn, 1));
+    sleepMs(SETTLE_MS);
+    CHECK(atomic_load(&t->readersIn) == 1);
+    CHECK(atomic_load(&t->writersIn) == 0);
+
+    // The reader leaves, the waiting writer is next
+    sem_post(&t->release);
+    CHECK(reaches(&t->writersIn, 1));
+    CHECK(atomic_load(&t->readersIn) == 1);
+
+    // The writer leaves with no writer left waiting, the rest go
+    sem_post(&t->release);
+    CHECK(reaches(&t->readersIn, READERS_WAITING));
+    tearDown(t, threads, READERS_WAITING + 1);
+}
+
+static void runAll(const char *name, rwlock_t *(*newLock)(PRIORITY, uint32_t)) {
+    int before = failures;
+    testReadersAfterLastWriter(newLock(N_WAY, 1));
+    testReadersAfterLastReader(newLock(N_WAY, 1));
+    testTurnsWithWriterWaiting(newLock(N_WAY, 1));
+    if (failures > before) {
+        fprintf(stderr, "rwlock_test: %s lock failed\n", name);
+    }
+}
+
+int main(void) {
+    runAll("mutex", rwlock_new);
+    runAll("futex", rwlock_new_futex);
+    if (failures > 0) {
+        fprintf(stderr, "rwlock_test: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("rwlock_test: ok\n");
+    return 0;
+}
@@ -0,0 +1,201 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "uring.h"
+
+// Kernel features the event loop relies on: a wait with a timeout in the
+// same call as the submit, and no completions lost on overflow
+#define NEEDED_FEATURES (IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP | IORING_FEAT_SINGLE_MMAP)
+
+typedef struct uring {
+    int fd;
+    void *rings;
+    size_t ringsSize;
+    struct io_uring_sqe *sqes;
+    size_t sqesSize;
+
+    // Submission queue, the kernel consumes entries from *sqHead
+    _Atomic unsigned *sqHead;
+    _Atomic unsigned *sqTail;
+    unsigned sqMask;
+    unsigned sqEntries;
+    unsigned sqQueued; // local tail, published to *sqTail on submit
+
+    // Completion queue, the kernel produces entries up to *cqTail
+    _Atomic unsigned *cqHead;
+    _Atomic unsigned *cqTail;
+    unsigned cqMask;
+    struct io_uring_cqe *cqes;
+} uring_t;
+
+// Helper Functions -----------------------------------------------------------
+
+static int uringSetup(unsigned entries, struct io_uring_params *p) {
+    return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int uringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags, void *arg,
+    size_t argSize) {
+    return (int) syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, arg, argSize);
+}
+
+// Entries written by uring_sqe() that the kernel hasn't consumed yet
+static unsigned pending(uring_t *r) {
+    return r->sqQueued - atomic_load_explicit(r->sqHead, memory_order_acquire);
+}
+
+// Publish the queued entries to the kernel's view of the tail
+static void publish(uring_t *r) {
+    atomic_store_explicit(r->sqTail, r->sqQueued, memory_order_release);
+}
+
+// uring_supported() ----------------------------------------------------------
+
+bool uring_supported(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = uringSetup(4, &p);
+    if (fd < 0) {
+        return false;
+    }
+
+    bool ok = (p.features & NEEDED_FEATURES) == NEEDED_FEATURES;
+    size_t size = sizeof(struct io_uring_probe) + 256 * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe *probe = calloc(1, size);
+    assert(probe != NULL);
+    if (ok && syscall(__NR_io_uring_register, fd, IORING_REGISTER_PROBE, probe, 256) == 0) {
+        const int ops[] = { IORING_OP_ACCEPT, IORING_OP_RECV, IORING_OP_POLL_ADD,
+            IORING_OP_LINK_TIMEOUT, IORING_OP_CLOSE, IORING_OP_READ };
+        for (size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++) {
+            if (ops[i] > probe->last_op || !(probe->ops[ops[i]].flags & IO_URING_OP_SUPPORTED)) {
+                ok = false;
+            }
+        }
+    } else {
+        ok = false;
+    }
+    free(probe);
+    close(fd);
+    return ok;
+}
+
+// Constructors-Destructors ---------------------------------------------------
+
+uring_t *uring_new(unsigned entries) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = uringSetup(entries, &p);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    uring_t *r = malloc(sizeof(uring_t));
+    assert(r != NULL);
+    r->fd = fd;
+
+    // With IORING_FEAT_SINGLE_MMAP both queues share one mapping
+    size_t sqSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    size_t cqSize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    r->ringsSize = sqSize > cqSize ? sqSize : cqSize;
+    r->rings = mmap(NULL, r->ringsSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        IORING_OFF_SQ_RING);
+    r->sqesSize = p.sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd,
+        IORING_OFF_SQES);
+    if (r->rings == MAP_FAILED || r->sqes == MAP_FAILED) {
+        int err = errno;
+        if (r->rings != MAP_FAILED) {
+            munmap(r->rings, r->ringsSize);
+        }
+        close(fd);
+        free(r);
+        errno = err;
+        return NULL;
+    }
+
+    char *base = r->rings;
+    r->sqHead = (_Atomic unsigned *) (base + p.sq_off.head);
+    r->sqTail = (_Atomic unsigned *) (base + p.sq_off.tail);
+    r->sqMask = *(unsigned *) (base + p.sq_off.ring_mask);
+    r->sqEntries = p.sq_entries;
+    r->sqQueued = atomic_load(r->sqTail);
+    r->cqHead = (_Atomic unsigned *) (base + p.cq_off.head);
+    r->cqTail = (_Atomic unsigned *) (base + p.cq_off.tail);
+    r->cqMask = *(unsigned *) (base + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) (base + p.cq_off.cqes);
+
+    // Slot i of the submission array always names entry i
+    unsigned *array = (unsigned *) (base + p.sq_off.array);
+    for (unsigned i = 0; i < p.sq_entries; i++) {
+        array[i] = i;
+    }
+    return r;
+}
+
+void uring_delete(uring_t **r) {
+    if (*r == NULL) {
+        return;
+    }
+    munmap((*r)->sqes, (*r)->sqesSize);
+    munmap((*r)->rings, (*r)->ringsSize);
+    close((*r)->fd);
+    free(*r);
+    *r = NULL;
+}
+
+// Manipulation procedures ----------------------------------------------------
+
+void uring_reserve(uring_t *r, unsigned n) {
+    while (pending(r) + n > r->sqEntries) {
+        publish(r);
+        if (uringEnter(r->fd, pending(r), 0, 0, NULL, 0) < 0 && errno != EINTR
+            && errno != EAGAIN && errno != EBUSY) {
+            return;
+        }
+    }
+}
+
+struct io_uring_sqe *uring_sqe(uring_t *r) {
+    uring_reserve(r, 1);
+    struct io_uring_sqe *sqe = &r->sqes[r->sqQueued & r->sqMask];
+    r->sqQueued += 1;
+    memset(sqe, 0, sizeof(*sqe));
+    return sqe;
+}
+
+int uring_wait(uring_t *r, int timeoutMs) {
+    struct __kernel_timespec ts = { .tv_sec = timeoutMs / 1000,
+        .tv_nsec = (timeoutMs % 1000) * 1000000L };
+    struct io_uring_getevents_arg arg = { .sigmask = 0,
+        .sigmask_sz = _NSIG / 8,
+        .ts = timeoutMs < 0 ? 0 : (unsigned long long) (uintptr_t) &ts };
+
+    publish(r);
+    unsigned flags = IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+    if (uringEnter(r->fd, pending(r), 1, flags, &arg, sizeof(arg)) < 0) {
+        return -errno;
+    }
+    return 0;
+}
+
+struct io_uring_cqe *uring_peek(uring_t *r) {
+    unsigned head = atomic_load_explicit(r->cqHead, memory_order_relaxed);
+    if (head == atomic_load_explicit(r->cqTail, memory_order_acquire)) {
+        return NULL;
+    }
+    return &r->cqes[head & r->cqMask];
+}
+
+void uring_seen(uring_t *r) {
+    unsigned head = atomic_load_explicit(r->cqHead, memory_order_relaxed);
+    atomic_store_explicit(r->cqHead, head + 1, memory_order_release);
+}
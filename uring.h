@@ -0,0 +1,63 @@
+/**
+ * @File uring.h
+ *
+ * Minimal io_uring ring, set up and driven with the raw system calls so
+ * the server needs no liburing. One ring belongs to one thread.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <linux/io_uring.h>
+
+/** @struct uring_t
+ *
+ *  @brief A submission and completion queue pair mapped from the kernel.
+ */
+typedef struct uring uring_t;
+
+/** @brief Check whether the running kernel lets this process use io_uring
+ *  with every operation the io_uring event loop submits.
+ */
+bool uring_supported(void);
+
+/** @brief Dynamically allocates a new ring.
+ *
+ *  @param entries submission queue size, a power of two
+ *
+ *  @return a pointer to a new uring_t, or NULL with errno set if the
+ *  kernel refused to create it
+ */
+uring_t *uring_new(unsigned entries);
+
+/** @brief Tear down the ring, free all of its memory and set *r = NULL.
+ */
+void uring_delete(uring_t **r);
+
+/** @brief Make room for n more submissions, submitting the queued ones
+ *  if the queue is too full. Linked submissions must be reserved
+ *  together so they go to the kernel in the same batch.
+ */
+void uring_reserve(uring_t *r, unsigned n);
+
+/** @brief Take the next submission queue entry, zeroed. Queued entries
+ *  are only submitted by uring_wait() or uring_reserve().
+ */
+struct io_uring_sqe *uring_sqe(uring_t *r);
+
+/** @brief Submit every queued entry and wait for at least one completion,
+ *  all in one system call.
+ *
+ *  @param timeoutMs longest wait in milliseconds, -1 for no limit
+ *
+ *  @return 0, or -errno if the wait was interrupted or failed
+ */
+int uring_wait(uring_t *r, int timeoutMs);
+
+/** @brief Next completion to handle, or NULL if there is none yet.
+ */
+struct io_uring_cqe *uring_peek(uring_t *r);
+
+/** @brief Hand the completion returned by uring_peek() back to the ring.
+ */
+void uring_seen(uring_t *r);
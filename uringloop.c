@@ -0,0 +1,231 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <assert.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include "asgn2_helper_funcs.h"
+#include "config.h"
+#include "connection.h"
+#include "uring.h"
+#include "uringloop.h"
+
+#define RING_ENTRIES 256
+
+// user_data of completions that don't belong to a connection
+#define ACCEPT_TAG  1
+#define TIMEOUT_TAG 2
+#define CLOSE_TAG   3
+#define WAKE_TAG    4
+
+// Structs --------------------------------------------------------------------
+
+// private uringConn type, a connection as the loop sees it
+typedef struct uringConn {
+    Conn conn;
+    int fd;
+    bool receiving;
+    bool parked;
+    struct uringConn *nextParked;
+} uringConn;
+
+// private uringLoop type
+typedef struct uringLoop {
+    uring_t *ring;
+    int listenFd;
+    bool multishotAccept;
+    int wakeFd; // written to when a parked connection may go on
+    uint64_t wakes;
+    uringConn *parked;
+    struct __kernel_timespec idle; // waiting for a request head
+    struct __kernel_timespec send; // in the middle of a request
+} uringLoop;
+
+// Helper Functions -----------------------------------------------------------
+
+// Queue an accept on the listening socket. A multishot accept keeps
+// completing with new connections until the kernel says it stopped.
+static void armAccept(uringLoop *loop) {
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = loop->listenFd;
+    sqe->accept_flags = SOCK_NONBLOCK;
+    sqe->ioprio = loop->multishotAccept ? IORING_ACCEPT_MULTISHOT : 0;
+    sqe->user_data = ACCEPT_TAG;
+}
+
+// Queue a read of the wake eventfd, which completes once a lock or group
+// commit a parked connection waits on may be ready
+static void armWake(uringLoop *loop) {
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = loop->wakeFd;
+    sqe->addr = (uint64_t) (uintptr_t) &loop->wakes;
+    sqe->len = sizeof(loop->wakes);
+    sqe->user_data = WAKE_TAG;
+}
+
+// Queue op for uc with a timeout linked to it, so a client that goes quiet
+// has the op cancelled without the loop keeping any timers. The timeout is
+// the idle one between requests and the send one within a request.
+static struct io_uring_sqe *waitOn(uringLoop *loop, uringConn *uc, int op) {
+    uring_reserve(loop->ring, 2);
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+    sqe->opcode = op;
+    sqe->fd = uc->fd;
+    sqe->flags = IOSQE_IO_LINK;
+    sqe->user_data = (uint64_t) (uintptr_t) uc;
+
+    struct io_uring_sqe *timeout = uring_sqe(loop->ring);
+    timeout->opcode = IORING_OP_LINK_TIMEOUT;
+    timeout->fd = -1;
+    timeout->addr
+        = (uint64_t) (uintptr_t) (connAwaitingRequest(uc->conn) ? &loop->idle : &loop->send);
+    timeout->len = 1;
+    timeout->user_data = TIMEOUT_TAG;
+    return sqe;
+}
+
+// Stop serving uc and queue the close of its socket
+static void closeUringConn(uringLoop *loop, uringConn *uc) {
+    struct io_uring_sqe *sqe = uring_sqe(loop->ring);
+    sqe->opcode = IORING_OP_CLOSE;
+    sqe->fd = releaseConn(&uc->conn);
+    sqe->user_data = CLOSE_TAG;
+    free(uc);
+}
+
+// Advance uc and queue whatever it waits on next. The bytes of a request
+// head are received by the ring straight into the connection's buffer,
+// anything else waits for readiness and is left to the connection.
+static void drive(uringLoop *loop, uringConn *uc) {
+    switch (connAdvance(uc->conn)) {
+    case CONN_WANT_READ: {
+        size_t len;
+        char *buf = connRecvSpace(uc->conn, &len);
+        if (buf != NULL) {
+            struct io_uring_sqe *sqe = waitOn(loop, uc, IORING_OP_RECV);
+            sqe->addr = (uint64_t) (uintptr_t) buf;
+            sqe->len = (unsigned) len;
+            uc->receiving = true;
+        } else {
+            waitOn(loop, uc, IORING_OP_POLL_ADD)->poll32_events = POLLIN;
+        }
+        break;
+    }
+    case CONN_WANT_WRITE: waitOn(loop, uc, IORING_OP_POLL_ADD)->poll32_events = POLLOUT; break;
+    case CONN_WANT_LOCK:
+        uc->parked = true;
+        uc->nextParked = loop->parked;
+        loop->parked = uc;
+        break;
+    case CONN_CLOSE: closeUringConn(loop, uc); break;
+    }
+}
+
+// Start serving a connection the ring accepted
+static void accepted(uringLoop *loop, int fd) {
+    uringConn *uc = malloc(sizeof(uringConn));
+    assert(uc != NULL);
+    uc->conn = newConn(fd, true, loop->wakeFd);
+    uc->fd = fd;
+    uc->receiving = false;
+    uc->parked = false;
+    uc->nextParked = NULL;
+    drive(loop, uc);
+}
+
+// Give every parked connection another try at its lock or group commit
+static void retryParked(uringLoop *loop) {
+    uringConn *uc = loop->parked;
+    loop->parked = NULL;
+    while (uc != NULL) {
+        uringConn *next = uc->nextParked;
+        uc->parked = false;
+        drive(loop, uc);
+        uc = next;
+    }
+}
+
+// Act on one completion
+static void complete(uringLoop *loop, const struct io_uring_cqe *cqe) {
+    if (cqe->user_data == ACCEPT_TAG) {
+        if (cqe->res >= 0) {
+            accepted(loop, cqe->res);
+        } else if (cqe->res == -EINVAL && loop->multishotAccept) {
+            // Kernel too old for multishot accept, take one at a time
+            loop->multishotAccept = false;
+        } else if (cqe->res != -EAGAIN && cqe->res != -EINTR) {
+            fprintf(stderr, "Err: %s\n", strerror(-cqe->res));
+        }
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            armAccept(loop);
+        }
+        return;
+    }
+    if (cqe->user_data == WAKE_TAG) {
+        armWake(loop);
+        retryParked(loop);
+        return;
+    }
+    if (cqe->user_data == TIMEOUT_TAG || cqe->user_data == CLOSE_TAG) {
+        return;
+    }
+
+    uringConn *uc = (uringConn *) (uintptr_t) cqe->user_data;
+    if (cqe->res == -ECANCELED) {
+        // The linked timeout fired first
+        connTimedOut(uc->conn);
+        closeUringConn(loop, uc);
+        return;
+    }
+
+    // End of stream and errors are left for the connection's own read
+    // to run into again, it already knows how to answer them
+    if (uc->receiving && cqe->res > 0) {
+        connReceived(uc->conn, (size_t) cqe->res);
+    }
+    uc->receiving = false;
+    drive(loop, uc);
+}
+
+// uring_worker_thread()
+// Runs an io_uring loop over the Listener_Socket passed in args.
+void *uring_worker_thread(void *args) {
+    Listener_Socket *socket = (Listener_Socket *) args;
+    uringLoop loop = { .ring = uring_new(RING_ENTRIES),
+        .listenFd = socket->fd,
+        .multishotAccept = true,
+        .wakeFd = eventfd(0, EFD_CLOEXEC),
+        .parked = NULL,
+        .idle = { .tv_sec = config.idleTimeout, .tv_nsec = 0 },
+        .send = { .tv_sec = config.sendTimeout, .tv_nsec = 0 } };
+    if (loop.ring == NULL) {
+        fprintf(stderr, "io_uring_setup error\n");
+        exit(1);
+    }
+    if (loop.wakeFd < 0) {
+        fprintf(stderr, "eventfd error\n");
+        exit(1);
+    }
+
+    armAccept(&loop);
+    armWake(&loop);
+    while (1) {
+        // One system call submits everything queued since the last one
+        // and collects a batch of completions
+        uring_wait(loop.ring, -1);
+        struct io_uring_cqe *cqe;
+        while ((cqe = uring_peek(loop.ring)) != NULL) {
+            struct io_uring_cqe done = *cqe;
+            uring_seen(loop.ring);
+            complete(&loop, &done);
+        }
+    }
+    return args;
+}
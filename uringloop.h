@@ -0,0 +1,15 @@
+/**
+ * @File uringloop.h
+ *
+ * io_uring worker. Like the epoll worker each one multiplexes all of its
+ * connections on one thread, but accepts, request reads, readiness waits
+ * and closes are queued on its ring and submitted in one batch per loop
+ * iteration.
+ */
+
+#pragma once
+
+// uring_worker_thread()
+// Runs an io_uring loop over the Listener_Socket passed in args. Only
+// started after uring_supported() said yes. Never returns.
+void *uring_worker_thread(void *args);
@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <assert.h>
+#include "rwlock.h"
+#include "uritable.h"
+#include "wakelist.h"
+
+#define INITIAL_BUCKETS 16
+#define MAX_LOAD        2
+#define STATS_BUCKETS   64
+#define MAX_TRACKED     256 // per shard, URIs past it go unreported
+
+// Lock statistics of a URI, kept after its entry is removed so that a
+// report covers URIs that aren't in use at the moment too
+typedef struct uriStats {
+    char uri[65];
+    uint32_t hash;
+    rwlockStats totals;     // summed from the URI's removed entries
+    struct uriEntry *entry; // the URI's entry while it has one
+    struct uriStats *next;
+} uriStats;
+
+typedef struct uriEntry {
+    char uri[65];
+    uint32_t hash;
+    int refs;
+    rwlock_t *rw;
+    wakeList parked; // loops with connections waiting for rw, under the shard's mutex
+    uriStats *stats;
+    struct uriEntry *next;
+} uriEntry_t;
+
+// Each shard sits on its own cache line so shards don't contend
+typedef struct shard {
+    _Alignas(64) pthread_mutex_t mutex;
+    uriEntry_t **buckets;
+    int nBuckets;
+    int count;
+    uriStats **tracked; // STATS_BUCKETS chains, NULL without lockStats
+    int nTracked;
+} shard;
+
+typedef struct uriTable {
+    int nShards;
+    shard *shards;
+    bool futexLocks;
+    bool lockStats;
+} uriTable_t;
+
+//  FNV-1a hash of a URI, shared by the tables keyed on URIs.
+uint32_t uritable_hash(const char *uri) {
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) uri; *p != '\0'; p++) {
+        h ^= *p;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// The low bits of a hash pick the shard, the rest pick the bucket
+static shard *shardFor(uriTable_t *t, uint32_t hash) {
+    return &t->shards[hash & (t->nShards - 1)];
+}
+
+static uriEntry_t **bucketFor(uriTable_t *t, shard *s, uint32_t hash) {
+    return &s->buckets[(hash / t->nShards) & (s->nBuckets - 1)];
+}
+
+// Double a shard's bucket array once its chains get long, shard is locked
+static void grow(uriTable_t *t, shard *s) {
+    int oldBuckets = s->nBuckets;
+    uriEntry_t **old = s->buckets;
+    s->nBuckets = oldBuckets * 2;
+    s->buckets = (uriEntry_t **) calloc(s->nBuckets, sizeof(uriEntry_t *));
+    assert(s->buckets != NULL);
+    for (int i = 0; i < oldBuckets; i++) {
+        uriEntry_t *e = old[i];
+        while (e != NULL) {
+            uriEntry_t *next = e->next;
+            uriEntry_t **bucket = bucketFor(t, s, e->hash);
+            e->next = *bucket;
+            *bucket = e;
+            e = next;
+        }
+    }
+    free(old);
+}
+
+// The statistics kept for uri, created if there is room, shard is locked
+static uriStats *statsFor(uriTable_t *t, shard *s, const char *uri, uint32_t hash) {
+    uriStats **chain = &s->tracked[(hash / t->nShards) & (STATS_BUCKETS - 1)];
+    uriStats *st = *chain;
+    while (st != NULL && (st->hash != hash || strcmp(st->uri, uri) != 0)) {
+        st = st->next;
+    }
+    if (st == NULL && s->nTracked < MAX_TRACKED) {
+        st = (uriStats *) calloc(1, sizeof(uriStats));
+        assert(st != NULL);
+        strcpy(st->uri, uri);
+        st->hash = hash;
+        st->next = *chain;
+        *chain = st;
+        s->nTracked += 1;
+    }
+    return st;
+}
+
+static void addStats(rwlockStats *sum, const rwlockStats *more) {
+    for (int i = 0; i < 2; i++) {
+        sum->acquired[i] += more->acquired[i];
+        sum->contended[i] += more->contended[i];
+        sum->waitNs[i] += more->waitNs[i];
+        sum->heldNs[i] += more->heldNs[i];
+        if (more->maxWaitNs[i] > sum->maxWaitNs[i]) {
+            sum->maxWaitNs[i] = more->maxWaitNs[i];
+        }
+        if (more->maxHeldNs[i] > sum->maxHeldNs[i]) {
+            sum->maxHeldNs[i] = more->maxHeldNs[i];
+        }
+    }
+}
+
+static long totalWait(const rwlockStats *stats) {
+    return stats->waitNs[0] + stats->waitNs[1];
+}
+
+//  Dynamically allocates and initializes a new table.
+//  @param nShards the number of independently locked shards
+//  @param futexLocks whether URIs get futex rwlocks
+//  @param lockStats whether to keep contention statistics per URI
+//  @return a pointer to a new uriTable_t
+uriTable_t *uritable_new(int nShards, bool futexLocks, bool lockStats) {
+    int n = 1;
+    while (n < nShards) {
+        n *= 2;
+    }
+
+    uriTable_t *t = (uriTable_t *) calloc(1, sizeof(uriTable_t));
+    assert(t != NULL);
+    t->nShards = n;
+    t->futexLocks = futexLocks;
+    t->lockStats = lockStats;
+    t->shards = (shard *) aligned_alloc(64, n * sizeof(shard));
+    assert(t->shards != NULL);
+    for (int i = 0; i < n; i++) {
+        int rc = pthread_mutex_init(&(t->shards[i].mutex), NULL);
+        assert(!rc);
+        t->shards[i].nBuckets = INITIAL_BUCKETS;
+        t->shards[i].buckets = (uriEntry_t **) calloc(INITIAL_BUCKETS, sizeof(uriEntry_t *));
+        assert(t->shards[i].buckets != NULL);
+        t->shards[i].count = 0;
+        t->shards[i].tracked = NULL;
+        t->shards[i].nTracked = 0;
+        if (lockStats) {
+            t->shards[i].tracked = (uriStats **) calloc(STATS_BUCKETS, sizeof(uriStats *));
+            assert(t->shards[i].tracked != NULL);
+        }
+    }
+    return t;
+}
+
+//  Delete the table and every entry still in it.
+void uritable_delete(uriTable_t **t) {
+    if (*t != NULL) {
+        for (int i = 0; i < (*t)->nShards; i++) {
+            shard *s = &(*t)->shards[i];
+            for (int b = 0; b < s->nBuckets; b++) {
+                uriEntry_t *e = s->buckets[b];
+                while (e != NULL) {
+                    uriEntry_t *next = e->next;
+                    rwlock_delete(&e->rw);
+                    wakelist_free(&e->parked);
+                    free(e);
+                    e = next;
+                }
+            }
+            for (int b = 0; s->tracked != NULL && b < STATS_BUCKETS; b++) {
+                uriStats *st = s->tracked[b];
+                while (st != NULL) {
+                    uriStats *next = st->next;
+                    free(st);
+                    st = next;
+                }
+            }
+            free(s->tracked);
+            free(s->buckets);
+            pthread_mutex_destroy(&(s->mutex));
+        }
+        free((*t)->shards);
+        free(*t);
+    }
+    *t = NULL;
+}
+
+//  Look up uri, adding it if absent, and take a reference on it.
+uriEntry_t *uritable_acquire(uriTable_t *t, const char *uri) {
+    uint32_t hash = uritable_hash(uri);
+    shard *s = shardFor(t, hash);
+
+    pthread_mutex_lock(&(s->mutex));
+    uriEntry_t **bucket = bucketFor(t, s, hash);
+    uriEntry_t *e = *bucket;
+    while (e != NULL && (e->hash != hash || strcmp(e->uri, uri) != 0)) {
+        e = e->next;
+    }
+
+    if (e == NULL) {
+        e = (uriEntry_t *) malloc(sizeof(uriEntry_t));
+        assert(e != NULL);
+        strncpy(e->uri, uri, sizeof(e->uri) - 1);
+        e->uri[sizeof(e->uri) - 1] = '\0';
+        e->hash = hash;
+        e->refs = 0;
+        e->rw = t->futexLocks ? rwlock_new_futex(N_WAY, 1) : rwlock_new(N_WAY, 1);
+        wakelist_init(&e->parked);
+        e->stats = NULL;
+        if (t->lockStats) {
+            rwlock_track(e->rw);
+            e->stats = statsFor(t, s, uri, hash);
+            if (e->stats != NULL) {
+                e->stats->entry = e;
+            }
+        }
+        e->next = *bucket;
+        *bucket = e;
+        s->count += 1;
+        if (s->count > MAX_LOAD * s->nBuckets) {
+            grow(t, s);
+        }
+    }
+    e->refs += 1;
+    pthread_mutex_unlock(&(s->mutex));
+    return e;
+}
+
+//  Drop a reference taken by uritable_acquire, removing the entry once
+//  nobody holds it.
+void uritable_release(uriTable_t *t, uriEntry_t *e) {
+    shard *s = shardFor(t, e->hash);
+
+    pthread_mutex_lock(&(s->mutex));
+    e->refs -= 1;
+    if (e->refs == 0) {
+        uriEntry_t **link = bucketFor(t, s, e->hash);
+        while (*link != e) {
+            link = &(*link)->next;
+        }
+        *link = e->next;
+        s->count -= 1;
+        if (e->stats != NULL) {
+            // Keep what the lock saw before it goes away with the entry
+            rwlockStats last;
+            rwlock_stats(e->rw, &last);
+            addStats(&e->stats->totals, &last);
+            e->stats->entry = NULL;
+        }
+    } else {
+        e = NULL;
+    }
+    pthread_mutex_unlock(&(s->mutex));
+
+    if (e != NULL) {
+        rwlock_delete(&e->rw);
+        wakelist_free(&e->parked);
+        free(e);
+    }
+}
+
+//  The reader/writer lock guarding the file behind e.
+rwlock_t *uritable_rwlock(uriEntry_t *e) {
+    return e->rw;
+}
+
+//  Have wakeFd written to the next time e's lock may have become free.
+void uritable_park(uriTable_t *t, uriEntry_t *e, int wakeFd) {
+    shard *s = shardFor(t, e->hash);
+    pthread_mutex_lock(&(s->mutex));
+    wakelist_add(&e->parked, wakeFd);
+    pthread_mutex_unlock(&(s->mutex));
+}
+
+//  Wake the loops parked on e, after its lock was released. Unparked
+//  entries cost one atomic load.
+void uritable_wake(uriTable_t *t, uriEntry_t *e) {
+    if (!wakelist_pending(&e->parked)) {
+        return;
+    }
+    shard *s = shardFor(t, e->hash);
+    pthread_mutex_lock(&(s->mutex));
+    wakelist_wake(&e->parked);
+    pthread_mutex_unlock(&(s->mutex));
+}
+
+//  Find the URIs whose locks were waited on longest, filling top with up
+//  to n of them, longest total wait first.
+int uritable_contended(uriTable_t *t, uriLockStats *top, int n) {
+    int found = 0;
+    for (int i = 0; t->lockStats && i < t->nShards; i++) {
+        shard *s = &t->shards[i];
+        pthread_mutex_lock(&(s->mutex));
+        for (int b = 0; b < STATS_BUCKETS; b++) {
+            for (uriStats *st = s->tracked[b]; st != NULL; st = st->next) {
+                uriLockStats candidate;
+                strcpy(candidate.uri, st->uri);
+                candidate.lock = st->totals;
+                if (st->entry != NULL) {
+                    rwlockStats live;
+                    rwlock_stats(st->entry->rw, &live);
+                    addStats(&candidate.lock, &live);
+                }
+                if (candidate.lock.contended[0] + candidate.lock.contended[1] == 0) {
+                    continue;
+                }
+
+                // Insertion into the sorted top n
+                int at = found < n ? found++ : n;
+                while (at > 0 && totalWait(&top[at - 1].lock) < totalWait(&candidate.lock)) {
+                    if (at < n) {
+                        top[at] = top[at - 1];
+                    }
+                    at--;
+                }
+                if (at < n) {
+                    top[at] = candidate;
+                }
+            }
+        }
+        pthread_mutex_unlock(&(s->mutex));
+    }
+    return found;
+}
@@ -0,0 +1,94 @@
+/**
+ * @File uritable.h
+ *
+ * Concurrent registry of the per-URI reader/writer locks. URIs hash to
+ * one of several independently locked shards, and a lookup hands back a
+ * refcounted entry whose rwlock is used directly until it is released.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "rwlock.h"
+
+/** @struct uriTable_t
+ *
+ *  @brief The sharded hash table of URIs currently in use.
+ */
+typedef struct uriTable uriTable_t;
+
+/** @struct uriEntry_t
+ *
+ *  @brief A handle on one URI's entry, valid until it is released.
+ */
+typedef struct uriEntry uriEntry_t;
+
+/** @struct uriLockStats
+ *
+ *  @brief The lock statistics gathered for one URI.
+ */
+typedef struct uriLockStats {
+    char uri[65];
+    rwlockStats lock;
+} uriLockStats;
+
+/** @brief Dynamically allocates and initializes a new table.
+ *
+ *  @param nShards the number of independently locked shards, rounded up
+ *  to a power of two
+ *
+ *  @param futexLocks whether URIs get futex rwlocks instead of mutex ones
+ *
+ *  @param lockStats whether to keep contention statistics for every
+ *  URI's lock
+ *
+ *  @return a pointer to a new uriTable_t
+ */
+uriTable_t *uritable_new(int nShards, bool futexLocks, bool lockStats);
+
+/** @brief Delete the table and every entry still in it, sets *t = NULL.
+ */
+void uritable_delete(uriTable_t **t);
+
+/** @brief Look up uri, adding it if absent, and take a reference on it.
+ *
+ *  @return the entry for uri, which stays in the table until every
+ *  reference is released
+ */
+uriEntry_t *uritable_acquire(uriTable_t *t, const char *uri);
+
+/** @brief Drop a reference taken by uritable_acquire, removing the entry
+ *  once nobody holds it.
+ */
+void uritable_release(uriTable_t *t, uriEntry_t *e);
+
+/** @brief The reader/writer lock guarding the file behind e.
+ */
+rwlock_t *uritable_rwlock(uriEntry_t *e);
+
+/** @brief Have wakeFd, an event loop's eventfd, written to the next time
+ *  uritable_wake is called on e, for a loop with a connection whose
+ *  trylock of e's rwlock failed. The connection must try the lock once
+ *  more after parking, in case it was released in between.
+ */
+void uritable_park(uriTable_t *t, uriEntry_t *e, int wakeFd);
+
+/** @brief Wake every loop parked on e, once its rwlock was released or
+ *  a waiter that held others back gave up.
+ */
+void uritable_wake(uriTable_t *t, uriEntry_t *e);
+
+/** @brief FNV-1a hash of a URI, shared by the tables keyed on URIs.
+ */
+uint32_t uritable_hash(const char *uri);
+
+/** @brief Find the URIs whose locks were waited on longest. Statistics
+ *  outlive the URI's entry, so every URI served counts, up to a fixed
+ *  number of tracked URIs.
+ *
+ *  @param top filled with up to n URIs, longest total wait first
+ *
+ *  @return the number of URIs written to top, 0 without lockStats
+ */
+int uritable_contended(uriTable_t *t, uriLockStats *top, int n);
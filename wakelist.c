@@ -0,0 +1,54 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <assert.h>
+#include "wakelist.h"
+
+#define INITIAL_FDS 4
+
+void wakelist_init(wakeList *w) {
+    w->fds = NULL;
+    atomic_init(&w->count, 0);
+    w->size = 0;
+}
+
+void wakelist_free(wakeList *w) {
+    free(w->fds);
+    wakelist_init(w);
+}
+
+// A loop is on the list at most once, so it stays as short as the number
+// of loops
+void wakelist_add(wakeList *w, int fd) {
+    int count = atomic_load(&w->count);
+    for (int i = 0; i < count; i++) {
+        if (w->fds[i] == fd) {
+            return;
+        }
+    }
+    if (count == w->size) {
+        w->size = w->size == 0 ? INITIAL_FDS : w->size * 2;
+        w->fds = (int *) realloc(w->fds, w->size * sizeof(int));
+        assert(w->fds != NULL);
+    }
+    w->fds[count] = fd;
+    atomic_store(&w->count, count + 1);
+}
+
+bool wakelist_pending(wakeList *w) {
+    return atomic_load(&w->count) > 0;
+}
+
+// An eventfd only fails a write when its counter is about to overflow,
+// and then it is readable already
+void wakelist_wake(wakeList *w) {
+    uint64_t one = 1;
+    int count = atomic_load(&w->count);
+    for (int i = 0; i < count; i++) {
+        ssize_t rc = write(w->fds[i], &one, sizeof(one));
+        (void) rc;
+    }
+    atomic_store(&w->count, 0);
+}
@@ -0,0 +1,49 @@
+/**
+ * @File wakelist.h
+ *
+ * The event loops to wake when something a parked connection waits on,
+ * a per-URI lock or a group commit, may have become ready. Each loop is
+ * one eventfd, added once however many of its connections wait. The
+ * list is guarded by its owner's lock, except that wakelist_pending may
+ * be checked without it.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdatomic.h>
+
+/** @struct wakeList
+ *
+ *  @brief The eventfds to write to on the next wake, embedded in whatever
+ *  the loops wait on.
+ */
+typedef struct wakeList {
+    int *fds;
+    _Atomic int count;
+    int size;
+} wakeList;
+
+/** @brief Initialize an empty list.
+ */
+void wakelist_init(wakeList *w);
+
+/** @brief Free the list's memory, without waking anyone.
+ */
+void wakelist_free(wakeList *w);
+
+/** @brief Have fd written to on the next wakelist_wake. A caller that
+ *  parks after a failed try must try once more after adding itself, a
+ *  wake in between would otherwise be lost.
+ */
+void wakelist_add(wakeList *w, int fd);
+
+/** @brief Whether any fd was added since the last wake. Sequentially
+ *  consistent, so a waker that changed the state first and then sees
+ *  false knows every waiter that saw the old state gets woken.
+ */
+bool wakelist_pending(wakeList *w);
+
+/** @brief Write to every fd on the list and empty it.
+ */
+void wakelist_wake(wakeList *w);